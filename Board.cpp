@@ -0,0 +1,86 @@
+/*
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Library General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ *
+ * Board.cpp
+ * Copyright (C) 2011 Simon Newton
+ */
+
+#include "Board.h"
+
+#if defined(__AVR_ATmega328P__)
+const byte Board::PWM_PINS[] = {3, 5, 6, 9, 10, 11};
+const pwm_channel Board::PWM_CHANNELS[] = {
+  {0xb4, 0xb0, _BV(5), 0},  // OC2B
+  {0x48, 0x44, _BV(5), PWM_CHANNEL_FAST},  // OC0B
+  {0x47, 0x44, _BV(7), PWM_CHANNEL_FAST},  // OC0A
+  {0x88, 0x80, _BV(7), PWM_CHANNEL_16BIT},  // OC1A
+  {0x8a, 0x80, _BV(5), PWM_CHANNEL_16BIT},  // OC1B
+  {0xb3, 0xb0, _BV(7), 0},  // OC2A
+};
+const pwm_timer Board::PWM_TIMERS[] = {
+  {0x44, 0x45, 0x07, {3, 2, 1}, PWM_TIMER_MILLIS | PWM_TIMER_FAST},  // Timer0
+  {0x80, 0x81, 0x07, {3, 2, 1}, PWM_TIMER_LATCH},  // Timer1
+  {0xb0, 0xb1, 0x07, {4, 2, 1}, 0},  // Timer2
+};
+
+#elif defined(__AVR_ATmega32U4__)
+const byte Board::PWM_PINS[] = {3, 5, 6, 9, 10, 11};
+const pwm_channel Board::PWM_CHANNELS[] = {
+  {0x48, 0x44, _BV(5), PWM_CHANNEL_FAST},  // OC0B
+  {0x98, 0x90, _BV(7), PWM_CHANNEL_16BIT},  // OC3A
+  {0xd2, 0xc2, _BV(3), 0},  // OC4D, TC4H is left at 0
+  {0x88, 0x80, _BV(7), PWM_CHANNEL_16BIT},  // OC1A
+  {0x8a, 0x80, _BV(5), PWM_CHANNEL_16BIT},  // OC1B
+  {0x47, 0x44, _BV(7), PWM_CHANNEL_FAST},  // OC0A
+};
+const pwm_timer Board::PWM_TIMERS[] = {
+  {0x44, 0x45, 0x07, {3, 2, 1}, PWM_TIMER_MILLIS | PWM_TIMER_FAST},  // Timer0
+  {0x80, 0x81, 0x07, {3, 2, 1}, PWM_TIMER_LATCH},  // Timer1
+  {0x90, 0x91, 0x07, {3, 2, 1}, 0},  // Timer3
+  // Timer4 has four CS bits, TOP is OCR4C which init() sets to 255
+  {0xc2, 0xc1, 0x0f, {7, 4, 1}, 0},  // Timer4
+};
+const unsigned int Board::DMX_USARTS[] = {0xc8};
+
+#elif defined(__AVR_ATmega2560__)
+const byte Board::PWM_PINS[] = {2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 44, 45,
+                                46};
+const pwm_channel Board::PWM_CHANNELS[] = {
+  {0x9a, 0x90, _BV(5), PWM_CHANNEL_16BIT},  // OC3B
+  {0x9c, 0x90, _BV(3), PWM_CHANNEL_16BIT},  // OC3C
+  {0x48, 0x44, _BV(5), PWM_CHANNEL_FAST},  // OC0B
+  {0x98, 0x90, _BV(7), PWM_CHANNEL_16BIT},  // OC3A
+  {0xa8, 0xa0, _BV(7), PWM_CHANNEL_16BIT},  // OC4A
+  {0xaa, 0xa0, _BV(5), PWM_CHANNEL_16BIT},  // OC4B
+  {0xac, 0xa0, _BV(3), PWM_CHANNEL_16BIT},  // OC4C
+  {0xb4, 0xb0, _BV(5), 0},  // OC2B
+  {0xb3, 0xb0, _BV(7), 0},  // OC2A
+  {0x88, 0x80, _BV(7), PWM_CHANNEL_16BIT},  // OC1A
+  {0x8a, 0x80, _BV(5), PWM_CHANNEL_16BIT},  // OC1B
+  {0x47, 0x44, _BV(7), PWM_CHANNEL_FAST},  // OC0A
+  {0x12c, 0x120, _BV(3), PWM_CHANNEL_16BIT},  // OC5C
+  {0x12a, 0x120, _BV(5), PWM_CHANNEL_16BIT},  // OC5B
+  {0x128, 0x120, _BV(7), PWM_CHANNEL_16BIT},  // OC5A
+};
+const pwm_timer Board::PWM_TIMERS[] = {
+  {0x44, 0x45, 0x07, {3, 2, 1}, PWM_TIMER_MILLIS | PWM_TIMER_FAST},  // Timer0
+  {0x80, 0x81, 0x07, {3, 2, 1}, PWM_TIMER_LATCH},  // Timer1
+  {0xb0, 0xb1, 0x07, {4, 2, 1}, 0},  // Timer2
+  {0x90, 0x91, 0x07, {3, 2, 1}, 0},  // Timer3
+  {0xa0, 0xa1, 0x07, {3, 2, 1}, 0},  // Timer4
+  {0x120, 0x121, 0x07, {3, 2, 1}, 0},  // Timer5
+};
+const unsigned int Board::DMX_USARTS[] = {0xc8, 0xd0, 0x130};
+#endif
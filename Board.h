@@ -0,0 +1,198 @@
+/*
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Library General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ *
+ * Board.h
+ * Copyright (C) 2011 Simon Newton
+ * Compile time pin assignments for each supported MCU. The board is selected
+ * by the MCU setting in the Makefile.
+ */
+
+#include "Arduino.h"
+
+#ifndef BOARD_H
+#define BOARD_H
+
+/**
+ * A digital pin, PORT_ADDRESS is the data memory address of the PORTx
+ * register. Since everything is known at compile time, pins in the I/O space
+ * compile down to single SBI / CBI instructions.
+ */
+template <unsigned int PORT_ADDRESS, byte BIT>
+class FastPin {
+  public:
+    static void Output() { _SFR_MEM8(PORT_ADDRESS - 1) |= _BV(BIT); }
+    static void High() { _SFR_MEM8(PORT_ADDRESS) |= _BV(BIT); }
+    static void Low() { _SFR_MEM8(PORT_ADDRESS) &= ~_BV(BIT); }
+    // writing a 1 to PINx toggles the pin
+    static void Toggle() { _SFR_MEM8(PORT_ADDRESS - 2) = _BV(BIT); }
+
+    static void Set(bool on) {
+      if (on)
+        High();
+      else
+        Low();
+    }
+};
+
+/**
+ * A PWM output. The addresses are data memory addresses of the output compare
+ * register and the TCCRnA / TCCRnC register that holds the COMnx bits.
+ */
+typedef struct {
+  unsigned int ocr_address;
+  unsigned int tccr_address;
+  byte com_mask;  // the COMnx1 bit
+  byte flags;
+} pwm_channel;
+
+enum {
+  // Timer0 stays in fast PWM mode for millis(). A compare value of 0 there
+  // still gives a 1 tick pulse so the output has to be disconnected.
+  PWM_CHANNEL_FAST = 0x01,
+  // A 16 bit timer running in 8 bit mode, the high byte must be written too.
+  PWM_CHANNEL_16BIT = 0x02,
+};
+
+/**
+ * A timer that drives PWM outputs, the outputs on a timer share its carrier
+ * frequency. The addresses are data memory addresses.
+ */
+typedef struct {
+  unsigned int tccr_address;  // the pwm_channel tccr_address of its outputs
+  unsigned int clock_address;  // the TCCRnB register, with the CS bits
+  byte clock_mask;  // the CS bits
+  byte clock_select[3];  // the CS values for /64, /8 & /1
+  byte flags;
+} pwm_timer;
+
+enum {
+  // Timer0 also keeps time for millis() & micros(), see PwmCarrier.cpp
+  PWM_TIMER_MILLIS = 0x01,
+  // Timer1's overflow latches the outputs
+  PWM_TIMER_LATCH = 0x02,
+  // fast PWM, the period is 256 ticks rather than 510
+  PWM_TIMER_FAST = 0x04,
+};
+
+// Register offsets from the UCSRnA address of a USART
+enum {
+  USART_UCSRB_OFFSET = 1,
+  USART_UCSRC_OFFSET = 2,
+  USART_UBRRL_OFFSET = 4,
+  USART_UBRRH_OFFSET = 5,
+  USART_UDR_OFFSET = 6,
+};
+
+// PORTx addresses, PINx and DDRx are the two addresses below these.
+enum {
+  PORTA_ADDRESS = 0x22,
+  PORTB_ADDRESS = 0x25,
+  PORTC_ADDRESS = 0x28,
+  PORTD_ADDRESS = 0x2b,
+  PORTE_ADDRESS = 0x2e,
+};
+
+#if defined(__AVR_ATmega328P__)
+
+// Arduino Uno / Duemilanove. USART0 is the USB link so there are no DMX
+// ports.
+#define DMX_USART_COUNT 0
+#define HOST_USART_RX_vect USART_RX_vect
+class Board {
+  public:
+    enum { PWM_OUTPUT_COUNT = 6 };
+    // receive buffers for host messages, see UsbProReceiver.h
+    enum { HOST_LARGE_BUFFERS = 1, HOST_SMALL_BUFFERS = 1 };
+    // D13 & D12
+    typedef FastPin<PORTB_ADDRESS, 5> LedPin;
+    typedef FastPin<PORTB_ADDRESS, 4> IdentifyLedPin;
+    static const byte TEMP_SENSOR_PIN = 0;
+    static const byte PWM_PINS[PWM_OUTPUT_COUNT];
+    static const pwm_channel PWM_CHANNELS[PWM_OUTPUT_COUNT];
+    enum { PWM_TIMER_COUNT = 3 };
+    static const pwm_timer PWM_TIMERS[PWM_TIMER_COUNT];
+};
+#define PWM_OUTPUT_COUNT_STRING "6"
+#define PWM_OUTPUT_COUNT_LESS_3_STRING "3"
+
+#elif defined(__AVR_ATmega32U4__)
+
+// Arduino Leonardo. USB is native, so USART1 is free for DMX. The host
+// messages arrive over the USB CDC endpoint rather than a USART.
+#define DMX_USART_COUNT 1
+#define DMX_INPUT_RX_vect USART1_RX_vect
+#define DMX_INPUT_UDRE_vect USART1_UDRE_vect
+#define DMX_INPUT_TX_vect USART1_TX_vect
+class Board {
+  public:
+    enum { PWM_OUTPUT_COUNT = 6 };
+    // D13 & D12
+    typedef FastPin<PORTC_ADDRESS, 7> LedPin;
+    typedef FastPin<PORTD_ADDRESS, 6> IdentifyLedPin;
+    // D4, the RS-485 driver enable for the DMX input
+    typedef FastPin<PORTD_ADDRESS, 4> DmxDirectionPin;
+    static const byte TEMP_SENSOR_PIN = 0;
+    static const byte PWM_PINS[PWM_OUTPUT_COUNT];
+    static const pwm_channel PWM_CHANNELS[PWM_OUTPUT_COUNT];
+    enum { PWM_TIMER_COUNT = 4 };
+    static const pwm_timer PWM_TIMERS[PWM_TIMER_COUNT];
+    static const unsigned int DMX_USARTS[DMX_USART_COUNT];
+};
+#define PWM_OUTPUT_COUNT_STRING "6"
+#define PWM_OUTPUT_COUNT_LESS_3_STRING "3"
+
+#elif defined(__AVR_ATmega2560__)
+
+// Arduino Mega 2560. D13 is one of the PWM outputs so the LEDs move to D22 &
+// D23. USART1 - 3 drive the DMX ports.
+#define DMX_USART_COUNT 3
+#define DMX_INPUT_RX_vect USART3_RX_vect
+#define DMX_INPUT_UDRE_vect USART3_UDRE_vect
+#define DMX_INPUT_TX_vect USART3_TX_vect
+#define HOST_USART_RX_vect USART0_RX_vect
+class Board {
+  public:
+    enum { PWM_OUTPUT_COUNT = 15 };
+    enum { HOST_LARGE_BUFFERS = 3, HOST_SMALL_BUFFERS = 2 };
+    typedef FastPin<PORTA_ADDRESS, 0> LedPin;
+    typedef FastPin<PORTA_ADDRESS, 1> IdentifyLedPin;
+    // D24, the RS-485 driver enable for the DMX input
+    typedef FastPin<PORTA_ADDRESS, 2> DmxDirectionPin;
+    static const byte TEMP_SENSOR_PIN = 0;
+    static const byte PWM_PINS[PWM_OUTPUT_COUNT];
+    static const pwm_channel PWM_CHANNELS[PWM_OUTPUT_COUNT];
+    enum { PWM_TIMER_COUNT = 6 };
+    static const pwm_timer PWM_TIMERS[PWM_TIMER_COUNT];
+    static const unsigned int DMX_USARTS[DMX_USART_COUNT];
+};
+#define PWM_OUTPUT_COUNT_STRING "15"
+#define PWM_OUTPUT_COUNT_LESS_3_STRING "12"
+
+#else
+#error "Unsupported MCU, see Board.h"
+#endif
+
+// When DMX_INPUT is defined the last USART receives DMX & answers RDM, the
+// rest transmit.
+#ifdef DMX_INPUT
+#if DMX_USART_COUNT == 0
+#error "DMX_INPUT needs a spare USART, see Board.h"
+#endif
+#define DMX_PORT_COUNT (DMX_USART_COUNT - 1)
+#else
+#define DMX_PORT_COUNT DMX_USART_COUNT
+#endif
+
+#endif  // BOARD_H
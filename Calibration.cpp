@@ -0,0 +1,85 @@
+/*
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Library General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ * Calibration.cpp
+ * Copyright (C) 2011 Simon Newton
+ */
+
+#include "Calibration.h"
+#include "ColourMath.h"
+#include "Profiler.h"
+
+
+void CalibrationClass::Init() {
+  for (byte i = 0; i < RGB_TRIPLET_COUNT; ++i)
+    WidgetSettings.CalibrationMatrix(i, m_matrices[i]);
+  m_valid = 0;
+}
+
+
+/**
+ * Calibrate a set of output levels.
+ * @param levels PWM_OUTPUT_COUNT levels
+ * @param calibrated PWM_OUTPUT_COUNT calibrated levels
+ */
+void CalibrationClass::Apply(const byte *levels, byte *calibrated) {
+  PROFILE_SCOPE(PROFILE_CALIBRATE);
+  for (byte i = 0; i < RGB_TRIPLET_COUNT; ++i) {
+    const byte *input = levels + 3 * i;
+    byte mask = 1 << i;
+    if (!(m_valid & mask) || memcmp(input, m_input[i], 3)) {
+      memcpy(m_input[i], input, 3);
+      Multiply(m_matrices[i], input, m_output[i]);
+      m_valid |= mask;
+    }
+    memcpy(calibrated + 3 * i, m_output[i], 3);
+  }
+
+  for (byte i = 3 * RGB_TRIPLET_COUNT; i < PWM_OUTPUT_COUNT; ++i)
+    calibrated[i] = levels[i];
+}
+
+
+/**
+ * Set the matrix for a triplet, this is saved in the settings.
+ */
+void CalibrationClass::SetMatrix(byte triplet, const byte *matrix) {
+  memcpy(m_matrices[triplet], matrix, MATRIX_SIZE);
+  // the EEPROM write yields, and a frame applied meanwhile needs the new matrix
+  m_valid &= ~(1 << triplet);
+  WidgetSettings.SetCalibrationMatrix(triplet, matrix);
+  m_changed = true;
+}
+
+
+bool CalibrationClass::MatrixChanged() {
+  bool changed = m_changed;
+  m_changed = false;
+  return changed;
+}
+
+
+void CalibrationClass::Multiply(const byte *matrix,
+                                const byte *input,
+                                byte *output) {
+  for (byte row = 0; row < 3; ++row) {
+    unsigned int sum = Scale8(input[0], matrix[0]);
+    sum += Scale8(input[1], matrix[1]);
+    sum += Scale8(input[2], matrix[2]);
+    output[row] = sum > 255 ? 255 : sum;
+    matrix += 3;
+  }
+}
+
+CalibrationClass Calibration;
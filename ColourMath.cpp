@@ -0,0 +1,62 @@
+/*
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Library General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ *
+ * ColourMath.cpp
+ * Copyright (C) 2011 Simon Newton
+ */
+
+#include "ColourMath.h"
+
+
+/**
+ * Convert hue, saturation & intensity to RGB.
+ *
+ * The hue wheel is split into three sectors (R->G, G->B, B->R). Within a
+ * sector the two active channels always sum to the intensity, so a hue fade
+ * doesn't change the light output. Reducing the saturation mixes in white at
+ * the same intensity.
+ * @param hue the hue, 0 - 255 covers the full wheel
+ * @param saturation the saturation, 0 is white
+ * @param intensity the intensity
+ * @param rgb the output array, 3 bytes
+ */
+void HsiToRgb(byte hue, byte saturation, byte intensity, byte *rgb) {
+  unsigned int position = hue * 3;
+  byte sector = position >> 8;
+  byte fraction = position;
+
+  byte rising = Scale8(intensity, fraction);
+  byte falling = intensity - rising;
+  byte white = Scale8(intensity, 255 - saturation);
+  rising = Scale8(rising, saturation) + white;
+  falling = Scale8(falling, saturation) + white;
+
+  switch (sector) {
+    case 0:
+      rgb[0] = falling;
+      rgb[1] = rising;
+      rgb[2] = white;
+      break;
+    case 1:
+      rgb[0] = white;
+      rgb[1] = falling;
+      rgb[2] = rising;
+      break;
+    default:
+      rgb[0] = rising;
+      rgb[1] = white;
+      rgb[2] = falling;
+  }
+}
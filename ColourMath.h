@@ -0,0 +1,35 @@
+/*
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Library General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ *
+ * ColourMath.h
+ * Copyright (C) 2011 Simon Newton
+ * Integer colour conversions, these only use 8x8 bit multiplies.
+ */
+
+#include "Arduino.h"
+
+#ifndef COLOUR_MATH_H
+#define COLOUR_MATH_H
+
+/**
+ * Scale a value by scale / 255. Scale8(x, 255) == x.
+ */
+inline byte Scale8(byte value, byte scale) {
+  return ((unsigned int) value * scale + value) >> 8;
+}
+
+void HsiToRgb(byte hue, byte saturation, byte intensity, byte *rgb);
+
+#endif  // COLOUR_MATH_H
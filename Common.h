@@ -33,4 +33,10 @@ extern byte MANUFACTURER_NAME_SIZE;
 // global objects
 extern UsbProSender sender;
 
+// the current output levels, before the master & strobe are applied
+extern byte output_levels[];
+
+// stage output_levels for the PWM driver, see main.cpp
+void WriteOutputs();
+
 #endif  // COMMON_H
@@ -0,0 +1,246 @@
+/*
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Library General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ *
+ * DmxReceiver.cpp
+ * Copyright (C) 2011 Simon Newton
+ */
+
+#include <util/atomic.h>
+#include "DmxReceiver.h"
+#include "RDMEnums.h"
+
+#ifdef DMX_INPUT
+
+// 8 data bits, 2 stop bits, no parity
+static const byte DMX_FRAME_FORMAT = _BV(USBS1) | _BV(UCSZ11) | _BV(UCSZ10);
+
+
+DmxReceiverClass::DmxReceiverClass()
+    : m_usart(Board::DMX_USARTS[DMX_USART_COUNT - 1]),
+      m_state(RX_IDLE),
+      m_slot(0),
+      m_frame_size(0),
+      m_frame_count(0),
+      m_read_count(0),
+      m_request_ready(false),
+      m_request_size(0),
+      m_request_time(0),
+      m_response_size(0),
+      m_response_slot(0),
+      m_late_responses(0) {
+}
+
+
+/**
+ * Setup the USART & the transceiver direction pin.
+ */
+void DmxReceiverClass::Init() {
+  Board::DmxDirectionPin::Output();
+  _SFR_MEM8(m_usart) = 0;
+  _SFR_MEM8(m_usart + USART_UCSRC_OFFSET) = DMX_FRAME_FORMAT;
+  StartReceiving();
+}
+
+
+bool DmxReceiverClass::FrameReady() {
+  byte count = m_frame_count;
+  if (count == m_read_count)
+    return false;
+  m_read_count = count;
+  return true;
+}
+
+
+unsigned int DmxReceiverClass::FrameSize() const {
+  unsigned int size;
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    size = m_frame_size;
+  }
+  return size;
+}
+
+
+/**
+ * Send the response to the last request. Responses start with a break,
+ * discovery responses don't.
+ * @param size the number of bytes in the response buffer, or 0 if there
+ * isn't a response.
+ */
+void DmxReceiverClass::SendResponse(unsigned int size) {
+  if (!size) {
+    m_request_ready = false;
+    return;
+  }
+
+  if (micros() - m_request_time > MAX_TURNAROUND_US) {
+    // the controller has given up, a late response could collide with
+    // whatever it sends next
+    m_late_responses++;
+    m_request_ready = false;
+    return;
+  }
+
+  while (micros() - m_request_time < MIN_TURNAROUND_US) {}
+
+  unsigned int usart = m_usart;
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    _SFR_MEM8(usart + USART_UCSRB_OFFSET) = 0;
+    // the receiver stays off until TransmitComplete(), so no request arrives
+    // while this one's response is sent
+    m_request_ready = false;
+    Board::DmxDirectionPin::High();
+    m_response_size = size;
+    m_response_slot = 0;
+
+    unsigned int ubrr;
+    if (m_response[0] == START_CODE) {
+      ubrr = BREAK_BIT_US * (F_CPU / 1000000) / 16 - 1;
+      m_state = TX_BREAK;
+    } else {
+      ubrr = F_CPU / 16 / DMX_BAUD - 1;
+      m_state = TX_DATA;
+    }
+    _SFR_MEM8(usart + USART_UBRRH_OFFSET) = ubrr >> 8;
+    _SFR_MEM8(usart + USART_UBRRL_OFFSET) = ubrr;
+
+    if (m_state == TX_BREAK) {
+      _SFR_MEM8(usart + USART_UDR_OFFSET) = 0;
+      _SFR_MEM8(usart) = _BV(TXC1);
+      _SFR_MEM8(usart + USART_UCSRB_OFFSET) = _BV(TXEN1) | _BV(TXCIE1);
+    } else {
+      _SFR_MEM8(usart + USART_UCSRB_OFFSET) = _BV(TXEN1) | _BV(UDRIE1);
+    }
+  }
+}
+
+
+/**
+ * Handle a received byte. A framing error is the break, the byte after that
+ * is the start code.
+ */
+void DmxReceiverClass::ReceiveByte() {
+  byte status = _SFR_MEM8(m_usart);
+  byte data = _SFR_MEM8(m_usart + USART_UDR_OFFSET);
+
+  if (status & _BV(FE1)) {
+    if (m_state == RX_DMX)
+      CompleteFrame();
+    m_state = RX_START_CODE;
+    return;
+  }
+
+  switch (m_state) {
+    case RX_START_CODE:
+      if (data == 0) {
+        m_slot = 0;
+        m_state = RX_DMX;
+      } else if (data == START_CODE && !m_request_ready) {
+        m_request[0] = data;
+        m_request_size = 1;
+        m_state = RX_RDM;
+      } else {
+        m_state = RX_IDLE;
+      }
+      break;
+    case RX_DMX:
+      m_frame[m_slot++] = data;
+      if (m_slot == DMX_SLOTS) {
+        CompleteFrame();
+        m_state = RX_IDLE;
+      }
+      break;
+    case RX_RDM:
+      m_request[m_request_size++] = data;
+      if (m_request_size == 3 && data < MINIMUM_RDM_PACKET_SIZE - 2) {
+        m_state = RX_IDLE;
+      } else if (m_request_size > 3 &&
+                 m_request_size == m_request[2] + 2u) {
+        // the message length doesn't include the checksum
+        m_request_time = micros();
+        m_request_ready = true;
+        m_state = RX_IDLE;
+      }
+      break;
+    default:
+      break;
+  }
+}
+
+
+/**
+ * Send the next byte of the response.
+ */
+void DmxReceiverClass::DataRegisterEmpty() {
+  if (m_response_slot < m_response_size) {
+    _SFR_MEM8(m_usart + USART_UDR_OFFSET) = m_response[m_response_slot++];
+  } else {
+    _SFR_MEM8(m_usart) = _BV(TXC1);
+    _SFR_MEM8(m_usart + USART_UCSRB_OFFSET) = _BV(TXEN1) | _BV(TXCIE1);
+  }
+}
+
+
+/**
+ * Called once the break, or the last byte of the response, has been sent.
+ */
+void DmxReceiverClass::TransmitComplete() {
+  if (m_state == TX_BREAK) {
+    unsigned int ubrr = F_CPU / 16 / DMX_BAUD - 1;
+    _SFR_MEM8(m_usart + USART_UBRRH_OFFSET) = ubrr >> 8;
+    _SFR_MEM8(m_usart + USART_UBRRL_OFFSET) = ubrr;
+    _SFR_MEM8(m_usart + USART_UDR_OFFSET) = m_response[0];
+    m_response_slot = 1;
+    m_state = TX_DATA;
+    _SFR_MEM8(m_usart + USART_UCSRB_OFFSET) = _BV(TXEN1) | _BV(UDRIE1);
+  } else {
+    StartReceiving();
+  }
+}
+
+
+void DmxReceiverClass::CompleteFrame() {
+  if (m_slot) {
+    m_frame_size = m_slot;
+    m_frame_count++;
+  }
+}
+
+
+/**
+ * Release the line and go back to listening.
+ */
+void DmxReceiverClass::StartReceiving() {
+  Board::DmxDirectionPin::Low();
+  unsigned int ubrr = F_CPU / 16 / DMX_BAUD - 1;
+  _SFR_MEM8(m_usart + USART_UBRRH_OFFSET) = ubrr >> 8;
+  _SFR_MEM8(m_usart + USART_UBRRL_OFFSET) = ubrr;
+  m_state = RX_IDLE;
+  _SFR_MEM8(m_usart + USART_UCSRB_OFFSET) = _BV(RXEN1) | _BV(RXCIE1);
+}
+
+DmxReceiverClass DmxReceiver;
+
+ISR(DMX_INPUT_RX_vect) {
+  DmxReceiver.ReceiveByte();
+}
+
+ISR(DMX_INPUT_UDRE_vect) {
+  DmxReceiver.DataRegisterEmpty();
+}
+
+ISR(DMX_INPUT_TX_vect) {
+  DmxReceiver.TransmitComplete();
+}
+#endif  // DMX_INPUT
@@ -0,0 +1,111 @@
+/*
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Library General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ *
+ * DmxReceiver.h
+ * Copyright (C) 2011 Simon Newton
+ * DMX512 input and the RDM responder on the line.
+ */
+
+#include "Arduino.h"
+#include "Board.h"
+
+#ifndef DMX_RECEIVER_H
+#define DMX_RECEIVER_H
+
+#ifdef DMX_INPUT
+
+/**
+ * Receives DMX & RDM on the last USART, and sends the RDM responses. The
+ * transceiver is half duplex so the receiver is off while a response is
+ * sent.
+ */
+class DmxReceiverClass {
+  public:
+    DmxReceiverClass();
+
+    void Init();
+
+    // Returns true once for each complete DMX frame. The frame is filled in
+    // place, so it may already hold slots from the next frame when it's read.
+    bool FrameReady();
+    const byte *Frame() const { return m_frame; }
+    unsigned int FrameSize() const;
+
+    // True when an RDM request is waiting, further requests are dropped
+    // until SendResponse() is called and any response has been sent.
+    bool RequestReady() const { return m_request_ready; }
+    const byte *Request() const { return m_request; }
+    unsigned int RequestSize() const { return m_request_size; }
+
+    byte *ResponseBuffer() { return m_response; }
+    // Send size bytes from the response buffer, 0 drops the request. The
+    // response is dropped if it's too late to send.
+    void SendResponse(unsigned int size);
+
+    // The number of responses dropped because the request waited too long
+    unsigned int LateResponses() const { return m_late_responses; }
+
+    // the largest RDM message, including the checksum
+    enum { RDM_BUFFER_SIZE = 257 };
+
+    // Called from the USART interrupts
+    void ReceiveByte();
+    void DataRegisterEmpty();
+    void TransmitComplete();
+
+  private:
+    typedef enum {
+      RX_IDLE,
+      RX_START_CODE,
+      RX_DMX,
+      RX_RDM,
+      TX_BREAK,
+      TX_DATA,
+    } receiver_state;
+
+    enum { DMX_SLOTS = 512 };
+
+    unsigned int m_usart;  // the UCSRnA address
+    receiver_state m_state;
+    unsigned int m_slot;
+    unsigned int m_frame_size;
+    volatile byte m_frame_count;
+    byte m_read_count;
+    byte m_frame[DMX_SLOTS];
+
+    volatile bool m_request_ready;
+    unsigned int m_request_size;
+    unsigned long m_request_time;  // micros() at the end of the request
+    byte m_request[RDM_BUFFER_SIZE];
+
+    unsigned int m_response_size;
+    unsigned int m_response_slot;
+    byte m_response[RDM_BUFFER_SIZE];
+    unsigned int m_late_responses;
+
+    void CompleteFrame();
+    void StartReceiving();
+
+    // E1.20 responder timing
+    static const unsigned int MIN_TURNAROUND_US = 176;
+    static const unsigned int MAX_TURNAROUND_US = 2000;
+    static const unsigned long DMX_BAUD = 250000;
+    // a 0 sent with 20uS bits gives a 180uS break and a 40uS MAB
+    static const unsigned int BREAK_BIT_US = 20;
+};
+
+extern DmxReceiverClass DmxReceiver;
+#endif  // DMX_INPUT
+#endif  // DMX_RECEIVER_H
@@ -0,0 +1,231 @@
+/*
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Library General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ *
+ * DmxTransmitter.cpp
+ * Copyright (C) 2011 Simon Newton
+ *
+ * The break & MAB are sent as a single byte at a lower baud rate. The start
+ * bit and the leading 0 data bits form the break, the remaining 1 bits and
+ * the two stop bits form the MAB. Once the byte has gone out the baud rate is
+ * switched to 250k and the frame follows.
+ */
+
+#include <util/atomic.h>
+#include "DmxTransmitter.h"
+#include "Effects.h"
+
+#if DMX_PORT_COUNT > 0
+
+// The widget parameter limits, in 10.67uS units
+enum {
+  MIN_BREAK_TIME = 9,
+  MAX_BREAK_TIME = 127,
+  MIN_MAB_TIME = 1,
+  MAX_MAB_TIME = 127,
+};
+
+// 8 data bits, 2 stop bits, no parity
+static const byte DMX_FRAME_FORMAT = _BV(USBS1) | _BV(UCSZ11) | _BV(UCSZ10);
+
+
+DmxTransmitterClass::DmxTransmitterClass()
+    : m_break_ubrr(0),
+      m_break_pattern(0),
+      m_refresh_ticks(0) {
+  for (byte i = 0; i < DMX_PORT_COUNT; ++i) {
+    m_ports[i].usart = Board::DMX_USARTS[i];
+    m_ports[i].state = PORT_IDLE;
+    m_ports[i].slot = 0;
+    m_ports[i].frame_size = 0;
+    m_ports[i].ticks = 0;
+  }
+}
+
+
+/**
+ * Setup the USARTs for transmit only.
+ */
+void DmxTransmitterClass::Init() {
+  for (byte i = 0; i < DMX_PORT_COUNT; ++i) {
+    unsigned int usart = m_ports[i].usart;
+    _SFR_MEM8(usart) = 0;
+    _SFR_MEM8(usart + USART_UCSRC_OFFSET) = DMX_FRAME_FORMAT;
+    _SFR_MEM8(usart + USART_UCSRB_OFFSET) = _BV(TXEN1);
+  }
+}
+
+
+/**
+ * Work out the break byte for a set of timing parameters.
+ * @param break_time the break time in 10.67uS units
+ * @param mab_time the mark after break time in 10.67uS units
+ * @param refresh_rate the maximum frame rate, or 0 for as fast as possible.
+ */
+void DmxTransmitterClass::SetTiming(byte break_time,
+                                    byte mab_time,
+                                    byte refresh_rate) {
+  break_time = constrain(break_time, MIN_BREAK_TIME, MAX_BREAK_TIME);
+  mab_time = constrain(mab_time, MIN_MAB_TIME, MAX_MAB_TIME);
+
+  // Use as many bits as possible for the break, while leaving enough high
+  // bits for the MAB. The bit time is then the break time / low bits.
+  byte low_bits = 9;
+  while (low_bits > 1 &&
+         (11 - low_bits) * break_time < low_bits * mab_time)
+    low_bits--;
+
+  // 10.67uS is 32 / 3 uS, round the bit time up so the break isn't short
+  unsigned int bit_time_us = (break_time * 32 + 3 * low_bits - 1) /
+                             (3 * low_bits);
+  unsigned int ubrr = bit_time_us * (F_CPU / 1000000) / 16 - 1;
+  unsigned int refresh_ticks =
+    refresh_rate ? EffectsClass::TICK_HZ / refresh_rate : 0;
+
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    m_break_ubrr = ubrr;
+    m_break_pattern = 0xff << (low_bits - 1);
+    m_refresh_ticks = refresh_ticks;
+  }
+}
+
+
+/**
+ * Update the frame for a port. The copy isn't synchronized with the
+ * transmitter, a frame that is going out may contain slots from both the old
+ * & new data.
+ * @param port the port index
+ * @param data the frame, starting with the start code
+ * @param size the size of the frame
+ */
+void DmxTransmitterClass::SetFrame(byte port,
+                                   const byte *data,
+                                   unsigned int size) {
+  if (port >= DMX_PORT_COUNT || !size)
+    return;
+
+  dmx_port &dmx = m_ports[port];
+  size = min(size, (unsigned int) DMX_FRAME_SIZE);
+  memcpy(dmx.frame, data, size);
+  if (size < MIN_FRAME_SIZE) {
+    memset(dmx.frame + size, 0, MIN_FRAME_SIZE - size);
+    size = MIN_FRAME_SIZE;
+  }
+
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    dmx.frame_size = size;
+  }
+}
+
+
+/**
+ * Start the next frame on any idle ports that are due one.
+ */
+void DmxTransmitterClass::Tick() {
+  for (byte i = 0; i < DMX_PORT_COUNT; ++i) {
+    dmx_port &dmx = m_ports[i];
+    if (dmx.ticks != 0xffff)
+      dmx.ticks++;
+    if (dmx.state == PORT_IDLE && dmx.frame_size &&
+        dmx.ticks >= m_refresh_ticks)
+      StartBreak(&dmx);
+  }
+}
+
+
+/**
+ * Send the next slot.
+ */
+void DmxTransmitterClass::DataRegisterEmpty(byte port) {
+  dmx_port &dmx = m_ports[port];
+  if (dmx.slot < dmx.frame_size) {
+    _SFR_MEM8(dmx.usart + USART_UDR_OFFSET) = dmx.frame[dmx.slot++];
+  } else {
+    // wait for the last slot to leave the shift register, clearing any old
+    // transmit complete so it can't fire early
+    _SFR_MEM8(dmx.usart) = _BV(TXC1);
+    _SFR_MEM8(dmx.usart + USART_UCSRB_OFFSET) = _BV(TXEN1) | _BV(TXCIE1);
+  }
+}
+
+
+/**
+ * Called when the break byte or the last slot has been sent.
+ */
+void DmxTransmitterClass::TransmitComplete(byte port) {
+  dmx_port &dmx = m_ports[port];
+  unsigned int usart = dmx.usart;
+  if (dmx.state == PORT_BREAK) {
+    // we're in the MAB, switch to 250k and send the start code
+    unsigned int ubrr = F_CPU / 16 / DMX_BAUD - 1;
+    _SFR_MEM8(usart + USART_UBRRH_OFFSET) = ubrr >> 8;
+    _SFR_MEM8(usart + USART_UBRRL_OFFSET) = ubrr;
+    _SFR_MEM8(usart + USART_UDR_OFFSET) = dmx.frame[0];
+    dmx.slot = 1;
+    dmx.state = PORT_DATA;
+    _SFR_MEM8(usart + USART_UCSRB_OFFSET) = _BV(TXEN1) | _BV(UDRIE1);
+  } else if (dmx.ticks >= m_refresh_ticks) {
+    StartBreak(&dmx);
+  } else {
+    dmx.state = PORT_IDLE;
+    _SFR_MEM8(usart + USART_UCSRB_OFFSET) = _BV(TXEN1);
+  }
+}
+
+
+/**
+ * Send the break byte, this must only be called when the transmitter is
+ * empty.
+ */
+void DmxTransmitterClass::StartBreak(dmx_port *dmx) {
+  unsigned int usart = dmx->usart;
+  _SFR_MEM8(usart + USART_UBRRH_OFFSET) = m_break_ubrr >> 8;
+  _SFR_MEM8(usart + USART_UBRRL_OFFSET) = m_break_ubrr;
+  _SFR_MEM8(usart + USART_UDR_OFFSET) = m_break_pattern;
+  dmx->state = PORT_BREAK;
+  dmx->ticks = 0;
+  _SFR_MEM8(usart) = _BV(TXC1);
+  _SFR_MEM8(usart + USART_UCSRB_OFFSET) = _BV(TXEN1) | _BV(TXCIE1);
+}
+
+DmxTransmitterClass DmxTransmitter;
+
+ISR(USART1_UDRE_vect) {
+  DmxTransmitter.DataRegisterEmpty(0);
+}
+
+ISR(USART1_TX_vect) {
+  DmxTransmitter.TransmitComplete(0);
+}
+
+#if DMX_PORT_COUNT > 1
+ISR(USART2_UDRE_vect) {
+  DmxTransmitter.DataRegisterEmpty(1);
+}
+
+ISR(USART2_TX_vect) {
+  DmxTransmitter.TransmitComplete(1);
+}
+#endif
+
+#if DMX_PORT_COUNT > 2
+ISR(USART3_UDRE_vect) {
+  DmxTransmitter.DataRegisterEmpty(2);
+}
+
+ISR(USART3_TX_vect) {
+  DmxTransmitter.TransmitComplete(2);
+}
+#endif
+#endif  // DMX_PORT_COUNT > 0
@@ -0,0 +1,88 @@
+/*
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Library General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ *
+ * DmxTransmitter.h
+ * Copyright (C) 2011 Simon Newton
+ * Interrupt driven DMX512 output on the spare USARTs.
+ */
+
+#include "Arduino.h"
+#include "Board.h"
+
+#ifndef DMX_TRANSMITTER_H
+#define DMX_TRANSMITTER_H
+
+#if DMX_PORT_COUNT > 0
+
+// The start code plus 512 slots
+enum { DMX_FRAME_SIZE = 513 };
+
+/**
+ * Sends a frame buffer continuously on each port. The break & MAB are timed
+ * by the USART itself, so once a port is running the only CPU cost is one
+ * interrupt per slot.
+ */
+class DmxTransmitterClass {
+  public:
+    DmxTransmitterClass();
+
+    // Configure the USARTs, ports start sending once they have a frame
+    void Init();
+
+    // Takes the break & MAB times in 10.67uS units and the refresh rate in
+    // frames / s (0 is as fast as possible), as in the widget parameters.
+    void SetTiming(byte break_time, byte mab_time, byte refresh_rate);
+
+    // Update the frame for a port, data includes the start code
+    void SetFrame(byte port, const byte *data, unsigned int size);
+
+    // Called from the render tick interrupt
+    void Tick();
+
+    // Called from the USART interrupts
+    void DataRegisterEmpty(byte port);
+    void TransmitComplete(byte port);
+
+  private:
+    typedef enum {
+      PORT_IDLE,
+      PORT_BREAK,
+      PORT_DATA,
+    } port_state;
+
+    typedef struct {
+      unsigned int usart;  // the UCSRnA address
+      port_state state;
+      unsigned int slot;  // the next slot to send
+      unsigned int frame_size;  // 0 until we have a frame
+      unsigned int ticks;  // render ticks since the last break
+      byte frame[DMX_FRAME_SIZE];
+    } dmx_port;
+
+    dmx_port m_ports[DMX_PORT_COUNT];
+    unsigned int m_break_ubrr;
+    byte m_break_pattern;
+    unsigned int m_refresh_ticks;
+
+    void StartBreak(dmx_port *port);
+
+    // short frames are padded so the break to break time is at least 1204uS
+    static const unsigned int MIN_FRAME_SIZE = 25;
+    static const unsigned int DMX_BAUD = 250000;
+};
+
+extern DmxTransmitterClass DmxTransmitter;
+#endif  // DMX_PORT_COUNT > 0
+#endif  // DMX_TRANSMITTER_H
@@ -0,0 +1,50 @@
+/*
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Library General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ *
+ * Effects.cpp
+ * Copyright (C) 2011 Simon Newton
+ */
+
+#include "Effects.h"
+
+
+/**
+ * Advance the strobe. The phase is a 16 bit accumulator, at 488 ticks / s a
+ * rate of 1 is about 1Hz and 255 is about 25Hz.
+ */
+void EffectsClass::Tick() {
+  byte rate = m_strobe_rate;
+  bool open = true;
+  if (rate) {
+    m_phase += 128 + rate * 13;
+    open = (m_phase >> 8) < OPEN_PHASE;
+  }
+
+  if (open != m_gate_open) {
+    m_gate_open = open;
+    m_gate_changes++;
+  }
+}
+
+
+bool EffectsClass::GateChanged() {
+  byte changes = m_gate_changes;
+  if (changes == m_rendered_changes)
+    return false;
+  m_rendered_changes = changes;
+  return true;
+}
+
+EffectsClass Effects;
@@ -0,0 +1,72 @@
+/*
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Library General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ *
+ * Effects.h
+ * Copyright (C) 2011 Simon Newton
+ * The master & strobe stage, this runs after the output map.
+ */
+
+#include "Arduino.h"
+
+#ifndef EFFECTS_H
+#define EFFECTS_H
+
+/**
+ * Tracks the master level and strobe gate. The strobe is clocked from the
+ * render tick so the timing doesn't depend on when frames arrive.
+ */
+class EffectsClass {
+  public:
+    EffectsClass()
+        : m_master(255),
+          m_strobe_rate(0),
+          m_phase(0),
+          m_gate_open(true),
+          m_gate_changes(0),
+          m_rendered_changes(0) {
+    }
+
+    void SetMaster(byte master) { m_master = master; }
+    // 0 disables the strobe, 1 - 255 is roughly 1Hz to 25Hz
+    void SetStrobeRate(byte rate) { m_strobe_rate = rate; }
+
+    // Called from the render tick interrupt
+    void Tick();
+
+    // Returns true if the strobe gate has opened or closed since the last call
+    bool GateChanged();
+
+    // The gain to apply to every output, this combines the master & strobe
+    byte Gain() const { return m_gate_open ? m_master : 0; }
+
+    // The render tick rate, every other Timer0 overflow at the default carrier
+    static const unsigned int TICK_HZ = 488;
+
+  private:
+    byte m_master;
+    volatile byte m_strobe_rate;
+    unsigned int m_phase;
+    volatile bool m_gate_open;
+    // incremented by the tick, so we don't need to clear a flag shared with
+    // the interrupt
+    volatile byte m_gate_changes;
+    byte m_rendered_changes;
+
+    // the gate is open for the first 1/8th of each strobe period
+    static const byte OPEN_PHASE = 0x20;
+};
+
+extern EffectsClass Effects;
+#endif  // EFFECTS_H
@@ -18,18 +18,30 @@
  * Contains the message labels used to identify packets.
  */
 
-#include "Arduino.h"
-
 #ifndef MESSAGE_LABELS_H
 #define MESSAGE_LABELS_H
 
 // Message Label Codes
 enum {
   PARAMETERS_LABEL = 3,
+  SET_PARAMETERS_LABEL = 4,
   DMX_DATA_LABEL = 6,
   SERIAL_NUMBER_LABEL = 10,
   MANUFACTURER_LABEL = 77,
   NAME_LABEL = 78,
   RDM_LABEL = 82,
+  RDM_BATCH_LABEL = 83,
+  // returns the cycle counters in profile builds, see Profiler.h
+  PROFILE_LABEL = 200,
+  // returns the widget's counters, see SendCounters() in main.cpp
+  COUNTERS_LABEL = 201,
+  // DMX_DATA_LABEL drives the first DMX port, these drive the others
+  DMX_DATA_PORT2_LABEL = 202,
+  DMX_DATA_PORT3_LABEL = 203,
+  // sets the output sync mode, or applies the staged frame. See OutputSync.h
+  SYNC_LABEL = 204,
+  // returns the configuration snapshot, or applies one. See ApplyConfig() in
+  // main.cpp
+  CONFIG_LABEL = 205,
 };
 #endif  // MESSAGE_LABELS_H
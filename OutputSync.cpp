@@ -0,0 +1,61 @@
+/*
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Library General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ * OutputSync.cpp
+ * Copyright (C) 2011 Simon Newton
+ */
+
+#include "Common.h"
+#include "Effects.h"
+#include "OutputSync.h"
+
+
+void OutputSyncClass::SetEnabled(bool enabled) {
+  if (enabled == m_enabled)
+    return;
+
+  if (enabled) {
+    // frames that don't cover every output leave the rest unchanged
+    memcpy(m_levels, output_levels, sizeof(m_levels));
+  } else {
+    Sync();
+  }
+  m_enabled = enabled;
+}
+
+
+void OutputSyncClass::Stage(byte master, byte strobe_rate) {
+  m_master = master;
+  m_strobe_rate = strobe_rate;
+  m_staged = true;
+}
+
+
+/**
+ * Copy the staged frame to the outputs. This runs as soon as the sync
+ * arrives, PwmDriver then latches the values on the next overflow.
+ */
+void OutputSyncClass::Sync() {
+  if (!m_staged)
+    return;
+
+  memcpy(output_levels, m_levels, sizeof(m_levels));
+  Effects.SetMaster(m_master);
+  Effects.SetStrobeRate(m_strobe_rate);
+  WriteOutputs();
+  m_staged = false;
+  m_syncs++;
+}
+
+OutputSyncClass OutputSync;
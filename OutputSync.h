@@ -0,0 +1,69 @@
+/*
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Library General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ * OutputSync.h
+ * Copyright (C) 2011 Simon Newton
+ * Holds DMX frames back until a sync, so several widgets change together.
+ */
+
+#include "Arduino.h"
+#include "Personality.h"
+
+#ifndef OUTPUT_SYNC_H
+#define OUTPUT_SYNC_H
+
+/**
+ * Each widget normally applies a frame as soon as it arrives, so units on
+ * different USB ports drift apart by however long their serial data takes.
+ * In sync mode the frame is staged instead, and a SYNC_LABEL message or a
+ * broadcast SET of PID_MANUFACTURER_OUTPUT_SYNC applies it. The outputs then
+ * change on the next Timer1 overflow, so every unit that gets the sync
+ * changes within one PWM period.
+ */
+class OutputSyncClass {
+  public:
+    OutputSyncClass()
+        : m_enabled(false),
+          m_staged(false),
+          m_master(255),
+          m_strobe_rate(0),
+          m_syncs(0) {
+    }
+
+    bool Enabled() const { return m_enabled; }
+    // Disabling sync mode applies any staged frame
+    void SetEnabled(bool enabled);
+
+    // The buffer to convert a frame into when sync mode is enabled
+    byte *StagedLevels() { return m_levels; }
+    // Mark the frame in StagedLevels() as ready, with its master & strobe
+    void Stage(byte master, byte strobe_rate);
+
+    // Apply the staged frame, if there is one
+    void Sync();
+
+    // The number of syncs that applied a frame
+    unsigned int Syncs() const { return m_syncs; }
+
+  private:
+    bool m_enabled;
+    bool m_staged;
+    byte m_levels[PWM_OUTPUT_COUNT];
+    byte m_master;
+    byte m_strobe_rate;
+    unsigned int m_syncs;
+};
+
+extern OutputSyncClass OutputSync;
+#endif  // OUTPUT_SYNC_H
@@ -0,0 +1,284 @@
+/*
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Library General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ *
+ * Personality.cpp
+ * Copyright (C) 2011 Simon Newton
+ */
+
+#include "ColourMath.h"
+#include "Personality.h"
+
+
+// The slot maps for each personality, these scale with the number of outputs
+// on the board.
+static const slot_map PWM_MAP[] = {
+  {0, 0, ALL_OUTPUTS, 1, 0},
+};
+static const slot_map PWM_3_INVERTED_MAP[] = {
+  {0, 0, 3, 1, SLOT_MAP_INVERT},
+  {3, 3, ALL_OUTPUTS, 1, 0},
+};
+static const slot_map INVERTED_PWM_MAP[] = {
+  {0, 0, ALL_OUTPUTS, 1, SLOT_MAP_INVERT},
+};
+static const slot_map MONO_MAP[] = {
+  {0, 0, ALL_OUTPUTS, 0, 0},
+};
+static const slot_map RGB_TO_ALL_MAP[] = {
+  {0, 0, ALL_OUTPUTS, 1, SLOT_MAP_REPEAT_RGB},
+};
+static const slot_map SQUARE_PWM_MAP[] = {
+  {0, 0, ALL_OUTPUTS, 1, SLOT_MAP_SQUARE_CURVE},
+};
+// the R, G & B values of the HSI model are fed to every triplet
+#define HSI_TO_ALL_MAP RGB_TO_ALL_MAP
+
+#define SLOT_MAPS(map) map, sizeof(map) / sizeof(slot_map)
+
+const rdm_personality rdm_personalities[] = {
+  {1, PWM_OUTPUT_COUNT_STRING "x PWM", COLOUR_MODEL_DIRECT, NO_SLOT, NO_SLOT,
+    SLOT_MAPS(PWM_MAP), CARRIER_DEFAULT},
+  {2, "3x inverted PWM, " PWM_OUTPUT_COUNT_LESS_3_STRING "x PWM",
+    COLOUR_MODEL_DIRECT, NO_SLOT, NO_SLOT, SLOT_MAPS(PWM_3_INVERTED_MAP),
+    CARRIER_DEFAULT},
+  {3, PWM_OUTPUT_COUNT_STRING "x inverted PWM", COLOUR_MODEL_DIRECT, NO_SLOT,
+    NO_SLOT, SLOT_MAPS(INVERTED_PWM_MAP), CARRIER_DEFAULT},
+  {4, "1x PWM to all outputs", COLOUR_MODEL_DIRECT, NO_SLOT, NO_SLOT,
+    SLOT_MAPS(MONO_MAP), CARRIER_DEFAULT},
+  {5, "3x PWM to all RGB triplets", COLOUR_MODEL_DIRECT, NO_SLOT, NO_SLOT,
+    SLOT_MAPS(RGB_TO_ALL_MAP), CARRIER_DEFAULT},
+  {6, PWM_OUTPUT_COUNT_STRING "x square law PWM", COLOUR_MODEL_DIRECT,
+    NO_SLOT, NO_SLOT, SLOT_MAPS(SQUARE_PWM_MAP), CARRIER_DEFAULT},
+  {7, "HSI to all RGB triplets", COLOUR_MODEL_HSI, NO_SLOT, NO_SLOT,
+    SLOT_MAPS(HSI_TO_ALL_MAP), CARRIER_DEFAULT},
+  {8, PWM_OUTPUT_COUNT_STRING "x PWM, master, strobe", COLOUR_MODEL_DIRECT,
+    PWM_OUTPUT_COUNT, PWM_OUTPUT_COUNT + 1, SLOT_MAPS(PWM_MAP),
+    CARRIER_DEFAULT},
+  {9, "HSI to all RGB triplets, strobe", COLOUR_MODEL_HSI, NO_SLOT, 3,
+    SLOT_MAPS(HSI_TO_ALL_MAP), CARRIER_DEFAULT},
+  {10, PWM_OUTPUT_COUNT_STRING "x PWM, high frequency", COLOUR_MODEL_DIRECT,
+    NO_SLOT, NO_SLOT, SLOT_MAPS(PWM_MAP), CARRIER_31KHZ},
+};
+
+const byte PERSONALITY_COUNT = (sizeof(rdm_personalities) /
+                                sizeof(rdm_personality));
+
+
+const byte OutputMapClass::LINEAR_CURVE[] PROGMEM = {
+  0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15,
+  16, 17, 18, 19, 20, 21, 22, 23, 24, 25, 26, 27, 28, 29, 30, 31,
+  32, 33, 34, 35, 36, 37, 38, 39, 40, 41, 42, 43, 44, 45, 46, 47,
+  48, 49, 50, 51, 52, 53, 54, 55, 56, 57, 58, 59, 60, 61, 62, 63,
+  64, 65, 66, 67, 68, 69, 70, 71, 72, 73, 74, 75, 76, 77, 78, 79,
+  80, 81, 82, 83, 84, 85, 86, 87, 88, 89, 90, 91, 92, 93, 94, 95,
+  96, 97, 98, 99, 100, 101, 102, 103, 104, 105, 106, 107, 108, 109, 110, 111,
+  112, 113, 114, 115, 116, 117, 118, 119, 120, 121, 122, 123, 124, 125, 126, 127,
+  128, 129, 130, 131, 132, 133, 134, 135, 136, 137, 138, 139, 140, 141, 142, 143,
+  144, 145, 146, 147, 148, 149, 150, 151, 152, 153, 154, 155, 156, 157, 158, 159,
+  160, 161, 162, 163, 164, 165, 166, 167, 168, 169, 170, 171, 172, 173, 174, 175,
+  176, 177, 178, 179, 180, 181, 182, 183, 184, 185, 186, 187, 188, 189, 190, 191,
+  192, 193, 194, 195, 196, 197, 198, 199, 200, 201, 202, 203, 204, 205, 206, 207,
+  208, 209, 210, 211, 212, 213, 214, 215, 216, 217, 218, 219, 220, 221, 222, 223,
+  224, 225, 226, 227, 228, 229, 230, 231, 232, 233, 234, 235, 236, 237, 238, 239,
+  240, 241, 242, 243, 244, 245, 246, 247, 248, 249, 250, 251, 252, 253, 254, 255,
+};
+
+// out = in * in / 255
+const byte OutputMapClass::SQUARE_CURVE[] PROGMEM = {
+  0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1,
+  1, 1, 1, 1, 2, 2, 2, 2, 2, 2, 3, 3, 3, 3, 4, 4,
+  4, 4, 5, 5, 5, 5, 6, 6, 6, 7, 7, 7, 8, 8, 8, 9,
+  9, 9, 10, 10, 11, 11, 11, 12, 12, 13, 13, 14, 14, 15, 15, 16,
+  16, 17, 17, 18, 18, 19, 19, 20, 20, 21, 21, 22, 23, 23, 24, 24,
+  25, 26, 26, 27, 28, 28, 29, 30, 30, 31, 32, 32, 33, 34, 35, 35,
+  36, 37, 38, 38, 39, 40, 41, 42, 42, 43, 44, 45, 46, 47, 47, 48,
+  49, 50, 51, 52, 53, 54, 55, 56, 56, 57, 58, 59, 60, 61, 62, 63,
+  64, 65, 66, 67, 68, 69, 70, 71, 73, 74, 75, 76, 77, 78, 79, 80,
+  81, 82, 84, 85, 86, 87, 88, 89, 91, 92, 93, 94, 95, 97, 98, 99,
+  100, 102, 103, 104, 105, 107, 108, 109, 111, 112, 113, 115, 116, 117, 119, 120,
+  121, 123, 124, 126, 127, 128, 130, 131, 133, 134, 136, 137, 139, 140, 142, 143,
+  145, 146, 148, 149, 151, 152, 154, 155, 157, 158, 160, 162, 163, 165, 166, 168,
+  170, 171, 173, 175, 176, 178, 180, 181, 183, 185, 186, 188, 190, 192, 193, 195,
+  197, 199, 200, 202, 204, 206, 207, 209, 211, 213, 215, 217, 218, 220, 222, 224,
+  226, 228, 230, 232, 233, 235, 237, 239, 241, 243, 245, 247, 249, 251, 253, 255,
+};
+
+
+/**
+ * Return the number of outputs a slot map covers on this board.
+ */
+static byte MapOutputCount(const slot_map *map) {
+  if (map->first_output >= PWM_OUTPUT_COUNT)
+    return 0;
+  return min(map->output_count, PWM_OUTPUT_COUNT - map->first_output);
+}
+
+
+/**
+ * Return the slot, relative to the start address, for the nth output of a
+ * slot map.
+ */
+static byte MapSlot(const slot_map *map, byte n) {
+  if (map->flags & SLOT_MAP_REPEAT_RGB)
+    n %= 3;
+  return map->slot_offset + n * map->slot_step;
+}
+
+
+/**
+ * Calculate the number of slots used by a personality
+ * @param personality the personality definition
+ * @return the footprint in slots
+ */
+unsigned int PersonalityFootprint(const rdm_personality *personality) {
+  unsigned int footprint = 0;
+  if (personality->model == COLOUR_MODEL_HSI) {
+    footprint = HSI_SLOTS;
+  } else {
+    for (byte i = 0; i < personality->slot_map_count; ++i) {
+      const slot_map *map = &personality->slot_maps[i];
+      byte output_count = MapOutputCount(map);
+      for (byte j = 0; j < output_count; ++j)
+        footprint = max(footprint, MapSlot(map, j) + 1u);
+    }
+  }
+
+  if (personality->master_slot != NO_SLOT)
+    footprint = max(footprint, personality->master_slot + 1u);
+  if (personality->strobe_slot != NO_SLOT)
+    footprint = max(footprint, personality->strobe_slot + 1u);
+  return footprint;
+}
+
+
+/**
+ * Compile a personality into the list of output operations. This is called
+ * whenever the personality or start address changes.
+ * @param personality the personality number, starting from 1
+ * @param start_address the DMX start address, starting from 1
+ */
+void OutputMapClass::Compile(byte personality, unsigned int start_address) {
+  if (personality == 0 || personality > PERSONALITY_COUNT)
+    personality = 1;
+  const rdm_personality *definition = &rdm_personalities[personality - 1];
+
+  // resolve the slot for each output, later maps override earlier ones
+  unsigned int slots[PWM_OUTPUT_COUNT];
+  byte flags[PWM_OUTPUT_COUNT];
+  for (byte i = 0; i < PWM_OUTPUT_COUNT; ++i) {
+    slots[i] = UNMAPPED;
+    flags[i] = 0;
+  }
+
+  for (byte i = 0; i < definition->slot_map_count; ++i) {
+    const slot_map *map = &definition->slot_maps[i];
+    byte output_count = MapOutputCount(map);
+    for (byte j = 0; j < output_count; ++j) {
+      byte output = map->first_output + j;
+      slots[output] = MapSlot(map, j);
+      flags[output] = map->flags;
+    }
+  }
+
+  // with a colour model the ops read from the converted values, not the
+  // DMX frame
+  m_model = definition->model;
+  m_input_slot = start_address - 1;
+  m_converted_valid = false;
+  unsigned int base_slot = (m_model == COLOUR_MODEL_DIRECT ?
+                            start_address - 1 : 0);
+
+  // personalities without a master are always at full, and without a strobe
+  // are always on
+  m_master_slot = (definition->master_slot == NO_SLOT ? UNMAPPED :
+                   start_address - 1 + definition->master_slot);
+  m_strobe_slot = (definition->strobe_slot == NO_SLOT ? UNMAPPED :
+                   start_address - 1 + definition->strobe_slot);
+  m_master = 255;
+  m_strobe_rate = 0;
+
+  // now flatten into the op list
+  m_op_count = 0;
+  m_frame_size = 0;
+  for (byte i = 0; i < PWM_OUTPUT_COUNT; ++i) {
+    m_invert_masks[i] = flags[i] & SLOT_MAP_INVERT ? 0xff : 0;
+    if (slots[i] == UNMAPPED)
+      continue;
+
+    output_op *op = &m_ops[m_op_count++];
+    op->slot = base_slot + slots[i];
+    op->output = i;
+    op->curve = (flags[i] & SLOT_MAP_SQUARE_CURVE ? SQUARE_CURVE :
+                 LINEAR_CURVE);
+    m_frame_size = max(m_frame_size, op->slot + 1);
+  }
+  m_footprint = PersonalityFootprint(definition);
+}
+
+
+/**
+ * Convert a DMX frame into output levels.
+ * @param data the dmx data buffer, not including the start code.
+ * @param size the size of the dmx buffer.
+ * @param levels the output levels, indexed by output.
+ */
+void OutputMapClass::Apply(const byte *data,
+                           unsigned int size,
+                           byte *levels) {
+  if (m_master_slot < size)
+    m_master = data[m_master_slot];
+  if (m_strobe_slot < size)
+    m_strobe_rate = data[m_strobe_slot];
+
+  if (m_model == COLOUR_MODEL_DIRECT) {
+    ApplyOps(data, size, levels);
+    return;
+  }
+
+  if (size < m_input_slot + HSI_SLOTS)
+    return;
+
+  const byte *input = data + m_input_slot;
+  if (!m_converted_valid || memcmp(input, m_input, HSI_SLOTS)) {
+    memcpy(m_input, input, HSI_SLOTS);
+    HsiToRgb(m_input[0], m_input[1], m_input[2], m_converted);
+    m_converted_valid = true;
+  }
+  ApplyOps(m_converted, sizeof(m_converted), levels);
+}
+
+
+/**
+ * Walk the op list.
+ */
+void OutputMapClass::ApplyOps(const byte *data,
+                              unsigned int size,
+                              byte *levels) const {
+  if (size >= m_frame_size) {
+    for (byte i = 0; i < m_op_count; ++i) {
+      const output_op &op = m_ops[i];
+      levels[op.output] = pgm_read_byte(op.curve + data[op.slot]);
+    }
+  } else {
+    // a short frame, only update the outputs we have data for
+    for (byte i = 0; i < m_op_count; ++i) {
+      const output_op &op = m_ops[i];
+      if (op.slot < size)
+        levels[op.output] = pgm_read_byte(op.curve + data[op.slot]);
+    }
+  }
+}
+
+OutputMapClass OutputMap;
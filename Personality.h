@@ -0,0 +1,155 @@
+/*
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Library General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ *
+ * Personality.h
+ * Copyright (C) 2011 Simon Newton
+ * The DMX personalities, described as slot maps, and the output map they are
+ * compiled into.
+ */
+
+#include "Arduino.h"
+#include "Board.h"
+#include "PwmCarrier.h"
+
+#ifndef PERSONALITY_H
+#define PERSONALITY_H
+
+// The number of PWM outputs
+enum { PWM_OUTPUT_COUNT = Board::PWM_OUTPUT_COUNT };
+
+// The number of complete RGB triplets, starting from the first output
+enum { RGB_TRIPLET_COUNT = PWM_OUTPUT_COUNT / 3 };
+
+// Use as the output_count to map up to the last output
+enum { ALL_OUTPUTS = 0xff };
+
+// Slot map flags
+enum {
+  SLOT_MAP_INVERT = 0x01,  // the output is active low
+  SLOT_MAP_SQUARE_CURVE = 0x02,  // apply a square law dimmer curve
+  SLOT_MAP_REPEAT_RGB = 0x04,  // the slots repeat every three outputs
+};
+
+// How the personality's slots are interpreted
+typedef enum {
+  COLOUR_MODEL_DIRECT = 0,  // slot maps refer to DMX slots
+  COLOUR_MODEL_HSI = 1,  // H/S/I slots, slot maps refer to the R, G & B values
+} colour_model;
+
+// The number of slots used by the HSI colour model
+enum { HSI_SLOTS = 3 };
+
+// Used for the master & strobe slots when the personality doesn't have one
+enum { NO_SLOT = 0xff };
+
+// Maps a DMX slot onto a group of consecutive outputs.
+typedef struct {
+  byte slot_offset;  // the first slot, relative to the start address
+  byte first_output;  // the first output, an index into Board::PWM_PINS
+  byte output_count;  // the number of outputs in the group
+  byte slot_step;  // slot increment per output, 0 feeds one slot to all
+  byte flags;
+} slot_map;
+
+// A personality is a colour model, optional master & strobe slots, a list
+// of slot maps and the PWM carrier it starts with.
+typedef struct {
+  byte personality_number;
+  const char *description;
+  colour_model model;
+  byte master_slot;  // relative to the start address, or NO_SLOT
+  byte strobe_slot;  // relative to the start address, or NO_SLOT
+  const slot_map *slot_maps;
+  byte slot_map_count;
+  pwm_carrier carrier;  // limited to what each timer supports
+} rdm_personality;
+
+// our personalities
+extern const rdm_personality rdm_personalities[];
+extern const byte PERSONALITY_COUNT;
+
+// the number of slots a personality uses
+unsigned int PersonalityFootprint(const rdm_personality *personality);
+
+
+/**
+ * A personality compiled into a flat list of per-output operations.
+ */
+class OutputMapClass {
+  public:
+    OutputMapClass()
+        : m_op_count(0),
+          m_footprint(0),
+          m_frame_size(0),
+          m_model(COLOUR_MODEL_DIRECT),
+          m_input_slot(0),
+          m_converted_valid(false),
+          m_master_slot(UNMAPPED),
+          m_strobe_slot(UNMAPPED),
+          m_master(255),
+          m_strobe_rate(0) {
+    }
+
+    void Compile(byte personality, unsigned int start_address);
+
+    unsigned int Footprint() const { return m_footprint; }
+
+    // Convert a DMX frame into output levels
+    void Apply(const byte *data, unsigned int size, byte *levels);
+
+    // The XOR mask to apply to an output level before it's written to the pin
+    byte InvertMask(byte output) const { return m_invert_masks[output]; }
+
+    // The values of the master & strobe slots from the last frame
+    byte Master() const { return m_master; }
+    byte StrobeRate() const { return m_strobe_rate; }
+
+  private:
+    static const unsigned int UNMAPPED = 0xffff;
+
+    typedef struct {
+      unsigned int slot;  // the offset into the DMX frame or converted values
+      byte output;
+      const byte *curve;  // a 256 byte lookup table in PROGMEM
+    } output_op;
+
+    output_op m_ops[PWM_OUTPUT_COUNT];
+    byte m_invert_masks[PWM_OUTPUT_COUNT];
+    byte m_op_count;
+    unsigned int m_footprint;
+    // the minimum frame size that covers every op
+    unsigned int m_frame_size;
+
+    // colour conversion state, the conversion only runs when the input changes
+    colour_model m_model;
+    unsigned int m_input_slot;
+    bool m_converted_valid;
+    byte m_input[HSI_SLOTS];
+    byte m_converted[3];
+
+    // effect slots, these are absolute offsets into the DMX frame
+    unsigned int m_master_slot;
+    unsigned int m_strobe_slot;
+    byte m_master;
+    byte m_strobe_rate;
+
+    void ApplyOps(const byte *data, unsigned int size, byte *levels) const;
+
+    static const byte LINEAR_CURVE[];
+    static const byte SQUARE_CURVE[];
+};
+
+extern OutputMapClass OutputMap;
+#endif  // PERSONALITY_H
@@ -0,0 +1,205 @@
+/*
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Library General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ *
+ * PresetPlayer.cpp
+ * Copyright (C) 2011 Simon Newton
+ */
+
+#include "ColourMath.h"
+#include "Effects.h"
+#include "PresetPlayer.h"
+#include "RDMEnums.h"
+
+
+/**
+ * Convert a big endian time in 1/10ths of a second into render ticks.
+ */
+static unsigned long TenthsToTicks(const byte *data) {
+  unsigned int tenths = ((unsigned int) data[0] << 8) + data[1];
+  return (unsigned long) tenths * PresetPlayerClass::TICKS_PER_TENTH;
+}
+
+
+/**
+ * Start playback
+ * @param mode PRESET_PLAYBACK_OFF, PRESET_PLAYBACK_ALL or a scene number.
+ * @param level the playback level, this is applied as the master.
+ */
+void PresetPlayerClass::Start(unsigned int mode, byte level) {
+  byte first_scene = 0;
+  if (mode == PRESET_PLAYBACK_ALL)
+    first_scene = NextScene(0);
+  else if (mode <= WidgetSettingsClass::MAX_SCENES &&
+           WidgetSettings.SceneCaptured(mode))
+    first_scene = mode;
+
+  if (!first_scene) {
+    m_mode = PRESET_PLAYBACK_OFF;
+    m_state = STOPPED;
+    Effects.SetMaster(OutputMap.Master());
+    Effects.SetStrobeRate(OutputMap.StrobeRate());
+    return;
+  }
+
+  m_mode = mode;
+  m_level = level;
+  m_state = LOADING;
+  FetchScene(first_scene);
+  Effects.SetMaster(level);
+  Effects.SetStrobeRate(0);
+}
+
+
+/**
+ * Advance playback.
+ * @param ticks the number of render ticks since the last call
+ * @param levels the output levels
+ * @return true if the levels changed
+ */
+bool PresetPlayerClass::Update(byte ticks, byte *levels) {
+  if (m_state == STOPPED)
+    return false;
+
+  // read at most one byte of the next scene per call, and only if the EEPROM
+  // isn't busy with a write
+  if (!FetchComplete() && WidgetSettings.SceneReadReady()) {
+    m_fetch_buffer[m_fetch_offset] = WidgetSettings.SceneByte(m_fetch_scene,
+                                                             m_fetch_offset);
+    m_fetch_offset++;
+  }
+
+  if (m_state == LOADING && FetchComplete())
+    StartFade(levels);
+
+  if (!ticks)
+    return false;
+
+  switch (m_state) {
+    case FADING:
+      m_elapsed += ticks;
+      AdvanceFade(&m_up, ticks);
+      AdvanceFade(&m_down, ticks);
+      RenderFade(levels);
+      if (m_elapsed >= max(m_target.up_fade, m_target.down_fade)) {
+        m_state = HOLDING;
+        m_elapsed = 0;
+      }
+      return true;
+    case HOLDING:
+      if (m_mode != PRESET_PLAYBACK_ALL)
+        return false;
+      m_elapsed += ticks;
+      if (m_elapsed >= m_target.wait_time && FetchComplete()) {
+        StartFade(levels);
+        RenderFade(levels);
+        return true;
+      }
+      return false;
+    default:
+      return false;
+  }
+}
+
+
+/**
+ * Start fetching a scene from EEPROM
+ */
+void PresetPlayerClass::FetchScene(byte scene_number) {
+  m_fetch_scene = scene_number;
+  m_fetch_offset = 0;
+}
+
+
+/**
+ * Find the next captured scene, wrapping around at the end.
+ * @return the scene number or 0 if no scenes have been captured.
+ */
+byte PresetPlayerClass::NextScene(byte scene_number) const {
+  for (byte i = 0; i < WidgetSettingsClass::MAX_SCENES; ++i) {
+    scene_number = scene_number % WidgetSettingsClass::MAX_SCENES + 1;
+    if (WidgetSettings.SceneCaptured(scene_number))
+      return scene_number;
+  }
+  return 0;
+}
+
+
+/**
+ * Start fading from the current levels to the fetched scene.
+ */
+void PresetPlayerClass::StartFade(byte *levels) {
+  m_target.up_fade = TenthsToTicks(m_fetch_buffer);
+  m_target.down_fade = TenthsToTicks(m_fetch_buffer + 2);
+  m_target.wait_time = TenthsToTicks(m_fetch_buffer + 4);
+  memcpy(m_target.levels, m_fetch_buffer + 6, PWM_OUTPUT_COUNT);
+  memcpy(m_from, levels, PWM_OUTPUT_COUNT);
+  StartFadePosition(&m_up, m_target.up_fade);
+  StartFadePosition(&m_down, m_target.down_fade);
+
+  m_scene = m_fetch_scene;
+  m_elapsed = 0;
+  m_state = FADING;
+
+  // prefetch the scene after this one
+  if (m_mode == PRESET_PLAYBACK_ALL)
+    FetchScene(NextScene(m_scene));
+}
+
+
+/**
+ * Calculate the levels for the current point in the fade. Outputs that are
+ * increasing use the up fade time, and those decreasing the down fade time.
+ */
+void PresetPlayerClass::RenderFade(byte *levels) {
+  // the steps are rounded down, so the end of a fade comes from the ticks
+  byte up = m_elapsed >= m_target.up_fade ? 255 : m_up.progress >> 24;
+  byte down = m_elapsed >= m_target.down_fade ? 255 : m_down.progress >> 24;
+
+  for (byte i = 0; i < PWM_OUTPUT_COUNT; ++i) {
+    byte from = m_from[i];
+    byte to = m_target.levels[i];
+    if (to > from)
+      levels[i] = from + Scale8(to - from, up);
+    else
+      levels[i] = from - Scale8(from - to, down);
+  }
+}
+
+/**
+ * Set up the fixed point progress of a fade. This is the only divide, each
+ * tick after that is an add.
+ * @param duration the length of the fade in ticks
+ */
+void PresetPlayerClass::StartFadePosition(fade_position *fade,
+                                          unsigned long duration) {
+  fade->step = duration ? FADE_END / duration : FADE_END;
+  fade->progress = 0;
+}
+
+
+/**
+ * Move a fade on by a number of ticks, stopping at the end.
+ */
+void PresetPlayerClass::AdvanceFade(fade_position *fade, byte ticks) {
+  while (ticks--) {
+    if (fade->progress >= FADE_END - fade->step) {
+      fade->progress = FADE_END;
+      return;
+    }
+    fade->progress += fade->step;
+  }
+}
+
+PresetPlayerClass PresetPlayer;
@@ -0,0 +1,112 @@
+/*
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Library General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ *
+ * PresetPlayer.h
+ * Copyright (C) 2011 Simon Newton
+ * Plays back the scenes stored in EEPROM.
+ */
+
+#include "Arduino.h"
+#include "Personality.h"
+#include "WidgetSettings.h"
+
+#ifndef PRESET_PLAYER_H
+#define PRESET_PLAYER_H
+
+/**
+ * Fades between the stored scenes. This is driven from the render tick, and
+ * the next scene is read from EEPROM a byte at a time while the current one
+ * is playing so we never wait on the EEPROM.
+ */
+class PresetPlayerClass {
+  public:
+    PresetPlayerClass()
+        : m_mode(0),
+          m_level(255),
+          m_state(STOPPED),
+          m_scene(0),
+          m_fetch_scene(0),
+          m_fetch_offset(0),
+          m_elapsed(0) {
+    }
+
+    // Start playback, mode is 0 for off, 0xffff for all scenes or a scene
+    // number.
+    void Start(unsigned int mode, byte level);
+
+    bool Active() const { return m_mode != 0; }
+    unsigned int Mode() const { return m_mode; }
+    byte Level() const { return m_level; }
+
+    // Advance playback by a number of render ticks, returns true if the
+    // levels were changed.
+    bool Update(byte ticks, byte *levels);
+
+    // fade times are in 1/10ths of a second
+    static const byte TICKS_PER_TENTH = 49;
+
+  private:
+    typedef enum {
+      STOPPED,
+      LOADING,  // waiting for the first scene to be fetched
+      FADING,
+      HOLDING,
+    } playback_state;
+
+    typedef struct {
+      unsigned long up_fade;  // in ticks
+      unsigned long down_fade;  // in ticks
+      unsigned long wait_time;  // in ticks
+      byte levels[PWM_OUTPUT_COUNT];
+    } scene;
+
+    // How far through a fade we are, in fixed point with FADE_END at the end
+    typedef struct {
+      unsigned long step;  // per tick
+      unsigned long progress;
+    } fade_position;
+
+    // 255 in the top byte
+    static const unsigned long FADE_END = 0xff000000UL;
+
+    unsigned int m_mode;
+    byte m_level;
+    playback_state m_state;
+    byte m_scene;  // the scene we're fading to or holding
+
+    // the scene being fetched from EEPROM
+    byte m_fetch_scene;
+    byte m_fetch_offset;
+    byte m_fetch_buffer[WidgetSettingsClass::SCENE_SIZE];
+
+    scene m_target;
+    byte m_from[PWM_OUTPUT_COUNT];
+    unsigned long m_elapsed;
+    fade_position m_up;
+    fade_position m_down;
+
+    void FetchScene(byte scene_number);
+    bool FetchComplete() const {
+      return m_fetch_offset == WidgetSettingsClass::SCENE_SIZE;
+    }
+    byte NextScene(byte scene_number) const;
+    void StartFade(byte *levels);
+    void RenderFade(byte *levels);
+    static void StartFadePosition(fade_position *fade, unsigned long duration);
+    static void AdvanceFade(fade_position *fade, byte ticks);
+};
+
+extern PresetPlayerClass PresetPlayer;
+#endif  // PRESET_PLAYER_H
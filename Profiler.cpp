@@ -0,0 +1,163 @@
+/*
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Library General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ * Profiler.cpp
+ * Copyright (C) 2011 Simon Newton
+ */
+
+#ifdef PROFILE
+
+#include <util/atomic.h>
+#include "MessageLabels.h"
+#include "Profiler.h"
+#include "UsbProSender.h"
+
+
+/**
+ * Switch Timer1 to fast PWM mode 14, with ICR1 as TOP and no prescaler. This
+ * disconnects the outputs, PwmDriver.Init() reconnects them. The overflow
+ * interrupt stays on to count overflows.
+ */
+void ProfilerClass::Init() {
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    TCCR1B = 0;
+    TCCR1A = _BV(WGM11);
+    ICR1 = TIMER_TOP;
+    TCNT1 = 0;
+    TCCR1B = _BV(WGM13) | _BV(WGM12) | _BV(CS10);
+    TIMSK1 |= _BV(TOIE1);
+  }
+
+  for (byte i = 0; i < PROFILE_COUNTER_COUNT; ++i)
+    Reset(&m_counters[i]);
+  for (byte i = 0; i < PID_SLOTS; ++i)
+    m_pid_slots[i].command_class = 0;
+
+  // back to back calls give the cost of taking a timestamp
+  unsigned long start = Now();
+  m_overhead = Now() - start;
+}
+
+
+/**
+ * Return the current time in cycles. This wraps every 268s, which is fine
+ * for measuring intervals.
+ */
+unsigned long ProfilerClass::Now() const {
+  unsigned long overflows;
+  unsigned int count;
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    overflows = m_overflows;
+    count = TCNT1;
+    // the overflow may not have been serviced yet
+    if ((TIFR1 & _BV(TOV1)) && count < TIMER_TOP / 2)
+      overflows++;
+  }
+  return overflows * (TIMER_TOP + 1) + count;
+}
+
+
+/**
+ * Add the cycles since start to a counter.
+ */
+void ProfilerClass::Record(profile_counter *counter, unsigned long start) {
+  unsigned long cycles = Now() - start;
+  cycles = cycles > m_overhead ? cycles - m_overhead : 0;
+  counter->count++;
+  counter->total += cycles;
+  if (cycles < counter->min)
+    counter->min = cycles;
+  if (cycles > counter->max)
+    counter->max = cycles;
+}
+
+
+/**
+ * Find the slot for a PID handler, this allocates one on first use.
+ */
+profile_counter *ProfilerClass::PidCounter(unsigned int pid,
+                                           byte command_class) {
+  for (byte i = 0; i < PID_SLOTS; ++i) {
+    pid_slot *slot = &m_pid_slots[i];
+    if (!slot->command_class) {
+      slot->pid = pid;
+      slot->command_class = command_class;
+      Reset(&slot->counter);
+      return &slot->counter;
+    }
+    if (slot->pid == pid && slot->command_class == command_class)
+      return &slot->counter;
+  }
+  return NULL;
+}
+
+
+/**
+ * Send the counters in a PROFILE_LABEL message. The data is the number of
+ * fixed counters followed by each counter, then the number of PID handlers
+ * followed by the PID, command class & counter for each. Counters are the
+ * count, total, min and max, each 4 bytes, little endian like the rest of
+ * the widget messages. A counter that hasn't run has a min of 0xffffffff.
+ */
+void ProfilerClass::SendCounters(const UsbProSender &sender, bool reset) {
+  byte pid_slots = 0;
+  while (pid_slots < PID_SLOTS && m_pid_slots[pid_slots].command_class)
+    pid_slots++;
+
+  sender.SendMessageHeader(
+      PROFILE_LABEL,
+      2 + PROFILE_COUNTER_COUNT * COUNTER_MESSAGE_SIZE +
+      pid_slots * (3 + COUNTER_MESSAGE_SIZE));
+  sender.Write(PROFILE_COUNTER_COUNT);
+  for (byte i = 0; i < PROFILE_COUNTER_COUNT; ++i)
+    SendCounter(sender, m_counters[i]);
+
+  sender.Write(pid_slots);
+  for (byte i = 0; i < pid_slots; ++i) {
+    sender.Write(m_pid_slots[i].pid);
+    sender.Write(m_pid_slots[i].pid >> 8);
+    sender.Write(m_pid_slots[i].command_class);
+    SendCounter(sender, m_pid_slots[i].counter);
+  }
+  sender.SendMessageFooter();
+
+  if (reset) {
+    for (byte i = 0; i < PROFILE_COUNTER_COUNT; ++i)
+      Reset(&m_counters[i]);
+    for (byte i = 0; i < pid_slots; ++i)
+      Reset(&m_pid_slots[i].counter);
+  }
+}
+
+
+void ProfilerClass::Reset(profile_counter *counter) {
+  counter->count = 0;
+  counter->total = 0;
+  counter->min = 0xffffffff;
+  counter->max = 0;
+}
+
+
+void ProfilerClass::SendCounter(const UsbProSender &sender,
+                                const profile_counter &counter) {
+  const unsigned long values[] = {counter.count, counter.total, counter.min,
+                                  counter.max};
+  for (byte i = 0; i < sizeof(values) / sizeof(values[0]); ++i) {
+    for (byte j = 0; j < 32; j += 8)
+      sender.Write(values[i] >> j);
+  }
+}
+
+ProfilerClass Profiler;
+#endif  // PROFILE
@@ -0,0 +1,147 @@
+/*
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Library General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ * Profiler.h
+ * Copyright (C) 2011 Simon Newton
+ * Cycle counters for the hot paths, these are only compiled in by
+ * `make profile`.
+ */
+
+#include "Arduino.h"
+#include "UsbProSender.h"
+
+#ifndef PROFILER_H
+#define PROFILER_H
+
+#ifdef PROFILE
+
+// The fixed counters, PID handlers get their own slots.
+enum {
+  PROFILE_READ,  // one byte through the UsbProReceiver state machine
+  PROFILE_TAKE_ACTION,
+  PROFILE_SET_PWM,
+  PROFILE_VALIDATE,  // one byte of RDM validation
+  PROFILE_CALIBRATE,  // the colour calibration for one set of outputs
+  PROFILE_DMX_LATENCY,  // a host DMX frame waiting for the main loop
+  PROFILE_COUNTER_COUNT
+};
+
+typedef struct {
+  unsigned long count;
+  unsigned long total;  // all values are in CPU cycles
+  unsigned long min;
+  unsigned long max;
+} profile_counter;
+
+/**
+ * Timer1 normally runs phase correct, which counts down as well as up, in
+ * units of 64 cycles. In profile builds it's switched to fast PWM clocked
+ * from the CPU, with a TOP that keeps the same 490Hz period, so TCNT1 plus
+ * the overflow count is a cycle counter. The PWM driver scales the Timer1
+ * outputs to match.
+ */
+class ProfilerClass {
+  public:
+    enum { TIMER_TOP = 32639 };
+    // shift an 8 bit output value into the Timer1 range
+    enum { PWM_SHIFT = 7 };
+    // the number of PID handlers that can be tracked
+    enum { PID_SLOTS = 16 };
+
+    ProfilerClass(): m_overflows(0), m_overhead(0) {}
+
+    // Take over Timer1, this must be called before PwmDriver.Init()
+    void Init();
+
+    // Called from the Timer1 overflow interrupt
+    void Overflow() { m_overflows++; }
+
+    unsigned long Now() const;
+
+    void Record(profile_counter *counter, unsigned long start);
+    profile_counter *Counter(byte id) { return &m_counters[id]; }
+    // Returns NULL if all the slots are in use
+    profile_counter *PidCounter(unsigned int pid, byte command_class);
+
+    /*
+     * Send the counters to the host, the fixed counters are followed by one
+     * entry per PID handler.
+     * @param reset clear the counters once they've been sent
+     */
+    void SendCounters(const UsbProSender &sender, bool reset);
+
+  private:
+    // the count, total, min & max, 4 bytes each
+    enum { COUNTER_MESSAGE_SIZE = 16 };
+
+    typedef struct {
+      unsigned int pid;
+      byte command_class;  // 0 if the slot is unused
+      profile_counter counter;
+    } pid_slot;
+
+    volatile unsigned long m_overflows;
+    // the cycles taken by Now() itself
+    unsigned int m_overhead;
+    profile_counter m_counters[PROFILE_COUNTER_COUNT];
+    pid_slot m_pid_slots[PID_SLOTS];
+
+    static void Reset(profile_counter *counter);
+    static void SendCounter(const UsbProSender &sender,
+                            const profile_counter &counter);
+};
+
+extern ProfilerClass Profiler;
+
+
+/**
+ * Records the cycles between construction and destruction.
+ */
+class ProfileScope {
+  public:
+    explicit ProfileScope(byte id)
+        : m_counter(Profiler.Counter(id)),
+          m_start(Profiler.Now()) {
+    }
+
+    ProfileScope(unsigned int pid, byte command_class)
+        : m_counter(Profiler.PidCounter(pid, command_class)),
+          m_start(Profiler.Now()) {
+    }
+
+    ~ProfileScope() {
+      if (m_counter)
+        Profiler.Record(m_counter, m_start);
+    }
+
+  private:
+    profile_counter *m_counter;
+    unsigned long m_start;
+};
+
+#define PROFILE_INIT() Profiler.Init()
+#define PROFILE_OVERFLOW() Profiler.Overflow()
+#define PROFILE_SCOPE(id) ProfileScope profile_scope(id)
+#define PROFILE_PID_SCOPE(pid, command_class) \
+  ProfileScope profile_scope(pid, command_class)
+
+#else
+
+#define PROFILE_INIT()
+#define PROFILE_OVERFLOW()
+#define PROFILE_SCOPE(id)
+#define PROFILE_PID_SCOPE(pid, command_class)
+
+#endif  // PROFILE
+#endif  // PROFILER_H
@@ -0,0 +1,257 @@
+/*
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Library General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ * PwmCarrier.cpp
+ * Copyright (C) 2011 Simon Newton
+ * Selects the PWM carrier frequency of each timer.
+ */
+
+#include <util/atomic.h>
+#include "Arduino.h"
+#include "Personality.h"
+#include "Profiler.h"
+#include "PwmCarrier.h"
+#include "WidgetSettings.h"
+
+#if F_CPU != 16000000L
+#error "The Timer0 timekeeping assumes a 16MHz clock"
+#endif
+
+PwmCarrierClass PwmCarrier;
+
+/*
+ * Timer0's overflow keeps time for millis(), micros() & delay(). The core's
+ * versions assume the /64 prescaler, so they're renamed by WIRING_DEFS in the
+ * Makefile and replaced by these, which follow the Timer0 carrier. It also
+ * drives the render tick.
+ */
+static volatile unsigned long timer0_micros = 0;  // at the last overflow
+static volatile unsigned long timer0_millis = 0;
+static volatile unsigned int timer0_fract = 0;  // us since the last ms
+// log2(64 / prescaler), an overflow is 1024us >> timer0_shift
+static volatile byte timer0_shift = 0;
+
+
+ISR(TIMER0_OVF_vect) {
+  unsigned int period = 1024 >> timer0_shift;
+  unsigned int fract = timer0_fract + period;
+  unsigned long m = timer0_millis;
+  while (fract >= 1000) {
+    fract -= 1000;
+    m++;
+  }
+  timer0_fract = fract;
+  timer0_millis = m;
+  timer0_micros += period;
+
+  if (PwmCarrier.RenderTick())
+    HandleRenderTick();
+}
+
+
+unsigned long millis() {
+  unsigned long m;
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    m = timer0_millis;
+  }
+  return m;
+}
+
+
+unsigned long micros() {
+  unsigned long m;
+  byte t, shift;
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    m = timer0_micros;
+    t = TCNT0;
+    shift = timer0_shift;
+    // an overflow that hasn't been handled yet
+    if ((TIFR0 & _BV(TOV0)) && t < 255)
+      m += 1024 >> shift;
+  }
+  // a tick is 4us at /64
+  return m + ((static_cast<unsigned int>(t) << 2) >> shift);
+}
+
+
+void delay(unsigned long ms) {
+  unsigned int start = micros();
+  while (ms > 0) {
+    if (static_cast<unsigned int>(micros()) - start >= 1000) {
+      ms--;
+      start += 1000;
+    }
+  }
+}
+
+
+/**
+ * Switch Timer0's prescaler without losing time. The part of the period that
+ * has passed is added to the clock, then the period restarts.
+ * @param clock_select the new CS bits
+ * @param shift the new timer0_shift
+ */
+static void SetTimer0Clock(byte clock_select, byte shift) {
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    unsigned int elapsed = (static_cast<unsigned int>(TCNT0) << 2) >>
+                           timer0_shift;
+    if (TIFR0 & _BV(TOV0)) {
+      elapsed += 1024 >> timer0_shift;
+      TIFR0 = _BV(TOV0);
+    }
+    timer0_micros += elapsed;
+    unsigned int fract = timer0_fract + elapsed;
+    while (fract >= 1000) {
+      fract -= 1000;
+      timer0_millis++;
+    }
+    timer0_fract = fract;
+    TCNT0 = 0;
+    TCCR0B = (TCCR0B & ~0x07) | clock_select;
+    timer0_shift = shift;
+  }
+}
+
+
+/**
+ * Apply the saved carriers. Anything the board no longer supports falls back
+ * to the default.
+ */
+void PwmCarrierClass::Init() {
+  for (byte i = 0; i < Board::PWM_TIMER_COUNT; ++i) {
+    byte carrier = WidgetSettings.Carrier(i);
+    m_carriers[i] = carrier <= MaxCarrier(i) ? carrier : CARRIER_DEFAULT;
+    Apply(i);
+  }
+}
+
+
+byte PwmCarrierClass::OutputCount(byte group) const {
+  byte count = 0;
+  for (byte i = 0; i < PWM_OUTPUT_COUNT; ++i) {
+    if (Board::PWM_CHANNELS[i].tccr_address ==
+        Board::PWM_TIMERS[group].tccr_address)
+      count++;
+  }
+  return count;
+}
+
+
+pwm_carrier PwmCarrierClass::MaxCarrier(byte group) const {
+  byte flags = Board::PWM_TIMERS[group].flags;
+  if (flags & PWM_TIMER_MILLIS)
+    return CARRIER_4KHZ;
+#ifdef PROFILE
+  if (flags & PWM_TIMER_LATCH)
+    return CARRIER_DEFAULT;
+#endif
+  return CARRIER_31KHZ;
+}
+
+
+/**
+ * Set & save the carrier for a group.
+ * @param group the group, an index into Board::PWM_TIMERS
+ * @param carrier a pwm_carrier
+ */
+bool PwmCarrierClass::SetCarrier(byte group, byte carrier) {
+  if (group >= Board::PWM_TIMER_COUNT || carrier > MaxCarrier(group))
+    return false;
+  if (m_carriers[group] != carrier) {
+    m_carriers[group] = carrier;
+    Apply(group);
+  }
+  WidgetSettings.SetCarrier(group, carrier);
+  return true;
+}
+
+
+/**
+ * Set every group to a personality's default carrier.
+ * @param personality the personality number, starting from 1
+ */
+void PwmCarrierClass::SetPersonalityDefaults(byte personality) {
+  if (personality == 0 || personality > PERSONALITY_COUNT)
+    return;
+  byte carrier = rdm_personalities[personality - 1].carrier;
+  for (byte i = 0; i < Board::PWM_TIMER_COUNT; ++i)
+    SetCarrier(i, min(carrier, MaxCarrier(i)));
+}
+
+
+unsigned long PwmCarrierClass::Frequency(byte group) const {
+#ifdef PROFILE
+  if (Board::PWM_TIMERS[group].flags & PWM_TIMER_LATCH)
+    return F_CPU / (ProfilerClass::TIMER_TOP + 1);
+#endif
+  unsigned int period = (Board::PWM_TIMERS[group].flags & PWM_TIMER_FAST) ?
+                        256 : 510;
+  return F_CPU / (static_cast<unsigned long>(Prescaler(m_carriers[group])) *
+                  period);
+}
+
+
+/**
+ * The outputs always have 256 levels, the profile build's Timer1 runs at a
+ * higher resolution but the levels are scaled up to it.
+ */
+unsigned int PwmCarrierClass::Levels(byte) const {
+  return 256;
+}
+
+
+/**
+ * The change in pulse width from one level to the next. In phase correct mode
+ * each level moves both edges of the pulse, so it's two timer ticks.
+ */
+unsigned int PwmCarrierClass::LevelNanoseconds(byte group) const {
+  unsigned long ticks = (Board::PWM_TIMERS[group].flags & PWM_TIMER_FAST) ?
+                        1 : 2;
+  ticks *= Prescaler(m_carriers[group]);
+#ifdef PROFILE
+  // Timer1 runs at /1, a level is 1 << PWM_SHIFT ticks
+  if (Board::PWM_TIMERS[group].flags & PWM_TIMER_LATCH)
+    ticks = 1 << ProfilerClass::PWM_SHIFT;
+#endif
+  return ticks * 1000 / (F_CPU / 1000000);
+}
+
+
+/**
+ * Write a group's prescaler.
+ */
+void PwmCarrierClass::Apply(byte group) {
+  const pwm_timer &timer = Board::PWM_TIMERS[group];
+  byte clock_select = timer.clock_select[m_carriers[group]];
+
+  if (timer.flags & PWM_TIMER_MILLIS) {
+    SetTimer0Clock(clock_select, 3 * m_carriers[group]);
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+      m_render_divider = RENDER_DIVIDER << (3 * m_carriers[group]);
+      m_render_count = 1;
+    }
+    return;
+  }
+
+#ifdef PROFILE
+  // Timer1 is the profiler's cycle counter
+  if (timer.flags & PWM_TIMER_LATCH)
+    return;
+#endif
+
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    _SFR_MEM8(timer.clock_address) =
+        (_SFR_MEM8(timer.clock_address) & ~timer.clock_mask) | clock_select;
+  }
+}
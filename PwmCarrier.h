@@ -0,0 +1,110 @@
+/*
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Library General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ * PwmCarrier.h
+ * Copyright (C) 2011 Simon Newton
+ * Selects the PWM carrier frequency of each timer.
+ */
+
+#include "Arduino.h"
+#include "Board.h"
+
+#ifndef PWM_CARRIER_H
+#define PWM_CARRIER_H
+
+/**
+ * The carrier settings. Each one clocks the timer 8 times faster than the
+ * one before, the outputs keep 256 levels but a level is a shorter pulse, so
+ * the lowest levels are the first to suffer from slow LED drivers.
+ */
+typedef enum {
+  CARRIER_DEFAULT = 0,  // /64, 490Hz, or 977Hz for fast PWM
+  CARRIER_4KHZ = 1,  // /8, 3.9kHz, or 7.8kHz for fast PWM
+  CARRIER_31KHZ = 2,  // /1, 31.4kHz, not available on Timer0
+  CARRIER_COUNT,
+} pwm_carrier;
+
+
+/**
+ * The outputs are grouped by timer, each group has its own carrier. The
+ * carriers are saved in EEPROM, and reset to the personality's default when
+ * the personality changes.
+ *
+ * Two timers need special handling:
+ *  - Timer0 keeps time, millis() & micros() are replaced by versions that
+ *    follow its prescaler. It stops at CARRIER_4KHZ, at /1 the overflow
+ *    interrupt would run every 16us. Its overflow is also the render tick,
+ *    every 2nd or 16th overflow so the tick stays at 488Hz.
+ *  - Timer1's overflow latches the outputs, the interrupt is only enabled
+ *    while a frame is staged. In profile builds Timer1 is the cycle counter
+ *    and can't be changed.
+ */
+class PwmCarrierClass {
+  public:
+    PwmCarrierClass()
+        : m_render_divider(RENDER_DIVIDER),
+          m_render_count(RENDER_DIVIDER) {
+      for (byte i = 0; i < Board::PWM_TIMER_COUNT; ++i)
+        m_carriers[i] = CARRIER_DEFAULT;
+    }
+
+    // Apply the saved carriers, this runs after init() sets up the timers
+    void Init();
+
+    // Groups are numbered from 0 here, & from 1 over RDM
+    byte GroupCount() const { return Board::PWM_TIMER_COUNT; }
+    pwm_carrier Carrier(byte group) const {
+      return static_cast<pwm_carrier>(m_carriers[group]);
+    }
+    // The number of outputs on a group's timer
+    byte OutputCount(byte group) const;
+    // The fastest carrier a group supports
+    pwm_carrier MaxCarrier(byte group) const;
+
+    // @return false if the group doesn't support the carrier
+    bool SetCarrier(byte group, byte carrier);
+    // Set every group to the personality's default, or as close as it gets
+    void SetPersonalityDefaults(byte personality);
+
+    // The carrier frequency in Hz
+    unsigned long Frequency(byte group) const;
+    // The number of output levels, and the pulse width of one level in ns
+    unsigned int Levels(byte group) const;
+    unsigned int LevelNanoseconds(byte group) const;
+
+    // Called from the Timer0 overflow, true if this overflow is a render tick
+    bool RenderTick() {
+      if (--m_render_count)
+        return false;
+      m_render_count = m_render_divider;
+      return true;
+    }
+
+  private:
+    // Timer0 overflows per render tick at CARRIER_DEFAULT
+    enum { RENDER_DIVIDER = 2 };
+
+    byte m_carriers[Board::PWM_TIMER_COUNT];
+    volatile byte m_render_divider;
+    byte m_render_count;
+
+    void Apply(byte group);
+    static unsigned int Prescaler(byte carrier) { return 64 >> (3 * carrier); }
+};
+
+extern PwmCarrierClass PwmCarrier;
+
+// The render tick, this is in main.cpp
+void HandleRenderTick();
+#endif  // PWM_CARRIER_H
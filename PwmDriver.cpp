@@ -0,0 +1,124 @@
+/*
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Library General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ *
+ * PwmDriver.cpp
+ * Copyright (C) 2011 Simon Newton
+ */
+
+#include <util/atomic.h>
+#include "Profiler.h"
+#include "PwmDriver.h"
+
+
+/**
+ * Returns true if the channel pulses with a value of 0, so it has to be
+ * disconnected from the timer instead.
+ */
+static inline bool PulsesAtZero(const pwm_channel &channel) {
+#ifdef PROFILE
+  // the profiler runs Timer1 in fast PWM mode
+  if (channel.tccr_address == _SFR_MEM_ADDR(TCCR1A))
+    return true;
+#endif
+  return channel.flags & PWM_CHANNEL_FAST;
+}
+
+
+/**
+ * Convert an output value to the OCR value for a 16 bit timer.
+ */
+static inline unsigned int Ocr16Value(const pwm_channel &channel,
+                                      byte value) {
+#ifdef PROFILE
+  if (channel.tccr_address == _SFR_MEM_ADDR(TCCR1A))
+    return (unsigned int) value << ProfilerClass::PWM_SHIFT;
+#endif
+  return value;
+}
+
+
+/**
+ * Configure the pins as outputs, driven low when disconnected from the timer.
+ * The timers themselves are left as init() set them up.
+ */
+void PwmDriverClass::Init() {
+  for (byte i = 0; i < Board::PWM_OUTPUT_COUNT; ++i) {
+    const pwm_channel &channel = Board::PWM_CHANNELS[i];
+    m_staged[i] = 0;
+    pinMode(Board::PWM_PINS[i], OUTPUT);
+    digitalWrite(Board::PWM_PINS[i], LOW);
+    if (channel.flags & PWM_CHANNEL_16BIT)
+      _SFR_MEM16(channel.ocr_address) = 0;
+    else
+      _SFR_MEM8(channel.ocr_address) = 0;
+
+    if (!PulsesAtZero(channel))
+      _SFR_MEM8(channel.tccr_address) |= channel.com_mask;
+  }
+}
+
+
+/**
+ * Stage a set of values.
+ * @param values Board::PWM_OUTPUT_COUNT values
+ */
+void PwmDriverClass::Commit(const byte *values) {
+  // this is short enough to block the overflow rather than double buffer
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    for (byte i = 0; i < Board::PWM_OUTPUT_COUNT; ++i)
+      m_staged[i] = values[i];
+#ifndef PROFILE
+    // the profiler keeps the overflow enabled, otherwise it's on while a
+    // frame is pending. Clear any old overflow so the latch waits for the
+    // end of the current period.
+    if (!m_pending) {
+      TIFR1 = _BV(TOV1);
+      TIMSK1 |= _BV(TOIE1);
+    }
+#endif
+    m_pending = true;
+  }
+}
+
+
+/**
+ * Copy the staged values into the OCR registers. The registers are double
+ * buffered by the hardware, so each channel picks up its new value at the
+ * end of its current period.
+ */
+void PwmDriverClass::WriteRegisters() {
+  for (byte i = 0; i < Board::PWM_OUTPUT_COUNT; ++i) {
+    const pwm_channel &channel = Board::PWM_CHANNELS[i];
+    byte value = m_staged[i];
+    if (PulsesAtZero(channel)) {
+      // fast PWM still pulses at 0, disconnect & let the PORT bit hold it low
+      if (value)
+        _SFR_MEM8(channel.tccr_address) |= channel.com_mask;
+      else
+        _SFR_MEM8(channel.tccr_address) &= ~channel.com_mask;
+    }
+
+    if (channel.flags & PWM_CHANNEL_16BIT)
+      _SFR_MEM16(channel.ocr_address) = Ocr16Value(channel, value);
+    else
+      _SFR_MEM8(channel.ocr_address) = value;
+  }
+  m_pending = false;
+#ifndef PROFILE
+  TIMSK1 &= ~_BV(TOIE1);
+#endif
+}
+
+PwmDriverClass PwmDriver;
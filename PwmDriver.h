@@ -0,0 +1,61 @@
+/*
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Library General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ *
+ * PwmDriver.h
+ * Copyright (C) 2011 Simon Newton
+ * Writes the output compare registers directly, in place of analogWrite().
+ */
+
+#include "Arduino.h"
+#include "Board.h"
+
+#ifndef PWM_DRIVER_H
+#define PWM_DRIVER_H
+
+/**
+ * Output values are staged as a complete frame and latched into the OCR
+ * registers from the Timer1 overflow, so a frame never lands part way
+ * through a PWM period and all channels move together. The overflow
+ * interrupt is only enabled while a frame is staged.
+ *
+ * Counting instructions, latching six outputs takes about 170 cycles. Six
+ * analogWrite() calls take about 550, since each one calls pinMode() and
+ * looks up the pin's port & timer in flash.
+ */
+class PwmDriverClass {
+  public:
+    PwmDriverClass(): m_pending(false) {}
+
+    // Set up the pins and connect the outputs to the timers
+    void Init();
+
+    // Stage a frame of values, this is latched on the next overflow
+    void Commit(const byte *values);
+
+    // Called from the Timer1 overflow interrupt
+    void Latch() {
+      if (m_pending)
+        WriteRegisters();
+    }
+
+  private:
+    byte m_staged[Board::PWM_OUTPUT_COUNT];
+    volatile bool m_pending;
+
+    void WriteRegisters();
+};
+
+extern PwmDriverClass PwmDriver;
+#endif  // PWM_DRIVER_H
@@ -0,0 +1,177 @@
+/*
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Library General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ * RDMCodec.h
+ * Copyright (C) 2011 Simon Newton
+ * The layout of an RDM message and functions to build & check one. Like
+ * UsbProCodec.h this is shared with the host tools.
+ */
+
+#include <stdint.h>
+
+#ifndef RDM_CODEC_H
+#define RDM_CODEC_H
+
+enum {
+  RDM_START_CODE = 0xcc,
+  RDM_SUB_START_CODE = 0x01,
+  RDM_UID_SIZE = 6,
+  // the header is everything before the param data
+  RDM_HEADER_SIZE = 24,
+  RDM_CHECKSUM_SIZE = 2,
+  RDM_MAX_PARAM_DATA_SIZE = 231,
+};
+
+// The offset of each field, from the start code
+enum {
+  RDM_START_CODE_OFFSET = 0,
+  RDM_SUB_START_CODE_OFFSET = 1,
+  RDM_LENGTH_OFFSET = 2,
+  RDM_DEST_UID_OFFSET = 3,
+  RDM_SRC_UID_OFFSET = 9,
+  RDM_TN_OFFSET = 15,
+  // the port id in a request, the response type in a response
+  RDM_PORT_ID_OFFSET = 16,
+  RDM_MESSAGE_COUNT_OFFSET = 17,
+  RDM_SUB_DEVICE_OFFSET = 18,
+  RDM_COMMAND_CLASS_OFFSET = 20,
+  RDM_PID_OFFSET = 21,
+  RDM_PDL_OFFSET = 23,
+  RDM_PARAM_DATA_OFFSET = 24,
+};
+
+// The header fields of a message.
+typedef struct {
+  uint8_t dest_uid[RDM_UID_SIZE];
+  uint8_t src_uid[RDM_UID_SIZE];
+  uint8_t transaction_number;
+  uint8_t port_id;  // or the response type
+  uint8_t message_count;
+  uint16_t sub_device;
+  uint8_t command_class;
+  uint16_t param_id;
+  uint8_t param_data_size;
+} rdm_header;
+
+
+/**
+ * Add bytes to a checksum.
+ */
+inline uint16_t RDMChecksum(const uint8_t *data,
+                            uint16_t size,
+                            uint16_t checksum = 0) {
+  for (uint16_t i = 0; i < size; ++i)
+    checksum += data[i];
+  return checksum;
+}
+
+
+inline uint16_t RDMReadShort(const uint8_t *data) {
+  return (static_cast<uint16_t>(data[0]) << 8) + data[1];
+}
+
+
+inline void RDMWriteShort(uint8_t *data, uint16_t value) {
+  data[0] = value >> 8;
+  data[1] = value;
+}
+
+
+/**
+ * Write the header of a message, the length field includes the
+ * param_data_size.
+ * @param output the output, this must hold RDM_HEADER_SIZE bytes
+ */
+inline void RDMEncodeHeader(uint8_t *output, const rdm_header &header) {
+  output[RDM_START_CODE_OFFSET] = RDM_START_CODE;
+  output[RDM_SUB_START_CODE_OFFSET] = RDM_SUB_START_CODE;
+  output[RDM_LENGTH_OFFSET] = RDM_HEADER_SIZE + header.param_data_size;
+  for (uint8_t i = 0; i < RDM_UID_SIZE; ++i) {
+    output[RDM_DEST_UID_OFFSET + i] = header.dest_uid[i];
+    output[RDM_SRC_UID_OFFSET + i] = header.src_uid[i];
+  }
+  output[RDM_TN_OFFSET] = header.transaction_number;
+  output[RDM_PORT_ID_OFFSET] = header.port_id;
+  output[RDM_MESSAGE_COUNT_OFFSET] = header.message_count;
+  RDMWriteShort(output + RDM_SUB_DEVICE_OFFSET, header.sub_device);
+  output[RDM_COMMAND_CLASS_OFFSET] = header.command_class;
+  RDMWriteShort(output + RDM_PID_OFFSET, header.param_id);
+  output[RDM_PDL_OFFSET] = header.param_data_size;
+}
+
+
+/**
+ * Build a complete message.
+ * @param output the output buffer
+ * @param capacity the size of the output buffer
+ * @param header the header, param_data_size is the size of param_data
+ * @param param_data the param data, may be NULL if the size is 0
+ * @return the size of the message, or 0 if it doesn't fit
+ */
+inline uint16_t RDMEncodeMessage(uint8_t *output,
+                                 uint16_t capacity,
+                                 const rdm_header &header,
+                                 const uint8_t *param_data) {
+  uint16_t size = (RDM_HEADER_SIZE + header.param_data_size +
+                   RDM_CHECKSUM_SIZE);
+  if (header.param_data_size > RDM_MAX_PARAM_DATA_SIZE || size > capacity)
+    return 0;
+
+  RDMEncodeHeader(output, header);
+  for (uint8_t i = 0; i < header.param_data_size; ++i)
+    output[RDM_PARAM_DATA_OFFSET + i] = param_data[i];
+  uint16_t length = size - RDM_CHECKSUM_SIZE;
+  RDMWriteShort(output + length, RDMChecksum(output, length));
+  return size;
+}
+
+
+/**
+ * Check the framing & checksum of a message and extract the header.
+ * @param data the message, starting with the start code
+ * @param size the size of the message
+ * @param header the header to fill in, may be NULL
+ * @return true if the message is valid
+ */
+inline bool RDMDecodeMessage(const uint8_t *data,
+                             uint16_t size,
+                             rdm_header *header) {
+  if (size < RDM_HEADER_SIZE + RDM_CHECKSUM_SIZE ||
+      data[RDM_START_CODE_OFFSET] != RDM_START_CODE ||
+      data[RDM_SUB_START_CODE_OFFSET] != RDM_SUB_START_CODE)
+    return false;
+
+  uint8_t length = data[RDM_LENGTH_OFFSET];
+  if (length < RDM_HEADER_SIZE ||
+      length + RDM_CHECKSUM_SIZE != size ||
+      data[RDM_PDL_OFFSET] != length - RDM_HEADER_SIZE ||
+      RDMChecksum(data, length) != RDMReadShort(data + length))
+    return false;
+
+  if (header) {
+    for (uint8_t i = 0; i < RDM_UID_SIZE; ++i) {
+      header->dest_uid[i] = data[RDM_DEST_UID_OFFSET + i];
+      header->src_uid[i] = data[RDM_SRC_UID_OFFSET + i];
+    }
+    header->transaction_number = data[RDM_TN_OFFSET];
+    header->port_id = data[RDM_PORT_ID_OFFSET];
+    header->message_count = data[RDM_MESSAGE_COUNT_OFFSET];
+    header->sub_device = RDMReadShort(data + RDM_SUB_DEVICE_OFFSET);
+    header->command_class = data[RDM_COMMAND_CLASS_OFFSET];
+    header->param_id = RDMReadShort(data + RDM_PID_OFFSET);
+    header->param_data_size = data[RDM_PDL_OFFSET];
+  }
+  return true;
+}
+#endif  // RDM_CODEC_H
@@ -18,7 +18,8 @@
  * Various static RDM values.
  */
 
-#include "Arduino.h"
+#include <stdint.h>
+#include "RDMCodec.h"
 
 #ifndef RDMENUMS_H
 #define RDMENUMS_H
@@ -35,12 +36,14 @@ typedef enum {
 } rdm_status_codes;
 
 // Various RDM Constants
-const byte START_CODE = 0xcc;
-const byte SUB_START_CODE = 0x01;
+const uint8_t START_CODE = RDM_START_CODE;
+const uint8_t SUB_START_CODE = RDM_SUB_START_CODE;
 // min packet size including the checksum
-const byte MINIMUM_RDM_PACKET_SIZE = 26;
+const uint8_t MINIMUM_RDM_PACKET_SIZE = RDM_HEADER_SIZE + RDM_CHECKSUM_SIZE;
 
 typedef enum {
+  DISCOVERY_COMMAND = 0x10,
+  DISCOVERY_COMMAND_RESPONSE = 0x11,
   GET_COMMAND = 0x20,
   GET_COMMAND_RESPONSE = 0x21,
   SET_COMMAND = 0x30,
@@ -70,6 +73,10 @@ typedef enum {
 
 
 typedef enum {
+  // discovery
+  PID_DISC_UNIQUE_BRANCH = 0x0001,
+  PID_DISC_MUTE = 0x0002,
+  PID_DISC_UN_MUTE = 0x0003,
   PID_QUEUED_MESSAGE = 0x0020,
   PID_STATUS_MESSAGES = 0x0030,
   /*
@@ -135,15 +142,24 @@ typedef enum {
   PID_POWER_STATE = 0x1010,
   PID_PERFORM_SELFTEST = 0x1020,
   PID_SELF_TEST_DESCRIPTION = 0x1021,
+  */
   PID_CAPTURE_PRESET = 0x1030,
   PID_PRESET_PLAYBACK = 0x1031,
-  */
 
   // Manufacturer PID follow
   PID_MANUFACTURER_SET_SERIAL = 0x8000,
+  PID_MANUFACTURER_CALIBRATION = 0x8001,
+  PID_MANUFACTURER_OUTPUT_SYNC = 0x8002,
+  PID_MANUFACTURER_PWM_CARRIER = 0x8003,
 } rdm_pid;
 
 
+typedef enum {
+  PRESET_PLAYBACK_OFF = 0x0000,
+  PRESET_PLAYBACK_ALL = 0xffff,
+} rdm_preset_playback_mode;
+
+
 typedef enum {
   STATUS_NONE = 0x0,
   STATUS_GET_LAST_MESSAGE = 0x01,
@@ -17,10 +17,18 @@
  * Copyright (C) 2011 Simon Newton
  */
 
+#include "Calibration.h"
 #include "Common.h"
+#include "OutputSync.h"
+#include "PwmCarrier.h"
+#include "Personality.h"
+#include "PresetPlayer.h"
+#include "Profiler.h"
 #include "RDMEnums.h"
 #include "RDMHandlers.h"
 #include "RDMSender.h"
+#include "Responders.h"
+#include "Scheduler.h"
 #include "WidgetSettings.h"
 
 
@@ -60,38 +68,130 @@ const RDMHandler::pid_definition RDMHandler::PID_DEFINITIONS[] = {
     &RDMHandler::HandleSetDevicePowerCycles, 0, true},
   {PID_IDENTIFY_DEVICE, &RDMHandler::HandleGetIdentifyDevice,
     &RDMHandler::HandleSetIdentifyDevice, 0, false},
+  {PID_CAPTURE_PRESET, NULL, &RDMHandler::HandleCapturePreset, 0, true},
+  {PID_PRESET_PLAYBACK, &RDMHandler::HandleGetPresetPlayback,
+    &RDMHandler::HandleSetPresetPlayback, 0, true},
   {PID_MANUFACTURER_SET_SERIAL, NULL, &RDMHandler::HandleSetSerial, 4, true},
+  {PID_MANUFACTURER_CALIBRATION, &RDMHandler::HandleGetCalibration,
+    &RDMHandler::HandleSetCalibration, 1, true},
+  {PID_MANUFACTURER_OUTPUT_SYNC, &RDMHandler::HandleGetOutputSync,
+    &RDMHandler::HandleSetOutputSync, 0, true},
+  {PID_MANUFACTURER_PWM_CARRIER, &RDMHandler::HandleGetPwmCarrier,
+    &RDMHandler::HandleSetPwmCarrier, 1, true},
 };
 
 
-const RDMHandler::rdm_personality RDMHandler::rdm_personalities[] = {
-  {1, 6, "6x PWM"},
-  {2, 6, "3x inverted PWM, 3x PWM"},
-  {3, 6, "6x inverted PWM"},
-};
-
 // Various constants used in RDM messages
 const char RDMHandler::SUPPORTED_LANGUAGE[] = "en";
 const char RDMHandler::SOFTWARE_VERSION_STRING[] = "1.0";
+const byte RDMHandler::PRODUCT_DETAIL_IDS[] = {0x04, 0x03};  // PWM dimmer
 const char RDMHandler::SET_SERIAL_PID_DESCRIPTION[] = "Set Serial Number";
+const char RDMHandler::CALIBRATION_PID_DESCRIPTION[] = "Colour Calibration";
+const char RDMHandler::OUTPUT_SYNC_PID_DESCRIPTION[] = "Output Sync";
+const char RDMHandler::PWM_CARRIER_PID_DESCRIPTION[] = "PWM Carrier";
+
+// The manufacturer PIDs
+const RDMHandler::parameter_description RDMHandler::PARAMETER_DESCRIPTIONS[] = {
+  // uint8, set only
+  {PID_MANUFACTURER_SET_SERIAL, 4, 0x03, 0x02, 0, 0xfffffffe, 1,
+    SET_SERIAL_PID_DESCRIPTION},
+  // the triplet then the 9 coefficients, not defined, get & set
+  {PID_MANUFACTURER_CALIBRATION, 1 + CalibrationClass::MATRIX_SIZE, 0x00,
+    0x03, 0, 0, 0, CALIBRATION_PID_DESCRIPTION},
+  // uint8, get & set. A SET with no data applies the staged frame.
+  {PID_MANUFACTURER_OUTPUT_SYNC, 1, 0x03, 0x03, 0, 1, 0,
+    OUTPUT_SYNC_PID_DESCRIPTION},
+  // the timer group then its settings, not defined, get & set. A SET is the
+  // group & the carrier.
+  {PID_MANUFACTURER_PWM_CARRIER, PWM_CARRIER_INFO_SIZE, 0x00, 0x03, 0, 0, 0,
+    PWM_CARRIER_PID_DESCRIPTION},
+};
 const char RDMHandler::TEMPERATURE_SENSOR_DESCRIPTION[] = "Case Temperature";
 
 
 /**
- * Verify a RDM checksum
- * @param message a pointer to an RDM message starting with the SUB_START_CODE
- * @param size the size of the message data
- * @return true if the checksum is ok, false otherwise
+ * Validate a RDM message as it arrives. This keeps a running checksum and
+ * checks the start codes, length and destination UID as soon as they are
+ * received, so messages for other devices can be dropped mid-stream.
+ * @param offset the offset of this byte in the message, the first byte is the
+ * start code.
+ * @param data the byte
+ * @return false if the rest of the message doesn't need to be buffered
+ */
+bool RDMHandler::ValidateByte(unsigned int offset, byte data) {
+  if (offset == 0)
+    m_stream_pending = true;
+  return Validate(&m_stream, offset, data);
+}
+
+
+/**
+ * Run one byte of a message through the validation.
  */
-bool RDMHandler::VerifyChecksum(const byte *message, int size) {
-  // don't checksum the checksum itself (last two bytes)
-  unsigned int checksum = 0;
-  for (int i = 0; i < size - 2; i++)
-    checksum += message[i];
+bool RDMHandler::Validate(validation_state *validation,
+                          unsigned int offset,
+                          byte data) {
+  PROFILE_SCOPE(PROFILE_VALIDATE);
+  if (offset == 0) {
+    validation->state = STREAM_OK;
+    validation->length = 0;
+    validation->esta_match = true;
+    validation->serial_number = 0;
+    validation->broadcast = true;
+    validation->esta_broadcast = true;
+    validation->checksum = 0;
+    validation->received_checksum = 0;
+  } else if (validation->state != STREAM_OK) {
+    return false;
+  }
+
+  if (offset < RDM_DEST_UID_OFFSET) {
+    bool ok = true;
+    if (offset == RDM_START_CODE_OFFSET) {
+      ok = data == START_CODE;
+    } else if (offset == RDM_SUB_START_CODE_OFFSET) {
+      ok = data == SUB_START_CODE;
+    } else {
+      validation->length = data;
+      ok = data >= MINIMUM_RDM_PACKET_SIZE - 2;
+    }
+    if (!ok) {
+      validation->state = STREAM_BAD_FORMAT;
+      return false;
+    }
+  } else if (offset < RDM_SRC_UID_OFFSET) {
+    // the destination UID, the serial number is looked up once it's complete
+    if (offset <= 4) {
+      validation->esta_match &= (
+          data == WidgetSettings.UIDByte(offset - RDM_DEST_UID_OFFSET));
+      validation->esta_broadcast &= data == 0xff;
+    } else {
+      validation->serial_number = (validation->serial_number << 8) + data;
+      validation->broadcast &= data == 0xff;
+    }
 
-  byte checksum_offset = message[2];
-  return (checksum >> 8 == message[checksum_offset] &&
-          (checksum & 0xff) == message[checksum_offset + 1]);
+    if (offset == 8) {
+      validation->responder = Responders.Find(validation->serial_number);
+      bool to_us = (
+          (validation->esta_match &&
+           (validation->responder != RespondersClass::COUNT ||
+            validation->broadcast)) ||
+          (validation->esta_broadcast && validation->broadcast));
+      if (!to_us) {
+        validation->state = STREAM_NOT_FOR_US;
+        return false;
+      }
+    }
+  }
+
+  if (offset < validation->length || offset < 3) {
+    validation->checksum += data;
+  } else if (offset == validation->length) {
+    validation->received_checksum = data << 8;
+  } else if (offset == validation->length + 1u) {
+    validation->received_checksum += data;
+  }
+  return true;
 }
 
 
@@ -103,7 +203,7 @@ int RDMHandler::ReadTemperatureSensor() {
   // v = input / 1024 * 5 V
   // t = 100 * v
   // we multiple the result by 10
-  return 10 * 5.0 * analogRead(TEMP_SENSOR_PIN) * 100.0 / 1024.0;
+  return 10 * 5.0 * analogRead(Board::TEMP_SENSOR_PIN) * 100.0 / 1024.0;
 }
 
 
@@ -122,6 +222,40 @@ void RDMHandler::SendSensorResponse(const byte *received_message) {
 }
 
 
+/**
+ * Mark all the cached responses as needing to be rebuilt.
+ */
+void RDMHandler::InvalidateCachedResponses() {
+  for (byte i = 0; i < CACHED_RESPONSE_COUNT; ++i)
+    m_cached_responses[i].data = NULL;
+}
+
+
+/**
+ * Send a cached response.
+ * @return false if the response needs to be built first.
+ */
+bool RDMHandler::SendCachedResponse(const byte *received_message,
+                                    byte index) {
+  if (!m_cached_responses[index].data)
+    return false;
+  rdm_sender.SendCachedResponse(received_message, m_cached_responses[index]);
+  return true;
+}
+
+
+/**
+ * Build a cached response.
+ */
+void RDMHandler::BuildCachedResponse(byte index,
+                                     unsigned int pid,
+                                     const byte *data,
+                                     byte data_size) {
+  rdm_sender.BuildCachedResponse(&m_cached_responses[index], pid, data,
+                                 data_size);
+}
+
+
 /**
  * Send a RDM message with a string as param data. Used for DEVICE_LABEL,
  * MANUFACTURER_LABEL, etc.
@@ -163,18 +297,26 @@ void RDMHandler::HandleGetQueuedMessage(const byte *received_message) {
  * Handle a GET SUPPORTED_PARAMETERS request
  */
 void RDMHandler::HandleGetSupportedParameters(const byte *received_message) {
+  if (SendCachedResponse(received_message, CACHED_SUPPORTED_PARAMETERS))
+    return;
+
   byte supported_params = 0;
   for (byte i = 0; i < sizeof(PID_DEFINITIONS) / sizeof(pid_definition); ++i) {
-    if (PID_DEFINITIONS[i].include_in_supported_params)
+    if (PID_DEFINITIONS[i].include_in_supported_params &&
+        supported_params < MAX_SUPPORTED_PARAMETERS) {
+      m_supported_parameters[2 * supported_params] =
+        PID_DEFINITIONS[i].pid >> 8;
+      m_supported_parameters[2 * supported_params + 1] =
+        PID_DEFINITIONS[i].pid;
       supported_params++;
+    }
   }
 
-  rdm_sender.StartRDMAckResponse(received_message, supported_params * 2);
-  for (byte i = 0; i < sizeof(PID_DEFINITIONS) / sizeof(pid_definition); ++i) {
-    if (PID_DEFINITIONS[i].include_in_supported_params)
-      rdm_sender.SendIntAndChecksum(PID_DEFINITIONS[i].pid);
-  }
-  rdm_sender.EndRDMResponse();
+  BuildCachedResponse(CACHED_SUPPORTED_PARAMETERS,
+                      PID_SUPPORTED_PARAMETERS,
+                      m_supported_parameters,
+                      supported_params * 2);
+  SendCachedResponse(received_message, CACHED_SUPPORTED_PARAMETERS);
 }
 
 
@@ -185,26 +327,34 @@ void RDMHandler::HandleGetParameterDescription(const byte *received_message) {
   unsigned int param_id = (((unsigned int) received_message[24] << 8) +
                            received_message[25]);
 
-  if (param_id != 0x8000) {
+  const parameter_description *description = NULL;
+  for (byte i = 0;
+       i < sizeof(PARAMETER_DESCRIPTIONS) / sizeof(parameter_description);
+       ++i) {
+    if (PARAMETER_DESCRIPTIONS[i].pid == param_id)
+      description = &PARAMETER_DESCRIPTIONS[i];
+  }
+
+  if (!description) {
     rdm_sender.SendNack(received_message, NR_DATA_OUT_OF_RANGE);
     return;
   }
 
-  rdm_sender.StartRDMAckResponse(received_message,
-                                 20 + sizeof(SET_SERIAL_PID_DESCRIPTION) - 1);
-  rdm_sender.SendIntAndChecksum(0x8000);
-  rdm_sender.SendByteAndChecksum(4);  // pdl size
-  rdm_sender.SendByteAndChecksum(0x03);  // data type, uint8
-  rdm_sender.SendByteAndChecksum(0x02);  // command class, set only
+  byte description_size = strlen(description->description);
+  rdm_sender.StartRDMAckResponse(received_message, 20 + description_size);
+  rdm_sender.SendIntAndChecksum(description->pid);
+  rdm_sender.SendByteAndChecksum(description->pdl_size);
+  rdm_sender.SendByteAndChecksum(description->data_type);
+  rdm_sender.SendByteAndChecksum(description->command_class);
   rdm_sender.SendByteAndChecksum(0);  // type
   rdm_sender.SendByteAndChecksum(0);  // unit, none
   rdm_sender.SendByteAndChecksum(0);  // prefix, none
-  rdm_sender.SendLongAndChecksum(0);  // min
-  rdm_sender.SendLongAndChecksum(0xfffffffe);  // max
-  rdm_sender.SendLongAndChecksum(1);  // default
+  rdm_sender.SendLongAndChecksum(description->min_value);
+  rdm_sender.SendLongAndChecksum(description->max_value);
+  rdm_sender.SendLongAndChecksum(description->default_value);
 
-  for (unsigned int i = 0; i < sizeof(SET_SERIAL_PID_DESCRIPTION) - 1; ++i)
-    rdm_sender.SendByteAndChecksum(SET_SERIAL_PID_DESCRIPTION[i]);
+  for (byte i = 0; i < description_size; ++i)
+    rdm_sender.SendByteAndChecksum(description->description[i]);
   rdm_sender.EndRDMResponse();
 }
 
@@ -213,23 +363,45 @@ void RDMHandler::HandleGetParameterDescription(const byte *received_message) {
  * Handle a GET DEVICE_INFO request
  */
 void RDMHandler::HandleGetDeviceInfo(const byte *received_message) {
-  rdm_sender.StartRDMAckResponse(received_message, 19);
-  rdm_sender.SendIntAndChecksum(256);  // protocol version
-  rdm_sender.SendIntAndChecksum(2);  // device model
-  rdm_sender.SendIntAndChecksum(0x0508);  // product category
-  rdm_sender.SendLongAndChecksum(SOFTWARE_VERSION);  // software version
-
-  byte personality = WidgetSettings.Personality();
-  rdm_sender.SendIntAndChecksum(rdm_personalities[personality - 1].slots);
-  // current personality
-  rdm_sender.SendByteAndChecksum(personality);
-  rdm_sender.SendByteAndChecksum(sizeof(rdm_personalities) /
-                                 sizeof(rdm_personality));
-  // DMX Start Address
-  rdm_sender.SendIntAndChecksum(WidgetSettings.StartAddress());
-  rdm_sender.SendIntAndChecksum(0);  // Sub device count
-  rdm_sender.SendByteAndChecksum(1);  // Sensor Count
-  rdm_sender.EndRDMResponse();
+  // only the widget's DEVICE_INFO is cached
+  bool cached = !Responders.Current();
+  if (cached && SendCachedResponse(received_message, CACHED_DEVICE_INFO))
+    return;
+
+  unsigned int footprint = Responders.Footprint();
+  unsigned int start_address = Responders.StartAddress();
+  byte *data = m_device_info;
+  *data++ = 1;  // protocol version
+  *data++ = 0;
+  *data++ = 0;  // device model
+  *data++ = 2;
+  *data++ = 0x05;  // product category
+  *data++ = 0x08;
+  *data++ = SOFTWARE_VERSION >> 24;  // software version
+  *data++ = SOFTWARE_VERSION >> 16;
+  *data++ = SOFTWARE_VERSION >> 8;
+  *data++ = SOFTWARE_VERSION;
+  *data++ = footprint >> 8;
+  *data++ = footprint;
+  *data++ = Responders.Personality();  // current personality
+  *data++ = PERSONALITY_COUNT;
+  *data++ = start_address >> 8;  // DMX Start Address
+  *data++ = start_address;
+  *data++ = 0;  // Sub device count
+  *data++ = 0;
+  *data++ = 1;  // Sensor Count
+
+  if (!cached) {
+    rdm_sender.StartRDMAckResponse(received_message, sizeof(m_device_info));
+    for (byte i = 0; i < sizeof(m_device_info); ++i)
+      rdm_sender.SendByteAndChecksum(m_device_info[i]);
+    rdm_sender.EndRDMResponse();
+    return;
+  }
+
+  BuildCachedResponse(CACHED_DEVICE_INFO, PID_DEVICE_INFO, m_device_info,
+                      sizeof(m_device_info));
+  SendCachedResponse(received_message, CACHED_DEVICE_INFO);
 }
 
 
@@ -237,9 +409,13 @@ void RDMHandler::HandleGetDeviceInfo(const byte *received_message) {
  * Handle a GET PRODUCT_DETAIL_ID request
  */
 void RDMHandler::HandleGetProductDetailId(const byte *received_message) {
-  rdm_sender.StartRDMAckResponse(received_message, 2);
-  rdm_sender.SendIntAndChecksum(0x0403);  // PWM dimmer
-  rdm_sender.EndRDMResponse();
+  if (!SendCachedResponse(received_message, CACHED_PRODUCT_DETAIL_ID_LIST)) {
+    BuildCachedResponse(CACHED_PRODUCT_DETAIL_ID_LIST,
+                        PID_PRODUCT_DETAIL_ID_LIST,
+                        PRODUCT_DETAIL_IDS,
+                        sizeof(PRODUCT_DETAIL_IDS));
+    SendCachedResponse(received_message, CACHED_PRODUCT_DETAIL_ID_LIST);
+  }
 }
 
 
@@ -248,7 +424,14 @@ void RDMHandler::HandleGetProductDetailId(const byte *received_message) {
  */
 void RDMHandler::HandleGetDeviceModelDescription(
     const byte *received_message) {
-  HandleStringRequest(received_message, DEVICE_NAME, DEVICE_NAME_SIZE);
+  if (!SendCachedResponse(received_message,
+                          CACHED_DEVICE_MODEL_DESCRIPTION)) {
+    BuildCachedResponse(CACHED_DEVICE_MODEL_DESCRIPTION,
+                        PID_DEVICE_MODEL_DESCRIPTION,
+                        reinterpret_cast<const byte*>(DEVICE_NAME),
+                        DEVICE_NAME_SIZE);
+    SendCachedResponse(received_message, CACHED_DEVICE_MODEL_DESCRIPTION);
+  }
 }
 
 
@@ -256,8 +439,13 @@ void RDMHandler::HandleGetDeviceModelDescription(
  * Handle a GET MANUFACTURER_NAME request
  */
 void RDMHandler::HandleGetManufacturerLabel(const byte *received_message) {
-  HandleStringRequest(received_message, MANUFACTURER_NAME,
-                      MANUFACTURER_NAME_SIZE);
+  if (!SendCachedResponse(received_message, CACHED_MANUFACTURER_LABEL)) {
+    BuildCachedResponse(CACHED_MANUFACTURER_LABEL,
+                        PID_MANUFACTURER_LABEL,
+                        reinterpret_cast<const byte*>(MANUFACTURER_NAME),
+                        MANUFACTURER_NAME_SIZE);
+    SendCachedResponse(received_message, CACHED_MANUFACTURER_LABEL);
+  }
 }
 
 
@@ -266,7 +454,7 @@ void RDMHandler::HandleGetManufacturerLabel(const byte *received_message) {
  */
 void RDMHandler::HandleGetDeviceLabel(const byte *received_message) {
   char device_label[MAX_LABEL_SIZE];
-  byte size = WidgetSettings.DeviceLabel(device_label, sizeof(device_label));
+  byte size = Responders.DeviceLabel(device_label, sizeof(device_label));
   HandleStringRequest(received_message, device_label, size);
 }
 
@@ -285,11 +473,14 @@ void RDMHandler::HandleGetLanguage(const byte *received_message) {
  * Handle a GET SOFTWARE_VERSION_LABEL request
  */
 void RDMHandler::HandleGetSoftwareVersion(const byte *received_message) {
-  rdm_sender.StartRDMAckResponse(received_message,
-                                 sizeof(SOFTWARE_VERSION_STRING));
-  for (unsigned int i = 0; i < sizeof(SOFTWARE_VERSION_STRING); ++i)
-    rdm_sender.SendByteAndChecksum(SOFTWARE_VERSION_STRING[i]);
-  rdm_sender.EndRDMResponse();
+  if (!SendCachedResponse(received_message, CACHED_SOFTWARE_VERSION_LABEL)) {
+    BuildCachedResponse(
+        CACHED_SOFTWARE_VERSION_LABEL,
+        PID_SOFTWARE_VERSION_LABEL,
+        reinterpret_cast<const byte*>(SOFTWARE_VERSION_STRING),
+        sizeof(SOFTWARE_VERSION_STRING));
+    SendCachedResponse(received_message, CACHED_SOFTWARE_VERSION_LABEL);
+  }
 }
 
 
@@ -298,9 +489,8 @@ void RDMHandler::HandleGetSoftwareVersion(const byte *received_message) {
  */
 void RDMHandler::HandleGetPersonality(const byte *received_message) {
   rdm_sender.StartRDMAckResponse(received_message, 2);
-  rdm_sender.SendByteAndChecksum(WidgetSettings.Personality());
-  rdm_sender.SendByteAndChecksum(sizeof(rdm_personalities) /
-                                 sizeof(rdm_personality));
+  rdm_sender.SendByteAndChecksum(Responders.Personality());
+  rdm_sender.SendByteAndChecksum(PERSONALITY_COUNT);
   rdm_sender.EndRDMResponse();
 }
 
@@ -310,10 +500,9 @@ void RDMHandler::HandleGetPersonality(const byte *received_message) {
  */
 void RDMHandler::HandleGetPersonalityDescription(
     const byte *received_message) {
-  byte max_personalities = sizeof(rdm_personalities) / sizeof(rdm_personality);
   byte personality_number = received_message[24];
 
-  if (personality_number == 0 || personality_number > max_personalities) {
+  if (personality_number == 0 || personality_number > PERSONALITY_COUNT) {
     rdm_sender.SendNack(received_message, NR_DATA_OUT_OF_RANGE);
     return;
   }
@@ -324,7 +513,7 @@ void RDMHandler::HandleGetPersonalityDescription(
 
   rdm_sender.StartRDMAckResponse(received_message, 3 + description_length);
   rdm_sender.SendByteAndChecksum(personality_number);
-  rdm_sender.SendIntAndChecksum(personality->slots);
+  rdm_sender.SendIntAndChecksum(PersonalityFootprint(personality));
   for (unsigned int i = 0; i < description_length; ++i)
     rdm_sender.SendByteAndChecksum(personality->description[i]);
   rdm_sender.EndRDMResponse();
@@ -335,9 +524,8 @@ void RDMHandler::HandleGetPersonalityDescription(
  * Handle a GET DMX_START_ADDRESS request
  */
 void RDMHandler::HandleGetStartAddress(const byte *received_message) {
-  int start_address = WidgetSettings.StartAddress();
-  rdm_sender.StartRDMAckResponse(received_message, sizeof(start_address));
-  rdm_sender.SendIntAndChecksum(start_address);
+  rdm_sender.StartRDMAckResponse(received_message, 2);
+  rdm_sender.SendIntAndChecksum(Responders.StartAddress());
   rdm_sender.EndRDMResponse();
 }
 
@@ -386,9 +574,8 @@ void RDMHandler::HandleGetSensorValue(const byte *received_message) {
  * Handle a GET DEVICE_POWER_CYCLES request
  */
 void RDMHandler::HandleGetDevicePowerCycles(const byte *received_message) {
-  unsigned long power_cycles = WidgetSettings.DevicePowerCycles();
-  rdm_sender.StartRDMAckResponse(received_message, sizeof(power_cycles));
-  rdm_sender.SendLongAndChecksum(power_cycles);
+  rdm_sender.StartRDMAckResponse(received_message, 4);
+  rdm_sender.SendLongAndChecksum(WidgetSettings.DevicePowerCycles());
   rdm_sender.EndRDMResponse();
 }
 
@@ -398,7 +585,75 @@ void RDMHandler::HandleGetDevicePowerCycles(const byte *received_message) {
  */
 void RDMHandler::HandleGetIdentifyDevice(const byte *received_message) {
   rdm_sender.StartRDMAckResponse(received_message, 1);
-  rdm_sender.SendByteAndChecksum(m_identify_mode_enabled);
+  rdm_sender.SendByteAndChecksum(Responders.Identify());
+  rdm_sender.EndRDMResponse();
+}
+
+
+/**
+ * Handle a GET PRESET_PLAYBACK request
+ */
+void RDMHandler::HandleGetPresetPlayback(const byte *received_message) {
+  rdm_sender.StartRDMAckResponse(received_message, 3);
+  rdm_sender.SendIntAndChecksum(PresetPlayer.Mode());
+  rdm_sender.SendByteAndChecksum(PresetPlayer.Level());
+  rdm_sender.EndRDMResponse();
+}
+
+
+/**
+ * Handle a GET MANUFACTURER_CALIBRATION request. The param data is the
+ * triplet, starting from 1.
+ */
+void RDMHandler::HandleGetCalibration(const byte *received_message) {
+  byte triplet = received_message[24];
+  if (triplet == 0 || triplet > RGB_TRIPLET_COUNT) {
+    rdm_sender.SendNack(received_message, NR_DATA_OUT_OF_RANGE);
+    return;
+  }
+
+  const byte *matrix = Calibration.Matrix(triplet - 1);
+  rdm_sender.StartRDMAckResponse(received_message,
+                                 1 + CalibrationClass::MATRIX_SIZE);
+  rdm_sender.SendByteAndChecksum(triplet);
+  for (byte i = 0; i < CalibrationClass::MATRIX_SIZE; ++i)
+    rdm_sender.SendByteAndChecksum(matrix[i]);
+  rdm_sender.EndRDMResponse();
+}
+
+
+/**
+ * Handle a GET PID_MANUFACTURER_OUTPUT_SYNC request
+ */
+void RDMHandler::HandleGetOutputSync(const byte *received_message) {
+  rdm_sender.StartRDMAckResponse(received_message, 1);
+  rdm_sender.SendByteAndChecksum(OutputSync.Enabled());
+  rdm_sender.EndRDMResponse();
+}
+
+
+/**
+ * Handle a GET PID_MANUFACTURER_PWM_CARRIER request. The response is the
+ * group, the carrier, the fastest carrier the group supports, the number of
+ * outputs on it, the frequency in Hz, the number of levels and the pulse
+ * width of one level in ns. The last one shrinks as the carrier goes up.
+ */
+void RDMHandler::HandleGetPwmCarrier(const byte *received_message) {
+  byte group = received_message[24];
+  if (group == 0 || group > PwmCarrier.GroupCount()) {
+    rdm_sender.SendNack(received_message, NR_DATA_OUT_OF_RANGE);
+    return;
+  }
+
+  group--;
+  rdm_sender.StartRDMAckResponse(received_message, PWM_CARRIER_INFO_SIZE);
+  rdm_sender.SendByteAndChecksum(group + 1);
+  rdm_sender.SendByteAndChecksum(PwmCarrier.Carrier(group));
+  rdm_sender.SendByteAndChecksum(PwmCarrier.MaxCarrier(group));
+  rdm_sender.SendByteAndChecksum(PwmCarrier.OutputCount(group));
+  rdm_sender.SendLongAndChecksum(PwmCarrier.Frequency(group));
+  rdm_sender.SendIntAndChecksum(PwmCarrier.Levels(group));
+  rdm_sender.SendIntAndChecksum(PwmCarrier.LevelNanoseconds(group));
   rdm_sender.EndRDMResponse();
 }
 
@@ -451,6 +706,18 @@ void RDMHandler::HandleSetDeviceLabel(bool was_broadcast,
     return;
   }
 
+  if (Responders.Current()) {
+    // the virtual responders keep their labels in RAM
+    Responders.SetDeviceLabel((char*) received_message + 24,
+                              received_message[23]);
+    if (was_broadcast) {
+      rdm_sender.ReturnRDMErrorResponse(RDM_STATUS_BROADCAST);
+    } else {
+      rdm_sender.SendEmptyAck(received_message);
+    }
+    return;
+  }
+
   WidgetSettings.SetDeviceLabel((char*) received_message + 24,
                                 received_message[23]);
 
@@ -480,15 +747,20 @@ void RDMHandler::HandleSetPersonality(bool was_broadcast,
   }
 
   if (received_message[24] == 0 ||
-      received_message[24] >
-      sizeof(rdm_personalities) / sizeof(rdm_personality)) {
+      received_message[24] > PERSONALITY_COUNT) {
     rdm_sender.NackOrBroadcast(was_broadcast,
                                received_message,
                                NR_DATA_OUT_OF_RANGE);
     return;
   }
 
-  WidgetSettings.SetPersonality(received_message[24]);
+  Responders.SetPersonality(received_message[24]);
+  if (!Responders.Current()) {
+    OutputMap.Compile(WidgetSettings.Personality(),
+                      WidgetSettings.StartAddress());
+    PwmCarrier.SetPersonalityDefaults(WidgetSettings.Personality());
+    m_cached_responses[CACHED_DEVICE_INFO].data = NULL;
+  }
   if (was_broadcast) {
     rdm_sender.ReturnRDMErrorResponse(RDM_STATUS_BROADCAST);
   } else {
@@ -521,7 +793,12 @@ void RDMHandler::HandleSetStartAddress(bool was_broadcast,
     return;
   }
 
-  WidgetSettings.SetStartAddress(new_start_address);
+  Responders.SetStartAddress(new_start_address);
+  if (!Responders.Current()) {
+    OutputMap.Compile(WidgetSettings.Personality(),
+                      WidgetSettings.StartAddress());
+    m_cached_responses[CACHED_DEVICE_INFO].data = NULL;
+  }
 
   if (was_broadcast) {
     rdm_sender.ReturnRDMErrorResponse(RDM_STATUS_BROADCAST);
@@ -634,8 +911,7 @@ void RDMHandler::HandleSetIdentifyDevice(bool was_broadcast,
     return;
   }
 
-  m_identify_mode_enabled = received_message[24];
-  digitalWrite(IDENTIFY_LED_PIN, m_identify_mode_enabled);
+  Responders.SetIdentify(received_message[24]);
 
   if (was_broadcast) {
     rdm_sender.ReturnRDMErrorResponse(RDM_STATUS_BROADCAST);
@@ -672,6 +948,188 @@ void RDMHandler::HandleSetSerial(bool was_broadcast,
   }
 
   WidgetSettings.SetSerialNumber(new_serial_number);
+  // our UID is part of every cached response
+  InvalidateCachedResponses();
+
+  if (was_broadcast) {
+    rdm_sender.ReturnRDMErrorResponse(RDM_STATUS_BROADCAST);
+  } else {
+    rdm_sender.SendEmptyAck(received_message);
+  }
+}
+
+
+/**
+ * Handle a SET CAPTURE_PRESET request
+ */
+void RDMHandler::HandleCapturePreset(bool was_broadcast,
+                                     int sub_device,
+                                     const byte *received_message) {
+  if (received_message[23] != 8) {
+    rdm_sender.NackOrBroadcast(was_broadcast,
+                               received_message,
+                               NR_FORMAT_ERROR);
+    return;
+  }
+
+  unsigned int scene = (((unsigned int) received_message[24] << 8) +
+                        received_message[25]);
+  if (scene == 0 || scene > WidgetSettingsClass::MAX_SCENES) {
+    rdm_sender.NackOrBroadcast(was_broadcast,
+                               received_message,
+                               NR_DATA_OUT_OF_RANGE);
+    return;
+  }
+
+  unsigned int up_fade = (((unsigned int) received_message[26] << 8) +
+                          received_message[27]);
+  unsigned int down_fade = (((unsigned int) received_message[28] << 8) +
+                            received_message[29]);
+  unsigned int wait_time = (((unsigned int) received_message[30] << 8) +
+                            received_message[31]);
+  // DMX frames are applied while the EEPROM is written, so capture the
+  // levels as they are now
+  byte levels[PWM_OUTPUT_COUNT];
+  memcpy(levels, output_levels, sizeof(levels));
+  WidgetSettings.CaptureScene(scene, levels, up_fade, down_fade, wait_time);
+
+  if (was_broadcast) {
+    rdm_sender.ReturnRDMErrorResponse(RDM_STATUS_BROADCAST);
+  } else {
+    rdm_sender.SendEmptyAck(received_message);
+  }
+}
+
+
+/**
+ * Handle a SET PRESET_PLAYBACK request
+ */
+void RDMHandler::HandleSetPresetPlayback(bool was_broadcast,
+                                         int sub_device,
+                                         const byte *received_message) {
+  if (received_message[23] != 3) {
+    rdm_sender.NackOrBroadcast(was_broadcast,
+                               received_message,
+                               NR_FORMAT_ERROR);
+    return;
+  }
+
+  unsigned int mode = (((unsigned int) received_message[24] << 8) +
+                       received_message[25]);
+  byte level = received_message[26];
+
+  bool valid = mode == PRESET_PLAYBACK_OFF;
+  valid |= mode == PRESET_PLAYBACK_ALL && WidgetSettings.AnySceneCaptured();
+  valid |= (mode <= WidgetSettingsClass::MAX_SCENES &&
+            WidgetSettings.SceneCaptured(mode));
+  if (!valid) {
+    rdm_sender.NackOrBroadcast(was_broadcast,
+                               received_message,
+                               NR_DATA_OUT_OF_RANGE);
+    return;
+  }
+
+  // save the mode so playback resumes after a power cycle
+  WidgetSettings.SetPresetPlayback(mode, level);
+  PresetPlayer.Start(mode, level);
+
+  if (was_broadcast) {
+    rdm_sender.ReturnRDMErrorResponse(RDM_STATUS_BROADCAST);
+  } else {
+    rdm_sender.SendEmptyAck(received_message);
+  }
+}
+
+
+/**
+ * Handle a SET MANUFACTURER_CALIBRATION request. This is the triplet,
+ * starting from 1, then the matrix in row order.
+ */
+void RDMHandler::HandleSetCalibration(bool was_broadcast,
+                                      int sub_device,
+                                      const byte *received_message) {
+  if (received_message[23] != 1 + CalibrationClass::MATRIX_SIZE) {
+    rdm_sender.NackOrBroadcast(was_broadcast,
+                               received_message,
+                               NR_FORMAT_ERROR);
+    return;
+  }
+
+  byte triplet = received_message[24];
+  if (triplet == 0 || triplet > RGB_TRIPLET_COUNT) {
+    rdm_sender.NackOrBroadcast(was_broadcast,
+                               received_message,
+                               NR_DATA_OUT_OF_RANGE);
+    return;
+  }
+
+  Calibration.SetMatrix(triplet - 1, received_message + 25);
+
+  if (was_broadcast) {
+    rdm_sender.ReturnRDMErrorResponse(RDM_STATUS_BROADCAST);
+  } else {
+    rdm_sender.SendEmptyAck(received_message);
+  }
+}
+
+
+/**
+ * Handle a SET PID_MANUFACTURER_OUTPUT_SYNC request. With one byte this turns
+ * sync mode on or off, with no data it applies the staged frame. The latter
+ * is normally broadcast so every responder on the line changes together.
+ */
+void RDMHandler::HandleSetOutputSync(bool was_broadcast,
+                                     int sub_device,
+                                     const byte *received_message) {
+  byte param_data_size = received_message[23];
+  if (param_data_size > 1) {
+    rdm_sender.NackOrBroadcast(was_broadcast,
+                               received_message,
+                               NR_FORMAT_ERROR);
+    return;
+  }
+
+  if (param_data_size) {
+    if (received_message[24] > 1) {
+      rdm_sender.NackOrBroadcast(was_broadcast,
+                                 received_message,
+                                 NR_DATA_OUT_OF_RANGE);
+      return;
+    }
+    OutputSync.SetEnabled(received_message[24]);
+  } else {
+    OutputSync.Sync();
+  }
+
+  if (was_broadcast) {
+    rdm_sender.ReturnRDMErrorResponse(RDM_STATUS_BROADCAST);
+  } else {
+    rdm_sender.SendEmptyAck(received_message);
+  }
+}
+
+
+/**
+ * Handle a SET PID_MANUFACTURER_PWM_CARRIER request
+ */
+void RDMHandler::HandleSetPwmCarrier(bool was_broadcast,
+                                    int sub_device,
+                                    const byte *received_message) {
+  if (received_message[23] != 2) {
+    rdm_sender.NackOrBroadcast(was_broadcast,
+                               received_message,
+                               NR_FORMAT_ERROR);
+    return;
+  }
+
+  byte group = received_message[24];
+  if (group == 0 ||
+      !PwmCarrier.SetCarrier(group - 1, received_message[25])) {
+    rdm_sender.NackOrBroadcast(was_broadcast,
+                               received_message,
+                               NR_DATA_OUT_OF_RANGE);
+    return;
+  }
 
   if (was_broadcast) {
     rdm_sender.ReturnRDMErrorResponse(RDM_STATUS_BROADCAST);
@@ -681,6 +1139,70 @@ void RDMHandler::HandleSetSerial(bool was_broadcast,
 }
 
 
+/**
+ * Handle the discovery commands. Discovery messages are never NACKed, if we
+ * don't respond on the line the host gets RDM_STATUS_BROADCAST.
+ */
+void RDMHandler::HandleDiscovery(bool was_broadcast, const byte *message) {
+  unsigned int param_id = (message[21] << 8) + message[22];
+  byte param_data_size = message[23];
+
+  if (param_id == PID_DISC_UNIQUE_BRANCH) {
+    // respond if an unmuted UID is between the lower & upper bounds. If more
+    // than one is, the responses collide.
+    byte responding = 0;
+    byte first = 0;
+    for (byte i = 0; i < RespondersClass::COUNT; ++i) {
+      Responders.Select(i);
+      if (!Responders.Muted() && InDiscoveryRange(message) && !responding++)
+        first = i;
+    }
+    Responders.Select(first);
+
+    if (param_data_size == 12 && responding)
+      rdm_sender.SendDiscoveryResponse(responding > 1);
+    else
+      rdm_sender.ReturnRDMErrorResponse(RDM_STATUS_BROADCAST);
+    return;
+  }
+
+  if ((param_id == PID_DISC_MUTE || param_id == PID_DISC_UN_MUTE) &&
+      param_data_size == 0) {
+    Responders.SetMuted(param_id == PID_DISC_MUTE);
+    if (was_broadcast) {
+      rdm_sender.ReturnRDMErrorResponse(RDM_STATUS_BROADCAST);
+    } else {
+      // the control field, we don't set any of the flags
+      rdm_sender.StartCustomResponse(message, RDM_RESPONSE_ACK, 2,
+                                     DISCOVERY_COMMAND_RESPONSE, param_id);
+      rdm_sender.SendIntAndChecksum(0);
+      rdm_sender.EndRDMResponse();
+    }
+    return;
+  }
+
+  rdm_sender.ReturnRDMErrorResponse(RDM_STATUS_INVALID_COMMAND);
+}
+
+
+/**
+ * Check if the selected responder's UID is between the lower & upper bounds
+ * of a DISC_UNIQUE_BRANCH, inclusive.
+ */
+bool RDMHandler::InDiscoveryRange(const byte *message) const {
+  char lower = 0;
+  char upper = 0;
+  for (byte i = 0; i < 6; ++i) {
+    byte b = Responders.UIDByte(i);
+    if (!lower && b != message[24 + i])
+      lower = b > message[24 + i] ? 1 : -1;
+    if (!upper && b != message[30 + i])
+      upper = b < message[30 + i] ? 1 : -1;
+  }
+  return lower >= 0 && upper >= 0;
+}
+
+
 /*
  * Handle an RDM message
  * @param message pointer to a RDM message where the first byte is the sub star
@@ -688,37 +1210,115 @@ void RDMHandler::HandleSetSerial(bool was_broadcast,
  * @param size the size of the message data.
  */
 void RDMHandler::HandleRDMMessage(const byte *message, int size) {
+  // if the message wasn't validated as it arrived, do it now
+  if (!m_stream_pending) {
+    for (int i = 0; i < size; ++i) {
+      if (!Validate(&m_stream, i, message[i]))
+        break;
+    }
+  }
+  m_stream_pending = false;
+  HandleValidatedMessage(message, size, m_stream);
+}
+
+
+/**
+ * Handle a message from the line. The response is written to the buffer
+ * rather than sent to the host.
+ */
+unsigned int RDMHandler::HandleLineRDMMessage(const byte *message,
+                                              int size,
+                                              byte *response,
+                                              unsigned int response_size) {
+  validation_state validation;
+  for (int i = 0; i < size; ++i) {
+    if (!Validate(&validation, i, message[i]))
+      break;
+  }
+
+  rdm_sender.SetMode(RDMSender::LINE_RESPONSE, response, response_size);
+  HandleValidatedMessage(message, size, validation);
+  unsigned int response_length = rdm_sender.ResponseSize();
+  rdm_sender.SetMode(RDMSender::HOST_RESPONSE);
+  return response_length;
+}
+
+
+/**
+ * Handle a batch of GET requests from the host and send all the responses in
+ * a single reply. The reply size has to be known before the header is sent,
+ * so the requests are run twice, once to count the bytes and once to send
+ * them. This is why only GETs without side effects are allowed.
+ * @param message the requests, back to back
+ * @param size the size of the message
+ */
+void RDMHandler::HandleRDMBatch(const byte *message, unsigned int size) {
+  rdm_sender.SetMode(RDMSender::BATCH_COUNT);
+  HandleBatchRequests(message, size);
+  rdm_sender.StartBatch(rdm_sender.ResponseSize());
+  rdm_sender.SetMode(RDMSender::BATCH_RESPONSE);
+  HandleBatchRequests(message, size);
+  rdm_sender.EndBatch();
+  rdm_sender.SetMode(RDMSender::HOST_RESPONSE);
+}
+
+
+/**
+ * Run each request in a batch. A request that can't be framed ends the
+ * batch with RDM_STATUS_FAILED.
+ */
+void RDMHandler::HandleBatchRequests(const byte *message, unsigned int size) {
+  unsigned int offset = 0;
+  while (offset < size) {
+    // each request is a scheduler step
+    Scheduler.Yield();
+    const byte *request = message + offset;
+    unsigned int remaining = size - offset;
+    if (remaining < 3 || request[0] != START_CODE ||
+        request[2] + 2u > remaining) {
+      rdm_sender.ReturnRDMErrorResponse(RDM_STATUS_FAILED);
+      return;
+    }
+    unsigned int request_size = request[2] + 2;
+    offset += request_size;
+
+    if (request_size >= MINIMUM_RDM_PACKET_SIZE &&
+        (request[20] != GET_COMMAND ||
+         ((request[21] << 8) + request[22]) == PID_QUEUED_MESSAGE)) {
+      rdm_sender.ReturnRDMErrorResponse(RDM_STATUS_INVALID_COMMAND);
+      continue;
+    }
+
+    validation_state validation;
+    for (unsigned int i = 0; i < request_size; ++i) {
+      if (!Validate(&validation, i, request[i]))
+        break;
+    }
+    HandleValidatedMessage(request, request_size, validation);
+  }
+}
+
+
+/**
+ * Handle a message once it has been through the validation.
+ */
+void RDMHandler::HandleValidatedMessage(const byte *message,
+                                        int size,
+                                        const validation_state &validation) {
   // check for a packet that is too small, an invalid start / sub start code
   // or a mismatched message length.
-  if (size < MINIMUM_RDM_PACKET_SIZE || message[0] != START_CODE ||
-      message[1] != SUB_START_CODE || message[2] != size - 2) {
+  if (size < MINIMUM_RDM_PACKET_SIZE ||
+      validation.state == STREAM_BAD_FORMAT ||
+      validation.length != size - 2) {
     rdm_sender.ReturnRDMErrorResponse(RDM_STATUS_FAILED);
     return;
   }
 
-  if (!VerifyChecksum(message, size)) {
-    rdm_sender.ReturnRDMErrorResponse(RDM_STATUS_FAILED_CHECKSUM);
-    return;
-  }
-
   // true if this is broadcast or vendorcast, in which case we don't return a
   // RDM message
-  bool is_broadcast = true;
-  for (int i = 5; i <= 8; ++i) {
-    is_broadcast &= (message[i] == 0xff);
-  }
-
-  int expected_esta_id = message[3];
-  expected_esta_id  = expected_esta_id << 8;
-  expected_esta_id += message[4];
+  bool is_broadcast = validation.broadcast;
 
-  bool to_us = (
-      (expected_esta_id == WidgetSettings.EstaId() &&
-       (WidgetSettings.MatchesSerialNumber(message + 5) ||
-        is_broadcast)) ||
-      (expected_esta_id == 0xffff && is_broadcast));
-
-  if (!to_us) {
+  if (validation.state == STREAM_NOT_FOR_US) {
     if (is_broadcast) {
       rdm_sender.ReturnRDMErrorResponse(RDM_STATUS_BROADCAST);
     } else {
@@ -727,14 +1327,69 @@ void RDMHandler::HandleRDMMessage(const byte *message, int size) {
     return;
   }
 
+  if (validation.checksum != validation.received_checksum) {
+    rdm_sender.ReturnRDMErrorResponse(RDM_STATUS_FAILED_CHECKSUM);
+    return;
+  }
+
+#ifdef VIRTUAL_RESPONDERS
+  if (is_broadcast) {
+    HandleBroadcast(message, validation.received_checksum);
+    return;
+  }
+  Responders.Select(validation.responder);
+#endif
+  HandleRequest(message, is_broadcast, validation.received_checksum);
+}
+
+
+#ifdef VIRTUAL_RESPONDERS
+/**
+ * Every responder acts on a broadcast SET or mute. There's no reply on the
+ * line, and only the widget's status code is sent to the host.
+ */
+void RDMHandler::HandleBroadcast(const byte *message, unsigned int checksum) {
+  byte command_class = message[RDM_COMMAND_CLASS_OFFSET];
+  unsigned int param_id = RDMReadShort(message + RDM_PID_OFFSET);
+  // DISC_UNIQUE_BRANCH checks all the responders itself
+  if (command_class != GET_COMMAND && param_id != PID_DISC_UNIQUE_BRANCH) {
+    bool discard = rdm_sender.Mode() == RDMSender::HOST_RESPONSE;
+    if (discard)
+      rdm_sender.SetMode(RDMSender::DISCARD_RESPONSE);
+    for (byte i = RespondersClass::COUNT - 1; i; --i) {
+      Scheduler.Yield();
+      Responders.Select(i);
+      HandleRequest(message, true, checksum);
+    }
+    if (discard)
+      rdm_sender.SetMode(RDMSender::HOST_RESPONSE);
+  }
+  Responders.Select(0);
+  HandleRequest(message, true, checksum);
+}
+#endif
+
+
+/**
+ * Handle a request for the selected responder, once it's been validated.
+ */
+void RDMHandler::HandleRequest(const byte *message,
+                               bool is_broadcast,
+                               unsigned int checksum) {
   // check the command class
-  byte command_class = message[20];
+  byte command_class = message[RDM_COMMAND_CLASS_OFFSET];
+  if (command_class == DISCOVERY_COMMAND) {
+    HandleDiscovery(is_broadcast, message);
+    return;
+  }
+
   if (command_class != GET_COMMAND && command_class != SET_COMMAND) {
     rdm_sender.ReturnRDMErrorResponse(RDM_STATUS_INVALID_COMMAND);
+    return;
   }
 
   // check sub devices
-  unsigned int sub_device = (message[18] << 8) + message[19];
+  unsigned int sub_device = RDMReadShort(message + RDM_SUB_DEVICE_OFFSET);
   if (sub_device != 0 && sub_device != 0xffff) {
     // respond with nack
     rdm_sender.NackOrBroadcast(is_broadcast,
@@ -743,7 +1398,7 @@ void RDMHandler::HandleRDMMessage(const byte *message, int size) {
     return;
   }
 
-  unsigned int param_id = (message[21] << 8) + message[22];
+  unsigned int param_id = RDMReadShort(message + RDM_PID_OFFSET);
 
   pid_definition const *pid_handler = NULL;
   for (byte i = 0; i < sizeof(PID_DEFINITIONS) / sizeof(pid_definition); ++i) {
@@ -773,11 +1428,12 @@ void RDMHandler::HandleRDMMessage(const byte *message, int size) {
       return;
     }
 
-    if (message[23] != pid_handler->get_argument_size) {
+    if (message[RDM_PDL_OFFSET] != pid_handler->get_argument_size) {
       rdm_sender.SendNack(message, NR_FORMAT_ERROR);
       return;
     }
 
+    PROFILE_PID_SCOPE(param_id, command_class);
     (this->*(pid_handler->get_handler))(message);
 
   } else  {
@@ -787,6 +1443,69 @@ void RDMHandler::HandleRDMMessage(const byte *message, int size) {
       return;
     }
 
+    // broadcasts don't get a response, so there's nothing to replay
+    if (!is_broadcast) {
+      if (ReplaySet(message, checksum))
+        return;
+      RecordSet(message, checksum);
+    }
+
+    PROFILE_PID_SCOPE(param_id, command_class);
     (this->*(pid_handler->set_handler))(is_broadcast, sub_device, message);
+    rdm_sender.StopRecording();
+  }
+}
+
+
+/**
+ * Send the recorded response if this SET is a retransmission. Entries that
+ * have expired, or that are from this source with another transaction
+ * number, are dropped along the way. The timestamps are 16 bits, so an entry
+ * that goes unchecked for 65s can look fresh again, but it still has to
+ * match the source, transaction number, PID & data.
+ * @return true if the response was sent
+ */
+bool RDMHandler::ReplaySet(const byte *message, unsigned int checksum) {
+  unsigned int pid = RDMReadShort(message + RDM_PID_OFFSET);
+  unsigned int now = millis();
+  for (byte i = 0; i < SET_REPLAY_COUNT; ++i) {
+    set_replay &replay = m_set_replays[i];
+    if (replay.response.data_size == RDMSender::NOT_RECORDED)
+      continue;
+
+    bool same_source = !memcmp(replay.src_uid, message + RDM_SRC_UID_OFFSET,
+                               RDM_UID_SIZE);
+    bool same_transaction =
+        replay.transaction_number == message[RDM_TN_OFFSET];
+    if (now - replay.recorded > SET_REPLAY_MS ||
+        (same_source && !same_transaction)) {
+      replay.response.data_size = RDMSender::NOT_RECORDED;
+      continue;
+    }
+
+    if (!same_source || !same_transaction || replay.checksum != checksum ||
+        replay.pid != pid)
+      continue;
+
+    rdm_sender.SendRecordedResponse(message, replay.response);
+    m_replayed_sets++;
+    return true;
   }
+  return false;
+}
+
+
+/**
+ * Record the response to this SET, replacing the oldest entry.
+ */
+void RDMHandler::RecordSet(const byte *message, unsigned int checksum) {
+  set_replay *replay = &m_set_replays[m_next_set_replay];
+  m_next_set_replay = (m_next_set_replay + 1) % SET_REPLAY_COUNT;
+
+  memcpy(replay->src_uid, message + RDM_SRC_UID_OFFSET, RDM_UID_SIZE);
+  replay->transaction_number = message[RDM_TN_OFFSET];
+  replay->pid = RDMReadShort(message + RDM_PID_OFFSET);
+  replay->checksum = checksum;
+  replay->recorded = millis();
+  rdm_sender.StartRecording(&replay->response);
 }
@@ -22,6 +22,7 @@
 #define RDM_HANDLERS_H
 
 #include "Arduino.h"
+#include "Board.h"
 #include "RDMSender.h"
 
 /**
@@ -30,12 +31,17 @@
 class RDMHandler {
   public:
     explicit RDMHandler(const UsbProSender *sender)
-      : m_identify_mode_enabled(false),
-        m_device_label_pending(false),
+      : m_device_label_pending(false),
         m_sent_device_label(false),
-        rdm_sender(sender) {
-      pinMode(IDENTIFY_LED_PIN, OUTPUT);
-      digitalWrite(IDENTIFY_LED_PIN, m_identify_mode_enabled);
+        m_stream_pending(false),
+        rdm_sender(sender),
+        m_next_set_replay(0),
+        m_replayed_sets(0) {
+      Board::IdentifyLedPin::Output();
+      Board::IdentifyLedPin::Set(false);
+      InvalidateCachedResponses();
+      for (byte i = 0; i < SET_REPLAY_COUNT; ++i)
+        m_set_replays[i].response.data_size = RDMSender::NOT_RECORDED;
     }
 
     /*
@@ -46,10 +52,48 @@ class RDMHandler {
      */
     void HandleRDMMessage(const byte *message, int size);
 
+    // Called when the settings change without an RDM SET
+    void InvalidateCachedResponses();
+
+    /*
+     * Handle an RDM message received on the DMX line.
+     * @param message pointer to the RDM message, starting with the start code
+     * @param size the size of the message data.
+     * @param response the buffer to write the response to
+     * @param response_size the size of the response buffer
+     * @return the size of the response, 0 if there isn't one. Discovery
+     * responses start with 0xfe rather than the start code and are sent
+     * without a break.
+     */
+    unsigned int HandleLineRDMMessage(const byte *message,
+                                      int size,
+                                      byte *response,
+                                      unsigned int response_size);
+
+    /*
+     * Validate a RDM message as it arrives, this must be called for each byte
+     * in order, starting from offset 0.
+     * @return false if the rest of the message doesn't need to be buffered.
+     */
+    bool ValidateByte(unsigned int offset, byte data);
+
+    /*
+     * Handle a batch of RDM GET requests, all the responses are returned in a
+     * single RDM_BATCH_LABEL message. Each response is the status code,
+     * followed by the RDM message if the status is RDM_STATUS_OK.
+     * @param message the RDM requests back to back, each starting with the
+     * start code.
+     * @param size the size of the message data.
+     */
+    void HandleRDMBatch(const byte *message, unsigned int size);
+
     void QueueSetDeviceLabel() {
       m_device_label_pending = true;
     }
 
+    // The number of retransmitted SETs answered from the replay cache
+    unsigned int ReplayedSets() const { return m_replayed_sets; }
+
   private:
     // The definition for a PID, this includes which functions to call to
     // handle GET/SET requests and if we should include this PID in the list of
@@ -64,20 +108,111 @@ class RDMHandler {
       bool include_in_supported_params;
     } pid_definition;
 
-    // personalities
+    // The PARAMETER_DESCRIPTION for a manufacturer PID
     typedef struct {
-      byte personality_number;
-      byte slots;
+      unsigned int pid;
+      byte pdl_size;
+      byte data_type;
+      byte command_class;
+      unsigned long min_value;
+      unsigned long max_value;
+      unsigned long default_value;
       const char *description;
-    } rdm_personality;
+    } parameter_description;
+
+    // The state of the incremental validation
+    typedef enum {
+      STREAM_OK,
+      STREAM_BAD_FORMAT,
+      STREAM_NOT_FOR_US,
+    } stream_state;
+
+    typedef struct {
+      stream_state state;
+      byte length;
+      bool esta_match;
+      unsigned long serial_number;
+      byte responder;  // see RespondersClass::Find()
+      bool broadcast;
+      bool esta_broadcast;
+      unsigned int checksum;
+      unsigned int received_checksum;
+    } validation_state;
+
+    // The GETs with prebuilt responses
+    enum {
+      CACHED_DEVICE_INFO,
+      CACHED_SUPPORTED_PARAMETERS,
+      CACHED_DEVICE_MODEL_DESCRIPTION,
+      CACHED_MANUFACTURER_LABEL,
+      CACHED_SOFTWARE_VERSION_LABEL,
+      CACHED_PRODUCT_DETAIL_ID_LIST,
+      CACHED_RESPONSE_COUNT
+    };
+
+    enum { DEVICE_INFO_SIZE = 19 };
+    // the supported parameters list is truncated after this many PIDs
+    enum { MAX_SUPPORTED_PARAMETERS = 24 };
+
+    // A controller retransmits a SET if the response was lost or slow. The
+    // retransmission has the same source UID, transaction number & PID, so
+    // it's answered with the first response rather than run again. The
+    // checksum stops a reused transaction number with new data matching.
+    // Retries come within a few hundred ms, older entries are dropped, as are
+    // a source's entries once it moves on to a new transaction number.
+    enum { SET_REPLAY_COUNT = 4 };
+    enum { SET_REPLAY_MS = 500 };
+    typedef struct {
+      byte src_uid[RDM_UID_SIZE];
+      byte transaction_number;
+      unsigned int pid;
+      unsigned int checksum;
+      unsigned int recorded;  // the low 16 bits of millis()
+      RDMSender::recorded_response response;
+    } set_replay;
 
-    bool m_identify_mode_enabled;
     bool m_device_label_pending;
     bool m_sent_device_label;
+    // true if ValidateByte has seen the current message
+    bool m_stream_pending;
+    // messages from the host are validated as they arrive, line messages are
+    // validated separately so they don't disturb a partly received message.
+    validation_state m_stream;
     RDMSender rdm_sender;
 
+    RDMSender::cached_response m_cached_responses[CACHED_RESPONSE_COUNT];
+    // param data for the cached responses that can't point at a constant
+    byte m_device_info[DEVICE_INFO_SIZE];
+    byte m_supported_parameters[2 * MAX_SUPPORTED_PARAMETERS];
+
+    set_replay m_set_replays[SET_REPLAY_COUNT];
+    byte m_next_set_replay;
+    unsigned int m_replayed_sets;
+
+    static bool Validate(validation_state *validation,
+                         unsigned int offset,
+                         byte data);
+    void HandleValidatedMessage(const byte *message,
+                                int size,
+                                const validation_state &validation);
+    void HandleRequest(const byte *message,
+                       bool is_broadcast,
+                       unsigned int checksum);
+#ifdef VIRTUAL_RESPONDERS
+    void HandleBroadcast(const byte *message, unsigned int checksum);
+#endif
+    void HandleDiscovery(bool was_broadcast, const byte *message);
+    bool InDiscoveryRange(const byte *message) const;
+    void HandleBatchRequests(const byte *message, unsigned int size);
+    bool SendCachedResponse(const byte *received_message, byte index);
+    void BuildCachedResponse(byte index,
+                             unsigned int pid,
+                             const byte *data,
+                             byte data_size);
+    bool ReplaySet(const byte *message, unsigned int checksum);
+    void RecordSet(const byte *message, unsigned int checksum);
+
 
-    bool VerifyChecksum(const byte *message, int size);
     int ReadTemperatureSensor();
     void SendSensorResponse(const byte *received_message);
     void HandleStringRequest(const byte *received_message,
@@ -102,6 +237,10 @@ class RDMHandler {
     void HandleGetSensorValue(const byte *received_message);
     void HandleGetDevicePowerCycles(const byte *received_message);
     void HandleGetIdentifyDevice(const byte *received_message);
+    void HandleGetPresetPlayback(const byte *received_message);
+    void HandleGetCalibration(const byte *received_message);
+    void HandleGetOutputSync(const byte *received_message);
+    void HandleGetPwmCarrier(const byte *received_message);
 
     // SET Handlers
     void HandleSetLanguage(bool was_broadcast, int sub_device,
@@ -123,25 +262,35 @@ class RDMHandler {
                                  const byte *received_message);
     void HandleSetSerial(bool was_broadcast, int sub_device,
                          const byte *received_message);
+    void HandleCapturePreset(bool was_broadcast, int sub_device,
+                             const byte *received_message);
+    void HandleSetPresetPlayback(bool was_broadcast, int sub_device,
+                                 const byte *received_message);
+    void HandleSetCalibration(bool was_broadcast, int sub_device,
+                              const byte *received_message);
+    void HandleSetOutputSync(bool was_broadcast, int sub_device,
+                             const byte *received_message);
+    void HandleSetPwmCarrier(bool was_broadcast, int sub_device,
+                             const byte *received_message);
 
 
-    // Pin constants
-    static const byte IDENTIFY_LED_PIN = 12;
-    static const byte TEMP_SENSOR_PIN = 0;
-
     // Various constants used in RDM messages
     static const unsigned long SOFTWARE_VERSION = 1;
     static const int MAX_DMX_ADDRESS = 512;
     enum { MAX_LABEL_SIZE = 32 };
     static const char SUPPORTED_LANGUAGE[];
     static const char SOFTWARE_VERSION_STRING[];
+    static const byte PRODUCT_DETAIL_IDS[];
     static const char SET_SERIAL_PID_DESCRIPTION[];
+    static const char CALIBRATION_PID_DESCRIPTION[];
+    static const char OUTPUT_SYNC_PID_DESCRIPTION[];
+    static const char PWM_CARRIER_PID_DESCRIPTION[];
+    // the size of a GET PID_MANUFACTURER_PWM_CARRIER response
+    enum { PWM_CARRIER_INFO_SIZE = 12 };
     static const char TEMPERATURE_SENSOR_DESCRIPTION[];
 
-    // our personalities
-    static const rdm_personality rdm_personalities[];
-
     static const RDMHandler::pid_definition PID_DEFINITIONS[];
+    static const RDMHandler::parameter_description PARAMETER_DESCRIPTIONS[];
 };
 
 #endif  // RDM_HANDLERS_H
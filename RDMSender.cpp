@@ -19,19 +19,50 @@
 
 #include "RDMSender.h"
 #include "MessageLabels.h"
+#include "Responders.h"
 #include "WidgetSettings.h"
 
 
-void RDMSender::ReturnRDMErrorResponse(byte error_code) const {
-  m_sender->SendMessageHeader(RDM_LABEL, 1);
-  m_sender->Write(error_code);
+void RDMSender::SetMode(response_mode mode,
+                        byte *buffer,
+                        unsigned int buffer_size) {
+  m_mode = mode;
+  m_buffer = buffer;
+  m_buffer_size = buffer_size;
+  m_response_size = 0;
+}
+
+
+void RDMSender::StartBatch(unsigned int size) const {
+  m_sender->SendMessageHeader(RDM_BATCH_LABEL, size);
+}
+
+
+void RDMSender::EndBatch() const {
   m_sender->SendMessageFooter();
 }
 
 
+/**
+ * Return a status code to the host. There is no equivalent on the line, the
+ * controller just doesn't get a response.
+ */
+void RDMSender::ReturnRDMErrorResponse(byte error_code) const {
+  if (m_recording)
+    m_recording->data_size = NOT_RECORDED;
+  if (m_mode == LINE_RESPONSE)
+    return;
+  StartResponse(0);
+  Write(error_code);
+  EndResponse();
+}
+
+
 void RDMSender::SendByteAndChecksum(byte b) const {
+  if (m_recording && m_recorded_size < RECORDED_DATA_SIZE)
+    m_recording->data[m_recorded_size++] = b;
   m_current_checksum += b;
-  m_sender->Write(b);
+  Write(b);
 }
 
 void RDMSender::SendIntAndChecksum(int i) const {
@@ -50,16 +81,13 @@ void RDMSender::SendLongAndChecksum(long l) const {
 void RDMSender::StartRDMResponse(const byte *received_message,
                                  rdm_response_type response_type,
                                  unsigned int param_data_size) const {
-  int pid = received_message[21];
-  pid = (pid << 8) + received_message[22];
-
   StartCustomResponse(
       received_message,
       response_type,
       param_data_size,
-      received_message[20] == GET_COMMAND ?
+      received_message[RDM_COMMAND_CLASS_OFFSET] == GET_COMMAND ?
         GET_COMMAND_RESPONSE : SET_COMMAND_RESPONSE,
-      pid);
+      RDMReadShort(received_message + RDM_PID_OFFSET));
 }
 
 
@@ -68,43 +96,36 @@ void RDMSender::StartCustomResponse(const byte *received_message,
                                     unsigned int param_data_size,
                                     byte command_class,
                                     int pid) const {
-  // set the global checksum to 0
-  m_current_checksum = 0;
-  // size is the rdm status code, the rdm header + the param_data_size
-  m_sender->SendMessageHeader(RDM_LABEL,
-                              1 + MINIMUM_RDM_PACKET_SIZE + param_data_size);
-  SendByteAndChecksum(RDM_STATUS_OK);
-  SendByteAndChecksum(START_CODE);
-  SendByteAndChecksum(SUB_START_CODE);
-  SendByteAndChecksum(MINIMUM_RDM_PACKET_SIZE - 2 + param_data_size);
-
-  // copy the src uid into the dst uid field
-  SendByteAndChecksum(received_message[9]);
-  SendByteAndChecksum(received_message[10]);
-  SendByteAndChecksum(received_message[11]);
-  SendByteAndChecksum(received_message[12]);
-  SendByteAndChecksum(received_message[13]);
-  SendByteAndChecksum(received_message[14]);
-
-  // add our UID as the src, the ESTA_ID & fields are reversed
-  SendIntAndChecksum(WidgetSettings.EstaId());
-  SendLongAndChecksum(WidgetSettings.SerialNumber());
-
-  SendByteAndChecksum(received_message[15]);  // transaction #
-  SendByteAndChecksum(response_type);  // response type
-  SendByteAndChecksum(m_message_count);  // message count
-
-  // sub device
-  SendByteAndChecksum(received_message[18]);
-  SendByteAndChecksum(received_message[19]);
-
-  // command class
-  SendByteAndChecksum(command_class);
-
-  // param id, we don't use queued messages so this always matches the request
-  SendByteAndChecksum(pid >> 8);
-  SendByteAndChecksum(pid);
-  SendByteAndChecksum(param_data_size);
+  if (m_recording) {
+    m_recording->response_type = response_type;
+    m_recording->data_size = (param_data_size <= RECORDED_DATA_SIZE ?
+                              param_data_size : NOT_RECORDED);
+    m_recorded_size = 0;
+  }
+
+  StartResponse(MINIMUM_RDM_PACKET_SIZE + param_data_size);
+  if (m_mode != LINE_RESPONSE)
+    Write(RDM_STATUS_OK);
+
+  rdm_header header;
+  // the src uid of the request becomes the dst uid, we're the src
+  for (byte i = 0; i < RDM_UID_SIZE; ++i) {
+    header.dest_uid[i] = received_message[RDM_SRC_UID_OFFSET + i];
+    header.src_uid[i] = Responders.UIDByte(i);
+  }
+  header.transaction_number = received_message[RDM_TN_OFFSET];
+  header.port_id = response_type;
+  header.message_count = m_message_count;
+  header.sub_device = RDMReadShort(received_message + RDM_SUB_DEVICE_OFFSET);
+  header.command_class = command_class;
+  // we don't use queued messages so the pid always matches the request
+  header.param_id = pid;
+  header.param_data_size = param_data_size;
+
+  byte encoded_header[RDM_HEADER_SIZE];
+  RDMEncodeHeader(encoded_header, header);
+  m_current_checksum = RDMChecksum(encoded_header, sizeof(encoded_header));
+  Write(encoded_header, sizeof(encoded_header));
 }
 
 
@@ -121,9 +142,9 @@ void RDMSender::StartRDMAckResponse(const byte *received_message,
  * Send the footer for an RDM response
  */
 void RDMSender::EndRDMResponse() const {
-  m_sender->Write(m_current_checksum >> 8);
-  m_sender->Write(m_current_checksum);
-  m_sender->SendMessageFooter();
+  Write(m_current_checksum >> 8);
+  Write(m_current_checksum);
+  EndResponse();
 }
 
 
@@ -173,6 +194,145 @@ void RDMSender::NackOrBroadcast(bool was_broadcast,
 }
 
 
+/**
+ * Send the response to a DISC_UNIQUE_BRANCH. Each byte of the UID & checksum
+ * is sent twice, once OR'ed with 0xaa and once with 0x55.
+ */
+void RDMSender::SendDiscoveryResponse(bool collision) const {
+  StartResponse(DISCOVERY_RESPONSE_SIZE);
+  if (m_mode != LINE_RESPONSE)
+    Write(RDM_STATUS_OK);
+
+  for (byte i = 0; i < 7; ++i)
+    Write(0xfe);
+  Write(0xaa);
+
+  unsigned int checksum = 0;
+  for (byte i = 0; i < 6; ++i) {
+    byte b = Responders.UIDByte(i);
+    checksum += (b | 0xaa) + (b | 0x55);
+    Write(b | 0xaa);
+    Write(b | 0x55);
+  }
+  // the controller treats a bad checksum as a collision & branches
+  if (collision)
+    checksum = ~checksum;
+  Write((checksum >> 8) | 0xaa);
+  Write((checksum >> 8) | 0x55);
+  Write(checksum | 0xaa);
+  Write(checksum | 0x55);
+  EndResponse();
+}
+
+
+/**
+ * Build a cached ACK response to a GET.
+ * @param response the response to build
+ * @param pid the PID of the response
+ * @param data the param data, this isn't copied
+ * @param data_size the size of the param data
+ */
+void RDMSender::BuildCachedResponse(cached_response *response,
+                                    unsigned int pid,
+                                    const byte *data,
+                                    byte data_size) {
+  unsigned int checksum = START_CODE + SUB_START_CODE +
+                          MINIMUM_RDM_PACKET_SIZE - 2 + data_size;
+  for (byte i = 0; i < sizeof(m_cached_uid); ++i) {
+    m_cached_uid[i] = WidgetSettings.UIDByte(i);
+    checksum += m_cached_uid[i];
+  }
+  checksum += RDM_RESPONSE_ACK + GET_COMMAND_RESPONSE;
+  checksum += (pid >> 8) + (pid & 0xff) + data_size;
+  for (byte i = 0; i < data_size; ++i)
+    checksum += data[i];
+
+  response->data = data;
+  response->data_size = data_size;
+  response->pid = pid;
+  response->checksum = checksum;
+}
+
+
+/**
+ * Send a cached response, this only patches the fields that come from the
+ * request.
+ */
+void RDMSender::SendCachedResponse(const byte *received_message,
+                                   const cached_response &response) const {
+  StartResponse(MINIMUM_RDM_PACKET_SIZE + response.data_size);
+  if (m_mode != LINE_RESPONSE)
+    Write(RDM_STATUS_OK);
+  Write(START_CODE);
+  Write(SUB_START_CODE);
+  Write(MINIMUM_RDM_PACKET_SIZE - 2 + response.data_size);
+
+  // the src uid of the request becomes the dst uid
+  unsigned int checksum = response.checksum;
+  checksum = RDMChecksum(received_message + RDM_SRC_UID_OFFSET,
+                         RDM_UID_SIZE,
+                         checksum);
+  Write(received_message + RDM_SRC_UID_OFFSET, RDM_UID_SIZE);
+#ifdef VIRTUAL_RESPONDERS
+  // the response was built with the widget's UID
+  for (byte i = 0; i < sizeof(m_cached_uid); ++i) {
+    byte b = Responders.UIDByte(i);
+    checksum += b - m_cached_uid[i];
+    Write(b);
+  }
+#else
+  Write(m_cached_uid, sizeof(m_cached_uid));
+#endif
+
+  checksum += received_message[RDM_TN_OFFSET] + m_message_count;
+  Write(received_message[RDM_TN_OFFSET]);  // transaction #
+  Write(RDM_RESPONSE_ACK);
+  Write(m_message_count);
+  // GETs are only handled for the root device
+  Write(0);
+  Write(0);
+  Write(GET_COMMAND_RESPONSE);
+  Write(response.pid >> 8);
+  Write(response.pid);
+  Write(response.data_size);
+  Write(response.data, response.data_size);
+
+  Write(checksum >> 8);
+  Write(checksum);
+  EndResponse();
+}
+
+
+/**
+ * Start recording a response, the recording is invalid until a response is
+ * sent.
+ */
+void RDMSender::StartRecording(recorded_response *response) const {
+  response->data_size = NOT_RECORDED;
+  m_recording = response;
+  m_recorded_size = 0;
+}
+
+
+void RDMSender::StopRecording() const {
+  m_recording = NULL;
+}
+
+
+/**
+ * Send a recorded response again, with the header from this request.
+ */
+void RDMSender::SendRecordedResponse(const byte *received_message,
+                                     const recorded_response &response) const {
+  StartRDMResponse(received_message,
+                   static_cast<rdm_response_type>(response.response_type),
+                   response.data_size);
+  for (byte i = 0; i < response.data_size; ++i)
+    SendByteAndChecksum(response.data[i]);
+  EndRDMResponse();
+}
+
+
 /**
  * Increment the queued message count
  */
@@ -189,3 +349,64 @@ void RDMSender::DecrementMessageCount() {
   if (m_message_count)
     m_message_count--;
 }
+
+
+/**
+ * Start a response of size bytes, not including the status code.
+ */
+void RDMSender::StartResponse(unsigned int size) const {
+  if (m_mode == HOST_RESPONSE)
+    m_sender->SendMessageHeader(RDM_LABEL, 1 + size);
+  else if (m_mode == LINE_RESPONSE)
+    m_response_size = 0;
+}
+
+
+void RDMSender::EndResponse() const {
+  if (m_mode == HOST_RESPONSE)
+    m_sender->SendMessageFooter();
+}
+
+
+/**
+ * Write a byte of a response. Responses that don't fit in the line buffer are
+ * truncated.
+ */
+void RDMSender::Write(byte b) const {
+  switch (m_mode) {
+    case HOST_RESPONSE:
+    case BATCH_RESPONSE:
+      m_sender->Write(b);
+      m_response_size++;
+      break;
+    case BATCH_COUNT:
+      m_response_size++;
+      break;
+    case DISCARD_RESPONSE:
+      break;
+    case LINE_RESPONSE:
+      if (m_response_size < m_buffer_size)
+        m_buffer[m_response_size++] = b;
+      break;
+  }
+}
+
+
+void RDMSender::Write(const byte *data, unsigned int size) const {
+  switch (m_mode) {
+    case HOST_RESPONSE:
+    case BATCH_RESPONSE:
+      m_sender->Write(data, size);
+      m_response_size += size;
+      break;
+    case BATCH_COUNT:
+      m_response_size += size;
+      break;
+    case DISCARD_RESPONSE:
+      break;
+    case LINE_RESPONSE:
+      for (unsigned int i = 0; i < size; ++i)
+        Write(data[i]);
+      break;
+  }
+}
@@ -29,10 +29,63 @@
  */
 class RDMSender {
   public:
+    // Where responses go
+    typedef enum {
+      // a USB Pro message to the host, with a status code
+      HOST_RESPONSE,
+      // the status code & message to the host, as part of a batch reply
+      BATCH_RESPONSE,
+      // as BATCH_RESPONSE, but only count the bytes
+      BATCH_COUNT,
+      // the message as it appears on the line, written to a buffer
+      LINE_RESPONSE,
+      // nothing is sent, see RDMHandler::HandleBroadcast()
+      DISCARD_RESPONSE,
+    } response_mode;
+
+    // A prebuilt ACK to a GET. Only the destination UID, transaction number
+    // and message count change between requests, the checksum holds the sum
+    // of everything else.
+    typedef struct {
+      const byte *data;  // NULL if the response needs to be built
+      byte data_size;
+      unsigned int pid;
+      unsigned int checksum;
+    } cached_response;
+
+    // The type & param data of a short response, so it can be sent again
+    // without running the handler.
+    enum { RECORDED_DATA_SIZE = 4 };
+    enum { NOT_RECORDED = 0xff };
+    typedef struct {
+      byte response_type;
+      byte data_size;  // NOT_RECORDED if there isn't a complete response
+      byte data[RECORDED_DATA_SIZE];
+    } recorded_response;
+
     explicit RDMSender(const UsbProSender *sender)
       : m_sender(sender),
+        m_mode(HOST_RESPONSE),
+        m_buffer(NULL),
+        m_buffer_size(0),
+        m_response_size(0),
         m_message_count(0),
-        m_current_checksum(0) {}
+        m_current_checksum(0),
+        m_recording(NULL),
+        m_recorded_size(0) {}
+
+    // Change the response mode, the buffer is only used for LINE_RESPONSE.
+    void SetMode(response_mode mode,
+                 byte *buffer = NULL,
+                 unsigned int buffer_size = 0);
+    response_mode Mode() const { return m_mode; }
+    // The number of bytes written since the mode was set, for LINE_RESPONSE
+    // this is the size of the last response.
+    unsigned int ResponseSize() const { return m_response_size; }
+
+    // Frame a batch reply, size is the total from a BATCH_COUNT pass
+    void StartBatch(unsigned int size) const;
+    void EndBatch() const;
 
     void ReturnRDMErrorResponse(byte error_code) const;
 
@@ -66,12 +119,48 @@ class RDMSender {
                          const byte *received_message,
                          rdm_nack_reason nack_reason) const;
 
+    // the encoded UID sent in reply to a DISC_UNIQUE_BRANCH, with a bad
+    // checksum if several responders reply at once.
+    void SendDiscoveryResponse(bool collision = false) const;
+
+    // data must remain valid until the response is invalidated
+    void BuildCachedResponse(cached_response *response,
+                             unsigned int pid,
+                             const byte *data,
+                             byte data_size);
+    void SendCachedResponse(const byte *received_message,
+                            const cached_response &response) const;
+
+    // Record the next RDM response until StopRecording() is called.
+    // Responses with more than RECORDED_DATA_SIZE bytes of param data, and
+    // status codes, leave the recording as NOT_RECORDED.
+    void StartRecording(recorded_response *response) const;
+    void StopRecording() const;
+    void SendRecordedResponse(const byte *received_message,
+                              const recorded_response &response) const;
+
     void IncrementMessageCount();
     void DecrementMessageCount();
 
   private:
     const UsbProSender *m_sender;
+    response_mode m_mode;
+    byte *m_buffer;
+    unsigned int m_buffer_size;
+    mutable unsigned int m_response_size;
     byte m_message_count;
     mutable unsigned int m_current_checksum;
+    // our UID, as used by the cached responses
+    byte m_cached_uid[RDM_UID_SIZE];
+    mutable recorded_response *m_recording;
+    mutable byte m_recorded_size;
+
+    void Write(byte b) const;
+    void Write(const byte *data, unsigned int size) const;
+    void StartResponse(unsigned int size) const;
+    void EndResponse() const;
+
+    // 7 preamble bytes, the separator, the UID & checksum
+    enum { DISCOVERY_RESPONSE_SIZE = 24 };
 };
 #endif  // RDM_SENDER_H
@@ -0,0 +1,139 @@
+/*
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Library General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ *
+ * Responders.cpp
+ * Copyright (C) 2011 Simon Newton
+ */
+
+#include "Board.h"
+#include "Responders.h"
+
+
+/**
+ * The virtual responders start with the widget's personality, patched one
+ * after another from the widget's start address so their footprints don't
+ * overlap.
+ */
+void RespondersClass::Init() {
+#ifdef VIRTUAL_RESPONDERS
+  byte personality = WidgetSettings.Personality();
+  unsigned int footprint = PersonalityFootprint(
+      &rdm_personalities[personality - 1]);
+  unsigned int start_address = WidgetSettings.StartAddress();
+  for (byte i = 0; i < COUNT - 1; ++i) {
+    start_address += footprint;
+    if (start_address + footprint > 513)
+      start_address = 1;
+    m_virtual[i].start_address = start_address;
+    m_virtual[i].personality = personality;
+    m_virtual[i].label_size = 0;
+  }
+#endif
+}
+
+
+#ifdef VIRTUAL_RESPONDERS
+/**
+ * Select the responder for the current request. The UID is worked out here
+ * since each response uses it several times.
+ */
+void RespondersClass::Select(byte responder) {
+  m_current = responder;
+  if (!responder)
+    return;
+
+  unsigned long serial_number = WidgetSettings.SerialNumber() + responder;
+  m_uid[0] = WidgetSettings.UIDByte(0);
+  m_uid[1] = WidgetSettings.UIDByte(1);
+  for (byte i = 2; i < RDM_UID_SIZE; ++i)
+    m_uid[i] = serial_number >> (8 * (RDM_UID_SIZE - 1 - i));
+}
+#endif
+
+
+void RespondersClass::SetStartAddress(unsigned int start_address) {
+#ifdef VIRTUAL_RESPONDERS
+  if (m_current) {
+    m_virtual[m_current - 1].start_address = start_address;
+    return;
+  }
+#endif
+  WidgetSettings.SetStartAddress(start_address);
+}
+
+
+void RespondersClass::SetPersonality(byte personality) {
+#ifdef VIRTUAL_RESPONDERS
+  if (m_current) {
+    m_virtual[m_current - 1].personality = personality;
+    return;
+  }
+#endif
+  WidgetSettings.SetPersonality(personality);
+}
+
+
+unsigned int RespondersClass::Footprint() const {
+#ifdef VIRTUAL_RESPONDERS
+  if (m_current)
+    return PersonalityFootprint(&rdm_personalities[Personality() - 1]);
+#endif
+  return OutputMap.Footprint();
+}
+
+
+byte RespondersClass::DeviceLabel(char *label, byte length) const {
+#ifdef VIRTUAL_RESPONDERS
+  if (m_current) {
+    const virtual_responder &responder = m_virtual[m_current - 1];
+    byte size = min(responder.label_size, length);
+    memcpy(label, responder.label, size);
+    return size;
+  }
+#endif
+  return WidgetSettings.DeviceLabel(label, length);
+}
+
+
+void RespondersClass::SetDeviceLabel(const char *label, byte length) {
+#ifdef VIRTUAL_RESPONDERS
+  virtual_responder *responder = &m_virtual[m_current - 1];
+  responder->label_size = min(length, VIRTUAL_LABEL_LENGTH);
+  memcpy(responder->label, label, responder->label_size);
+#endif
+}
+
+
+/**
+ * The identify LED is lit while any responder is identifying.
+ */
+void RespondersClass::SetIdentify(bool identify) {
+  SetBit(m_identify, identify);
+  bool lit = false;
+  for (byte i = 0; i < BITMAP_SIZE; ++i)
+    lit |= m_identify[i];
+  Board::IdentifyLedPin::Set(lit);
+}
+
+
+void RespondersClass::SetBit(byte *bitmap, bool value) {
+  byte mask = 1 << (Current() & 7);
+  if (value)
+    bitmap[Current() >> 3] |= mask;
+  else
+    bitmap[Current() >> 3] &= ~mask;
+}
+
+RespondersClass Responders;
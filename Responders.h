@@ -0,0 +1,152 @@
+/*
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Library General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ *
+ * Responders.h
+ * Copyright (C) 2011 Simon Newton
+ * The state of each RDM responder the widget answers as.
+ */
+
+#include "Arduino.h"
+#include "Personality.h"
+#include "RDMCodec.h"
+#include "WidgetSettings.h"
+
+#ifndef RESPONDERS_H
+#define RESPONDERS_H
+
+#ifdef VIRTUAL_RESPONDERS
+#if VIRTUAL_RESPONDERS < 2 || VIRTUAL_RESPONDERS > 254
+#error "VIRTUAL_RESPONDERS must be between 2 and 254"
+#endif
+#endif
+
+/**
+ * The widget is normally a single responder, the settings are in
+ * WidgetSettings. Building with VIRTUAL_RESPONDERS=N makes it answer as N
+ * responders, to test how controllers cope with large RDM populations.
+ * Responder 0 is the widget, the others share its ESTA ID and take the
+ * serial numbers that follow, so a UID maps to a responder with a
+ * subtraction. Each has its own start address, personality, label, identify
+ * & mute state, held in RAM. They don't drive the outputs and share the
+ * widget's other parameters.
+ *
+ * The RDM handler selects the responder a request is for, and the accessors
+ * below act on that responder.
+ */
+class RespondersClass {
+  public:
+#ifdef VIRTUAL_RESPONDERS
+    enum { COUNT = VIRTUAL_RESPONDERS };
+#else
+    enum { COUNT = 1 };
+#endif
+    // Labels are truncated to this, to keep the state small. 20 bytes per
+    // responder allows for dozens on a 2560.
+    enum { VIRTUAL_LABEL_LENGTH = 16 };
+
+    RespondersClass()
+#ifdef VIRTUAL_RESPONDERS
+        : m_current(0)
+#endif
+    {
+      memset(m_identify, 0, sizeof(m_identify));
+      memset(m_muted, 0, sizeof(m_muted));
+    }
+
+    // Set up the virtual responders, called once the settings are loaded.
+    void Init();
+
+    // Map the serial number of a destination UID to a responder.
+    // @return the responder, or COUNT if the UID isn't one of ours
+    byte Find(unsigned long serial_number) const {
+      unsigned long responder = serial_number - WidgetSettings.SerialNumber();
+      return responder < COUNT ? responder : COUNT;
+    }
+
+#ifdef VIRTUAL_RESPONDERS
+    void Select(byte responder);
+    byte Current() const { return m_current; }
+#else
+    void Select(byte responder) {}
+    byte Current() const { return 0; }
+#endif
+
+    // returns a byte of the selected responder's UID, in network order
+    byte UIDByte(byte index) const {
+#ifdef VIRTUAL_RESPONDERS
+      if (m_current)
+        return m_uid[index];
+#endif
+      return WidgetSettings.UIDByte(index);
+    }
+
+    unsigned int StartAddress() const {
+#ifdef VIRTUAL_RESPONDERS
+      if (m_current)
+        return m_virtual[m_current - 1].start_address;
+#endif
+      return WidgetSettings.StartAddress();
+    }
+    void SetStartAddress(unsigned int start_address);
+
+    byte Personality() const {
+#ifdef VIRTUAL_RESPONDERS
+      if (m_current)
+        return m_virtual[m_current - 1].personality;
+#endif
+      return WidgetSettings.Personality();
+    }
+    void SetPersonality(byte personality);
+    unsigned int Footprint() const;
+
+    byte DeviceLabel(char *label, byte length) const;
+    // Only for the virtual responders, the widget's label is written by
+    // WidgetSettings.
+    void SetDeviceLabel(const char *label, byte length);
+
+    bool Identify() const { return GetBit(m_identify); }
+    void SetIdentify(bool identify);
+
+    // muted responders don't reply to DISC_UNIQUE_BRANCH
+    bool Muted() const { return GetBit(m_muted); }
+    void SetMuted(bool muted) { SetBit(m_muted, muted); }
+
+  private:
+    enum { BITMAP_SIZE = (COUNT + 7) / 8 };
+
+    byte m_identify[BITMAP_SIZE];
+    byte m_muted[BITMAP_SIZE];
+
+#ifdef VIRTUAL_RESPONDERS
+    typedef struct {
+      unsigned int start_address;
+      byte personality;
+      byte label_size;
+      char label[VIRTUAL_LABEL_LENGTH];
+    } virtual_responder;
+
+    byte m_current;
+    byte m_uid[RDM_UID_SIZE];
+    virtual_responder m_virtual[COUNT - 1];
+#endif
+
+    bool GetBit(const byte *bitmap) const {
+      return bitmap[Current() >> 3] & (1 << (Current() & 7));
+    }
+    void SetBit(byte *bitmap, bool value);
+};
+
+extern RespondersClass Responders;
+#endif  // RESPONDERS_H
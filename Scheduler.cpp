@@ -0,0 +1,38 @@
+/*
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Library General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ * Scheduler.cpp
+ * Copyright (C) 2011 Simon Newton
+ */
+
+#include <avr/eeprom.h>
+#include "Scheduler.h"
+
+
+void SchedulerClass::WaitForEeprom() {
+  while (!eeprom_is_ready()) {
+    Yield();
+    if (m_eeprom_task)
+      m_eeprom_task();
+  }
+}
+
+
+void SchedulerClass::RunTask() {
+  m_running = true;
+  m_task();
+  m_running = false;
+}
+
+SchedulerClass Scheduler;
@@ -0,0 +1,75 @@
+/*
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Library General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ * Scheduler.h
+ * Copyright (C) 2011 Simon Newton
+ * Lets DMX frames run ahead of slow RDM & settings work.
+ */
+
+#include "Arduino.h"
+
+#ifndef SCHEDULER_H
+#define SCHEDULER_H
+
+/**
+ * There are no threads, each piece of work in the main loop runs to
+ * completion. A DMX frame that arrives while an RDM response is being
+ * written to the host, or while the EEPROM is being written, would wait for
+ * that to finish, and a sweep of RDM requests makes the outputs jitter.
+ *
+ * Instead the slow work is split into steps with a bounded cost and calls
+ * Yield() between them. Yield() runs the high priority task, which applies
+ * any DMX frames that are waiting, and the slow work then resumes where it
+ * left off. The priorities are:
+ *  - DMX frames from the host or the DMX input, run by Yield()
+ *  - the other host messages & output rendering, run by the main loop
+ *  - RDM responses and EEPROM writes, which yield
+ *
+ * A step is one byte written to the host, which waits at most one byte time
+ * (87us at 115200) for space in the TX ring, one request in a batch, one
+ * virtual responder, or one EEPROM byte. EEPROM writes take 3.3ms, so the
+ * wait for the previous write yields too. That wait also runs the EEPROM
+ * task, which answers RDM from the DMX line, since the controller only waits
+ * 2ms for a response.
+ */
+class SchedulerClass {
+  public:
+    SchedulerClass(): m_task(NULL), m_eeprom_task(NULL), m_running(false) {}
+
+    // Set the high priority task, it mustn't write to the host or the EEPROM
+    void SetTask(void (*task)()) { m_task = task; }
+    // Set the task run while waiting for the EEPROM, it mustn't write to the
+    // EEPROM
+    void SetEepromTask(void (*task)()) { m_eeprom_task = task; }
+
+    // Called by low priority work between steps
+    void Yield() {
+      if (m_task && !m_running)
+        RunTask();
+    }
+
+    // Wait until the EEPROM can be written, yielding meanwhile
+    void WaitForEeprom();
+
+  private:
+    void (*m_task)();
+    void (*m_eeprom_task)();
+    // stops the task running inside itself
+    bool m_running;
+
+    void RunTask();
+};
+
+extern SchedulerClass Scheduler;
+#endif  // SCHEDULER_H
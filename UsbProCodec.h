@@ -0,0 +1,162 @@
+/*
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Library General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ * UsbProCodec.h
+ * Copyright (C) 2011 Simon Newton
+ * The Usb Pro message framing. This is shared by the firmware and the host
+ * tools, so it's header only, doesn't allocate and doesn't depend on the
+ * Arduino core.
+ */
+
+#include <stdint.h>
+
+#ifndef USBPRO_CODEC_H
+#define USBPRO_CODEC_H
+
+// A message is SOM, label, the data length (LSB first), the data and EOM.
+enum {
+  USBPRO_SOM = 0x7E,
+  USBPRO_EOM = 0xE7,
+  USBPRO_HEADER_SIZE = 4,
+  USBPRO_FOOTER_SIZE = 1,
+};
+
+
+/**
+ * Write the header of a message.
+ * @param header the output, this must hold USBPRO_HEADER_SIZE bytes
+ * @param label the message label
+ * @param size the size of the data that follows the header
+ * @return the number of bytes written
+ */
+inline uint8_t UsbProEncodeHeader(uint8_t *header,
+                                  uint8_t label,
+                                  uint16_t size) {
+  header[0] = USBPRO_SOM;
+  header[1] = label;
+  header[2] = size;
+  header[3] = size >> 8;
+  return USBPRO_HEADER_SIZE;
+}
+
+
+/**
+ * Frame a complete message.
+ * @param output the output, this must hold size + 5 bytes
+ * @param label the message label
+ * @param data the message data
+ * @param size the size of the data
+ * @return the number of bytes written
+ */
+inline uint16_t UsbProEncodeMessage(uint8_t *output,
+                                    uint8_t label,
+                                    const uint8_t *data,
+                                    uint16_t size) {
+  uint8_t *ptr = output + UsbProEncodeHeader(output, label, size);
+  for (uint16_t i = 0; i < size; ++i)
+    *ptr++ = data[i];
+  *ptr++ = USBPRO_EOM;
+  return ptr - output;
+}
+
+
+/**
+ * Splits a byte stream into messages. The parser doesn't store the data,
+ * each byte returns an event and the caller decides where the data goes. This
+ * allows the firmware to pick a buffer once the label & size are known.
+ */
+class UsbProParser {
+  public:
+    typedef enum {
+      NONE,  // the byte was part of the framing
+      HEADER,  // the label & size of a new message are known
+      DATA,  // the byte is the data at Offset()
+      END,  // the message is complete
+      ABORT,  // the message didn't end with an EOM, discard it
+    } event;
+
+    UsbProParser()
+        : m_state(PRE_SOM),
+          m_label(0),
+          m_size(0),
+          m_received(0) {
+    }
+
+    /**
+     * Run one byte through the state machine.
+     */
+    event Parse(uint8_t data) {
+      switch (m_state) {
+        case PRE_SOM:
+          if (data == USBPRO_SOM)
+            m_state = GOT_SOM;
+          return NONE;
+        case GOT_SOM:
+          m_label = data;
+          m_state = GOT_LABEL;
+          return NONE;
+        case GOT_LABEL:
+          m_size = data;
+          m_state = GOT_DATA_LSB;
+          return NONE;
+        case GOT_DATA_LSB:
+          m_size += static_cast<uint16_t>(data) << 8;
+          m_received = 0;
+          m_state = m_size ? IN_DATA : WAITING_FOR_EOM;
+          return HEADER;
+        case IN_DATA:
+          m_received++;
+          if (m_received == m_size)
+            m_state = WAITING_FOR_EOM;
+          return DATA;
+        case WAITING_FOR_EOM:
+          m_state = PRE_SOM;
+          return data == USBPRO_EOM ? END : ABORT;
+      }
+      return NONE;
+    }
+
+    /**
+     * Drop any partial message, for example after a receive overrun.
+     * @return true if the HEADER event for the message was already returned,
+     *   the caller should treat this like ABORT.
+     */
+    bool Reset() {
+      bool in_message = m_state == IN_DATA || m_state == WAITING_FOR_EOM;
+      m_state = PRE_SOM;
+      return in_message;
+    }
+
+    // valid from the HEADER event until the next message starts
+    uint8_t Label() const { return m_label; }
+    uint16_t Size() const { return m_size; }
+    // the offset of the byte that returned the last DATA event
+    uint16_t Offset() const { return m_received - 1; }
+
+  private:
+    typedef enum {
+      PRE_SOM,
+      GOT_SOM,
+      GOT_LABEL,
+      GOT_DATA_LSB,
+      IN_DATA,
+      WAITING_FOR_EOM,
+    } receiving_state;
+
+    receiving_state m_state;
+    uint8_t m_label;
+    uint16_t m_size;
+    uint16_t m_received;
+};
+#endif  // USBPRO_CODEC_H
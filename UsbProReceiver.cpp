@@ -17,27 +17,326 @@
  * Copyright (C) 2010 Simon Newton
  */
 
+#include <util/atomic.h>
+#include "MessageLabels.h"
+#include "Profiler.h"
 #include "UsbProReceiver.h"
 
+#ifdef HOST_USART_RX_vect
+/**
+ * Return the next message, this remains valid until Pop() is called.
+ * @return false if there are no messages.
+ */
+bool UsbProFrameQueueClass::Front(frame *next) {
+  SkipHandled();
+  byte tail = m_tail;
+  if (tail == m_head)
+    return false;
+  RecordLatency(tail);
+  next->label = m_queue[tail].label;
+  next->size = m_queue[tail].size;
+  next->data = Buffer(m_queue[tail].buffer);
+  return true;
+}
+
+
+/**
+ * Release the message returned by Front().
+ */
+void UsbProFrameQueueClass::Pop() {
+  byte tail = m_tail;
+  m_busy[m_queue[tail].buffer] = false;
+  m_tail = Next(tail);
+}
+
+
+/**
+ * Check if the message returned by Front() is a DMX frame that a newer one
+ * replaces.
+ * @return true if the message should be popped without being handled.
+ */
+bool UsbProFrameQueueClass::Superseded() {
+  return Superseded(m_tail);
+}
+
+
+/**
+ * Handle the DMX frames waiting behind other messages, this is called from
+ * Scheduler.Yield() while the main loop is busy with the message at the
+ * front. Frames aren't taken from beyond a sync message, they have to wait
+ * for the sync to latch the frame before them.
+ * @param handler called for each frame, as the message callback would be
+ */
+void UsbProFrameQueueClass::HandleDmxFrames(frame_handler handler) {
+  if (!m_dmx_waiting)
+    return;
+  m_dmx_waiting = false;
+
+  byte head = m_head;
+  for (byte i = m_tail; i != head; i = Next(i)) {
+    byte label = m_queue[i].label;
+    if (label == SYNC_LABEL) {
+      // the frames behind the sync still need handling once it's popped
+      for (i = Next(i); i != head; i = Next(i)) {
+        if (m_queue[i].buffer != NO_BUFFER && IsDmxLabel(m_queue[i].label))
+          m_dmx_waiting = true;
+      }
+      break;
+    }
+    byte buffer = m_queue[i].buffer;
+    if (buffer == NO_BUFFER || !IsDmxLabel(label))
+      continue;
+
+    RecordLatency(i);
+    if (!Superseded(i))
+      handler(label, Buffer(buffer), m_queue[i].size);
+    m_queue[i].buffer = NO_BUFFER;
+    m_busy[buffer] = false;
+  }
+  // this frees the entries if nothing is being handled
+  SkipHandled();
+}
+
+
+unsigned int UsbProFrameQueueClass::DroppedFrames() const {
+  unsigned int dropped_frames;
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    dropped_frames = m_dropped_frames;
+  }
+  return dropped_frames;
+}
+
+
+/**
+ * Move the tail past the frames that were handled out of turn.
+ */
+void UsbProFrameQueueClass::SkipHandled() {
+  byte tail = m_tail;
+  while (tail != m_head && m_queue[tail].buffer == NO_BUFFER)
+    tail = Next(tail);
+  m_tail = tail;
+}
+
+
+/**
+ * Check if a queued message is a DMX frame that a newer one replaces. Both
+ * need a null start code, alternate start code frames are always passed on
+ * to the DMX ports. A sync message between the two latches the older frame,
+ * so frames aren't skipped across one.
+ * @param index the position in the queue
+ */
+bool UsbProFrameQueueClass::Superseded(byte index) {
+  byte label = m_queue[index].label;
+  if (!IsDmxLabel(label) || !IsNullStartFrame(index))
+    return false;
+
+  byte head = m_head;
+  for (byte i = Next(index); i != head; i = Next(i)) {
+    if (m_queue[i].label == SYNC_LABEL)
+      return false;
+    if (m_queue[i].label == label && m_queue[i].buffer != NO_BUFFER &&
+        IsNullStartFrame(i)) {
+      m_coalesced_frames++;
+      return true;
+    }
+  }
+  return false;
+}
+
+
+/**
+ * Record how long a DMX frame waited for the main loop, in profile builds.
+ */
+void UsbProFrameQueueClass::RecordLatency(byte index) {
+#ifdef PROFILE
+  if (IsDmxLabel(m_queue[index].label))
+    Profiler.Record(Profiler.Counter(PROFILE_DMX_LATENCY),
+                    m_queue[index].received);
+#endif
+}
+
+
+/**
+ * Run the framing state machine for one byte.
+ * @param status the UCSRnA value, read before the data
+ * @param data the byte from UDRn
+ */
+void UsbProFrameQueueClass::ReceiveByte(byte status, byte data) {
+  PROFILE_SCOPE(PROFILE_READ);
+  if (status & _BV(DOR0)) {
+    // a byte was lost, so the current message is corrupt
+    if (m_parser.Reset() && m_buffer != NO_BUFFER) {
+      m_dropped_frames++;
+      EndFrame(false);
+    }
+  }
+
+  switch (m_parser.Parse(data)) {
+    case UsbProParser::HEADER:
+      if (!AllocateBuffer())
+        m_dropped_frames++;
+      break;
+    case UsbProParser::DATA:
+      // the message is dropped if it doesn't fit, see EndFrame()
+      if (m_parser.Offset() < m_capacity)
+        Buffer(m_buffer)[m_parser.Offset()] = data;
+      break;
+    case UsbProParser::END:
+      EndFrame(true);
+      break;
+    case UsbProParser::ABORT:
+      EndFrame(false);
+      break;
+    case UsbProParser::NONE:
+      break;
+  }
+}
+
+
+/**
+ * Pick a free buffer for the current message.
+ * @return false if they are all in use.
+ */
+bool UsbProFrameQueueClass::AllocateBuffer() {
+  byte first = 0;
+  byte last = Board::HOST_LARGE_BUFFERS;
+  unsigned int capacity = LARGE_BUFFER_SIZE;
+  if (!IsLargeLabel(m_parser.Label())) {
+    first = Board::HOST_LARGE_BUFFERS;
+    last = BUFFER_COUNT;
+    capacity = SMALL_BUFFER_SIZE;
+  }
+
+  for (byte i = first; i < last; ++i) {
+    if (!m_busy[i]) {
+      m_busy[i] = true;
+      m_buffer = i;
+      m_capacity = capacity;
+      return true;
+    }
+  }
+  m_buffer = NO_BUFFER;
+  m_capacity = 0;
+  return false;
+}
+
+
+/**
+ * Queue the current message, or release its buffer if it was incomplete or
+ * too big for the buffer. The queue can only fill up with frames that were
+ * handled out of turn.
+ */
+void UsbProFrameQueueClass::EndFrame(bool complete) {
+  if (m_buffer == NO_BUFFER)
+    return;
+
+  byte head = m_head;
+  if (complete && m_parser.Size() <= m_capacity && Next(head) != m_tail) {
+    byte label = m_parser.Label();
+    m_queue[head].label = label;
+    m_queue[head].buffer = m_buffer;
+    m_queue[head].size = m_parser.Size();
+#ifdef PROFILE
+    m_queue[head].received = Profiler.Now();
+#endif
+    if (IsDmxLabel(label))
+      m_dmx_waiting = true;
+    // this publishes the message to the main loop
+    m_head = Next(head);
+  } else {
+    if (complete)
+      m_dropped_frames++;
+    m_busy[m_buffer] = false;
+  }
+  m_buffer = NO_BUFFER;
+  m_capacity = 0;
+}
+
+
+byte *UsbProFrameQueueClass::Buffer(byte index) {
+  if (index < Board::HOST_LARGE_BUFFERS)
+    return m_large_buffers[index];
+  return m_small_buffers[index - Board::HOST_LARGE_BUFFERS];
+}
+
+
+/**
+ * Check if a queued message starts with a null start code.
+ * @param index the position in the queue
+ */
+bool UsbProFrameQueueClass::IsNullStartFrame(byte index) {
+  return m_queue[index].size && Buffer(m_queue[index].buffer)[0] == 0;
+}
+
+
+/**
+ * DMX, RDM & configuration messages need the large buffers.
+ */
+bool UsbProFrameQueueClass::IsLargeLabel(byte label) {
+  switch (label) {
+    case DMX_DATA_LABEL:
+    case DMX_DATA_PORT2_LABEL:
+    case DMX_DATA_PORT3_LABEL:
+    case RDM_LABEL:
+    case RDM_BATCH_LABEL:
+    case CONFIG_LABEL:
+      return true;
+    default:
+      return false;
+  }
+}
+
+
+bool UsbProFrameQueueClass::IsDmxLabel(byte label) {
+  return (label == DMX_DATA_LABEL || label == DMX_DATA_PORT2_LABEL ||
+          label == DMX_DATA_PORT3_LABEL);
+}
+
+
+ISR(HOST_USART_RX_vect) {
+  byte status = UCSR0A;
+  UsbProFrameQueue.ReceiveByte(status, UDR0);
+}
+
+UsbProFrameQueueClass UsbProFrameQueue;
+#else
+// messages that didn't fit in the buffer in Read()
+static unsigned int oversized_messages = 0;
+#endif
+
 
 UsbProReceiver::UsbProReceiver(void (*callback)(byte label,
                                                 const byte *message,
                                                 unsigned int size),
-                              void (*idle_callback)()):
+                              void (*idle_callback)(),
+                              bool (*data_callback)(byte label,
+                                                    unsigned int offset,
+                                                    byte data)):
     m_callback(callback),
-    m_idle_callback(idle_callback) {
+    m_idle_callback(idle_callback),
+    m_data_callback(data_callback) {
   Serial.begin(115200);  // fast baud rate, 9600 is too slow
 }
 
 
 /*
- * Read bytes from host
+ * Read messages from the host, this never returns.
  */
 void UsbProReceiver::Read() {
-  receiving_state recv_mode = PRE_SOM;
-  byte label = 0;
-  unsigned short expected_size = 0;
-  unsigned short data_offset = 0;
+#ifdef HOST_USART_RX_vect
+  UsbProFrameQueueClass::frame frame;
+  while (true) {
+    if (UsbProFrameQueue.Front(&frame)) {
+      if (!UsbProFrameQueue.Superseded())
+        m_callback(frame.label, frame.data, frame.size);
+      UsbProFrameQueue.Pop();
+    } else {
+      m_idle_callback();
+    }
+  }
+#else
+  UsbProParser parser;
+  bool buffering = true;
   byte message[600];
 
   while (true) {
@@ -45,43 +344,58 @@ void UsbProReceiver::Read() {
       m_idle_callback();
     }
 
-    byte data = Serial.read();
-    switch (recv_mode) {
-      case PRE_SOM:
-        if (data == 0x7E) {
-          recv_mode = GOT_SOM;
-        }
-        break;
-      case GOT_SOM:
-        label = data;
-        recv_mode = GOT_LABEL;
-        break;
-      case GOT_LABEL:
-        data_offset = 0;
-        expected_size = data;
-        recv_mode = GOT_DATA_LSB;
-        break;
-      case GOT_DATA_LSB:
-        expected_size += (data << 8);
-        if (expected_size == 0) {
-          recv_mode = WAITING_FOR_EOM;
-        } else {
-          recv_mode = IN_DATA;
-        }
-        break;
-      case IN_DATA:
-        message[data_offset] = data;
-        data_offset++;
-        if (data_offset == expected_size) {
-          recv_mode = WAITING_FOR_EOM;
-        }
-        break;
-      case WAITING_FOR_EOM:
-        if (data == 0xE7) {
-          // this was a valid packet, act on it
-          m_callback(label, message, expected_size);
-        }
-        recv_mode = PRE_SOM;
+    bool complete = false;
+    {
+      PROFILE_SCOPE(PROFILE_READ);
+      byte data = Serial.read();
+      switch (parser.Parse(data)) {
+        case UsbProParser::HEADER:
+          buffering = true;
+          break;
+        case UsbProParser::DATA:
+          if (buffering && m_data_callback)
+            buffering = m_data_callback(parser.Label(), parser.Offset(), data);
+          if (buffering && parser.Offset() < sizeof(message))
+            message[parser.Offset()] = data;
+          break;
+        case UsbProParser::END:
+          complete = true;
+          break;
+        case UsbProParser::NONE:
+        case UsbProParser::ABORT:
+          break;
+      }
+    }
+
+    // outside the scope so the profile doesn't include the message handling
+    if (complete) {
+      if (parser.Size() <= sizeof(message))
+        m_callback(parser.Label(), message, parser.Size());
+      else
+        oversized_messages++;
     }
   }
+#endif
+}
+
+
+unsigned int UsbProReceiver::DroppedFrames() {
+#ifdef HOST_USART_RX_vect
+  return UsbProFrameQueue.DroppedFrames();
+#else
+  // the USB endpoint is flow controlled, so only messages too big for the
+  // buffer are lost
+  return oversized_messages;
+#endif
+}
+
+
+unsigned int UsbProReceiver::CoalescedFrames() {
+#ifdef HOST_USART_RX_vect
+  return UsbProFrameQueue.CoalescedFrames();
+#else
+  // frames are handled as they are parsed, so one is never waiting behind
+  // another
+  return 0;
+#endif
 }
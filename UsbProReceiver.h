@@ -19,34 +19,158 @@
  */
 
 #include "Arduino.h"
+#include "Board.h"
+#include "UsbProCodec.h"
 
 #ifndef USBPRO_RECEIVER_H_
 #define USBPRO_RECEIVER_H_
 
+#ifdef HOST_USART_RX_vect
+/**
+ * When the host is connected through a USART the framing runs in the RX
+ * interrupt, so messages keep arriving while the main loop is busy with an
+ * EEPROM write or a slow RDM request.
+ *
+ * Each message is written straight into a buffer picked by its label, DMX &
+ * RDM messages get one of the large buffers, everything else a small one.
+ * Completed messages are passed to the main loop through a single producer,
+ * single consumer queue. If there is no free buffer when a message starts,
+ * or the message turns out to be bigger than its buffer, the message is
+ * dropped and counted.
+ *
+ * Only the newest DMX frame matters, so if the main loop falls behind and a
+ * later frame for the same port is already queued, the older one is skipped
+ * rather than applied.
+ *
+ * DMX frames can also be handled out of turn, from Scheduler.Yield(), while
+ * a slow message is at the front of the queue. Their buffers are released
+ * straight away and the queue entries are skipped when they reach the front.
+ */
+class UsbProFrameQueueClass {
+  public:
+    typedef struct {
+      byte label;
+      unsigned int size;
+      const byte *data;
+    } frame;
+
+    typedef void (*frame_handler)(byte label,
+                                  const byte *data,
+                                  unsigned int size);
+
+    UsbProFrameQueueClass()
+        : m_buffer(NO_BUFFER),
+          m_head(0),
+          m_tail(0),
+          m_dmx_waiting(false),
+          m_dropped_frames(0),
+          m_coalesced_frames(0) {
+      for (byte i = 0; i < BUFFER_COUNT; ++i)
+        m_busy[i] = false;
+    }
+
+    // Called from the main loop
+    bool Front(frame *next);
+    void Pop();
+    bool Superseded();
+    // Handle the queued DMX frames ahead of the messages in front of them
+    void HandleDmxFrames(frame_handler handler);
+    unsigned int DroppedFrames() const;
+    unsigned int CoalescedFrames() const { return m_coalesced_frames; }
+
+    // Called from the RX interrupt
+    void ReceiveByte(byte status, byte data);
+
+  private:
+    enum {
+      LARGE_BUFFER_SIZE = 600,
+      SMALL_BUFFER_SIZE = 32,
+      BUFFER_COUNT = Board::HOST_LARGE_BUFFERS + Board::HOST_SMALL_BUFFERS,
+      // frames handled out of turn keep their entry until they reach the
+      // front, this leaves room for a few behind a slow message
+      QUEUE_SIZE = BUFFER_COUNT + 4,
+      NO_BUFFER = 0xff,
+    };
+
+    typedef struct {
+      byte label;
+      byte buffer;  // NO_BUFFER once the frame has been handled out of turn
+      unsigned int size;
+#ifdef PROFILE
+      unsigned long received;  // when the message ended, in cycles
+#endif
+    } queued_frame;
+
+    // receive state, only used by the interrupt
+    UsbProParser m_parser;
+    byte m_buffer;
+    unsigned int m_capacity;
+
+    // a buffer is busy from the start of a message until it's popped
+    volatile bool m_busy[BUFFER_COUNT];
+    volatile queued_frame m_queue[QUEUE_SIZE];
+    // m_head is only written by the interrupt, m_tail by the main loop
+    volatile byte m_head;
+    volatile byte m_tail;
+    // set when a DMX frame is queued, cleared by HandleDmxFrames()
+    volatile bool m_dmx_waiting;
+    volatile unsigned int m_dropped_frames;
+    // only used by the main loop
+    unsigned int m_coalesced_frames;
+
+    byte m_large_buffers[Board::HOST_LARGE_BUFFERS][LARGE_BUFFER_SIZE];
+    byte m_small_buffers[Board::HOST_SMALL_BUFFERS][SMALL_BUFFER_SIZE];
+
+    void SkipHandled();
+    bool Superseded(byte index);
+    void RecordLatency(byte index);
+    bool AllocateBuffer();
+    void EndFrame(bool complete);
+    byte *Buffer(byte index);
+    bool IsNullStartFrame(byte index);
+    static bool IsLargeLabel(byte label);
+    static bool IsDmxLabel(byte label);
+    static byte Next(byte index) {
+      return index + 1 == QUEUE_SIZE ? 0 : index + 1;
+    }
+};
+
+extern UsbProFrameQueueClass UsbProFrameQueue;
+#endif
+
+
 /**
  * Receives a message over the serial link
  */
 class UsbProReceiver {
   public:
+    /*
+     * @param callback called when a full message is received
+     * @param idle_callback called when there is no serial data
+     * @param data_callback optional, called as each data byte arrives. If it
+     *   returns false the rest of the message isn't buffered, the message
+     *   callback still runs at the end of the message. This isn't used when
+     *   the messages are received by the interrupt.
+     */
     UsbProReceiver(void (*callback)(byte label,
                                     const byte *message,
                                     unsigned int size),
-                   void (*idle_callback)());
+                   void (*idle_callback)(),
+                   bool (*data_callback)(byte label,
+                                         unsigned int offset,
+                                         byte data) = NULL);
     void Read();
 
+    // The number of messages lost because the main loop fell behind, or
+    // because they were too big to buffer
+    static unsigned int DroppedFrames();
+    // The number of DMX frames skipped because a newer one was waiting
+    static unsigned int CoalescedFrames();
+
   private:
     void (*m_callback)(byte label, const byte *message, unsigned int size);
     void (*m_idle_callback)();
-
-    // The receiving state
-    typedef enum {
-      PRE_SOM = 0,
-      GOT_SOM = 1,
-      GOT_LABEL = 2,
-      GOT_DATA_LSB = 3,
-      IN_DATA = 4,
-      WAITING_FOR_EOM = 5,
-    } receiving_state;
+    bool (*m_data_callback)(byte label, unsigned int offset, byte data);
 };
 
 #endif  // USBPRO_RECEIVER_H_
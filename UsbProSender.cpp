@@ -17,6 +17,7 @@
  * Copyright (C) 2011 Simon Newton
  */
 
+#include "UsbProCodec.h"
 #include "UsbProSender.h"
 
 
@@ -24,17 +25,15 @@
  * Sends the message header
  */
 void UsbProSender::SendMessageHeader(byte label, int size) const {
-  Serial.write(0x7E);
-  Serial.write(label);
-  Serial.write(size);
-  Serial.write(size >> 8);
+  byte header[USBPRO_HEADER_SIZE];
+  Write(header, UsbProEncodeHeader(header, label, size));
 }
 
 /**
  * Sends the message footer
  */
 void UsbProSender::SendMessageFooter() const {
-  Serial.write(0xE7);
+  Write(USBPRO_EOM);
 }
 
 
@@ -47,6 +46,12 @@ void UsbProSender::SendMessageFooter() const {
 void UsbProSender::WriteMessage(byte label, int size,
                                 const byte data[]) const {
   SendMessageHeader(label, size);
-  Serial.write(data, size);
+  Write(data, size);
   SendMessageFooter();
 }
+
+
+void UsbProSender::Write(const byte *b, unsigned int l) const {
+  for (unsigned int i = 0; i < l; ++i)
+    Write(b[i]);
+}
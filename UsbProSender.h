@@ -18,6 +18,7 @@
  */
 
 #include "Arduino.h"
+#include "Scheduler.h"
 
 #ifndef USBPRO_SENDER_H
 #define USBPRO_SENDER_H
@@ -35,8 +36,13 @@ class UsbProSender {
     // helper message to send an array of bytes
     void WriteMessage(byte label, int size, const byte data[]) const;
 
-    void Write(byte b) const { Serial.write(b); }
-    void Write(const byte *b, unsigned int l) const { Serial.write(b, l); }
+    // Each byte is a scheduler step, DMX frames are applied while a long
+    // message waits for the TX ring.
+    void Write(byte b) const {
+      Scheduler.Yield();
+      Serial.write(b);
+    }
+    void Write(const byte *b, unsigned int l) const;
 };
 
 #endif  // USBPRO_SENDER_H
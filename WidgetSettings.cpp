@@ -27,9 +27,24 @@
  *   device power cycles (4)
  *   sensor 0 recorded value (2)
  *   dmx personality (1)
+ *   scene magic number (1)
+ *   preset playback mode (2)
+ *   preset playback level (1)
+ *   captured scenes bitmask (1)
+ *   ...
+ *   scenes, starting at 64 (MAX_SCENES * SCENE_SIZE)
+ *   calibration magic number (1)
+ *   calibration matrices (RGB_TRIPLET_COUNT * CALIBRATION_SIZE)
+ *   carrier magic number (1)
+ *   carriers (Board::PWM_TIMER_COUNT)
+ *
+ * A snapshot holds the configuration blocks, see SNAPSHOT_BLOCKS.
  */
 
+#include <avr/eeprom.h>
 #include "EEPROM/EEPROM.h"
+#include "RDMEnums.h"
+#include "Scheduler.h"
 #include "WidgetSettings.h"
 
 
@@ -46,6 +61,40 @@ const byte WidgetSettingsClass::DEVICE_LABEL_OFFSET = 12;
 const byte WidgetSettingsClass::DEVICE_POWER_CYCLES_OFFSET = 44;
 const byte WidgetSettingsClass::SENSOR_0_RECORDED_VALUE = 46;
 const byte WidgetSettingsClass::DMX_PERSONALITY_VALUE = 48;
+const byte WidgetSettingsClass::SCENE_MAGIC_OFFSET = 49;
+const byte WidgetSettingsClass::PRESET_PLAYBACK_MODE_OFFSET = 50;
+const byte WidgetSettingsClass::PRESET_PLAYBACK_LEVEL_OFFSET = 52;
+const byte WidgetSettingsClass::CAPTURED_SCENES_OFFSET = 53;
+const byte WidgetSettingsClass::SCENES_OFFSET = 64;
+// the calibration block follows the scenes, so it moves with the number of
+// outputs
+const unsigned int WidgetSettingsClass::CALIBRATION_MAGIC_OFFSET =
+  64 + MAX_SCENES * SCENE_SIZE;
+const unsigned int WidgetSettingsClass::CALIBRATION_OFFSET =
+  CALIBRATION_MAGIC_OFFSET + 1;
+const unsigned int WidgetSettingsClass::CARRIER_MAGIC_OFFSET =
+  CALIBRATION_OFFSET + RGB_TRIPLET_COUNT * CALIBRATION_SIZE;
+const unsigned int WidgetSettingsClass::CARRIER_OFFSET =
+  CARRIER_MAGIC_OFFSET + 1;
+
+// The scene, calibration & carrier blocks were added after the main settings,
+// so they have their own magic numbers.
+const byte WidgetSettingsClass::SCENE_MAGIC_NUMBER = 0x53;
+const byte WidgetSettingsClass::CALIBRATION_MAGIC_NUMBER = 0x43;
+const byte WidgetSettingsClass::CARRIER_MAGIC_NUMBER = 0x46;
+
+// The EEPROM blocks that make up a snapshot, in snapshot order. The label
+// block includes the size.
+const WidgetSettingsClass::eeprom_block
+    WidgetSettingsClass::SNAPSHOT_BLOCKS[] = {
+  {START_ADDRESS_OFFSET, 2},
+  {DMX_PERSONALITY_VALUE, 1},
+  {DEVICE_LABEL_SIZE_OFFSET, 2 + MAX_LABEL_LENGTH},
+  {PRESET_PLAYBACK_MODE_OFFSET, 4},
+  {SCENES_OFFSET, MAX_SCENES * SCENE_SIZE},
+  {CALIBRATION_OFFSET, RGB_TRIPLET_COUNT * CALIBRATION_SIZE},
+  {CARRIER_OFFSET, Board::PWM_TIMER_COUNT},
+};
 
 /**
  * Check if the settings are valid and if not initialize them
@@ -67,6 +116,26 @@ void WidgetSettingsClass::Init() {
     m_start_address = ReadInt(START_ADDRESS_OFFSET);
     m_personality = EEPROM.read(DMX_PERSONALITY_VALUE);
   }
+
+  if (EEPROM.read(SCENE_MAGIC_OFFSET) != SCENE_MAGIC_NUMBER) {
+    WriteByte(SCENE_MAGIC_OFFSET, SCENE_MAGIC_NUMBER);
+    SetPresetPlayback(0, 255);
+    WriteByte(CAPTURED_SCENES_OFFSET, 0);
+  }
+
+  if (EEPROM.read(CALIBRATION_MAGIC_OFFSET) != CALIBRATION_MAGIC_NUMBER) {
+    // the identity matrix leaves the outputs unchanged
+    const byte identity[CALIBRATION_SIZE] = {255, 0, 0, 0, 255, 0, 0, 0, 255};
+    for (byte i = 0; i < RGB_TRIPLET_COUNT; ++i)
+      SetCalibrationMatrix(i, identity);
+    WriteByte(CALIBRATION_MAGIC_OFFSET, CALIBRATION_MAGIC_NUMBER);
+  }
+
+  if (EEPROM.read(CARRIER_MAGIC_OFFSET) != CARRIER_MAGIC_NUMBER) {
+    for (byte i = 0; i < Board::PWM_TIMER_COUNT; ++i)
+      SetCarrier(i, CARRIER_DEFAULT);
+    WriteByte(CARRIER_MAGIC_OFFSET, CARRIER_MAGIC_NUMBER);
+  }
   IncrementDevicePowerCycles();
 }
 
@@ -113,11 +182,17 @@ bool WidgetSettingsClass::MatchesSerialNumber(const byte *data) const {
 }
 
 
+byte WidgetSettingsClass::UIDByte(byte index) const {
+  // the esta id is directly followed by the serial number
+  return EEPROM.read(ESTA_ID_OFFSET + index);
+}
+
+
 byte WidgetSettingsClass::DeviceLabel(char *label, byte length) const {
   byte size = min(ReadInt(DEVICE_LABEL_SIZE_OFFSET), length);
   byte i = 0;
   for (; i < size; ++i) {
-    label[i] = EEPROM.read(DEVICE_LABEL_OFFSET + i);
+    label[i] = ReadByte(DEVICE_LABEL_OFFSET + i);
     if (!label[i])
       break;
   }
@@ -155,17 +230,204 @@ void WidgetSettingsClass::SaveSensorValue(int value) {
 
 
 void WidgetSettingsClass::SetPersonality(byte value) {
-  EEPROM.write(DMX_PERSONALITY_VALUE, value);
+  WriteByte(DMX_PERSONALITY_VALUE, value);
   m_personality = value;
 }
 
 
+bool WidgetSettingsClass::SceneCaptured(byte scene) const {
+  if (scene == 0 || scene > MAX_SCENES)
+    return false;
+  return ReadByte(CAPTURED_SCENES_OFFSET) & (1 << (scene - 1));
+}
+
+
+bool WidgetSettingsClass::AnySceneCaptured() const {
+  return ReadByte(CAPTURED_SCENES_OFFSET);
+}
+
+
+void WidgetSettingsClass::CaptureScene(byte scene,
+                                       const byte *levels,
+                                       unsigned int up_fade,
+                                       unsigned int down_fade,
+                                       unsigned int wait_time) {
+  unsigned int offset = SCENES_OFFSET + (scene - 1) * SCENE_SIZE;
+  WriteInt(offset, up_fade);
+  WriteInt(offset + 2, down_fade);
+  WriteInt(offset + 4, wait_time);
+  for (byte i = 0; i < PWM_OUTPUT_COUNT; ++i)
+    WriteByte(offset + 6 + i, levels[i]);
+
+  WriteByte(CAPTURED_SCENES_OFFSET,
+               ReadByte(CAPTURED_SCENES_OFFSET) | (1 << (scene - 1)));
+}
+
+
+byte WidgetSettingsClass::SceneByte(byte scene, byte offset) const {
+  return ReadByte(SCENES_OFFSET + (scene - 1) * SCENE_SIZE + offset);
+}
+
+
+bool WidgetSettingsClass::SceneReadReady() const {
+  return eeprom_is_ready();
+}
+
+
+unsigned int WidgetSettingsClass::PresetPlaybackMode() const {
+  return ReadInt(PRESET_PLAYBACK_MODE_OFFSET);
+}
+
+
+byte WidgetSettingsClass::PresetPlaybackLevel() const {
+  return ReadByte(PRESET_PLAYBACK_LEVEL_OFFSET);
+}
+
+
+void WidgetSettingsClass::SetPresetPlayback(unsigned int mode, byte level) {
+  WriteInt(PRESET_PLAYBACK_MODE_OFFSET, mode);
+  WriteByte(PRESET_PLAYBACK_LEVEL_OFFSET, level);
+}
+
+
+/**
+ * Read the calibration matrix for a triplet.
+ * @param triplet the triplet, starting from 0
+ * @param matrix CALIBRATION_SIZE bytes, in row order
+ */
+void WidgetSettingsClass::CalibrationMatrix(byte triplet, byte *matrix) const {
+  unsigned int offset = CALIBRATION_OFFSET + triplet * CALIBRATION_SIZE;
+  for (byte i = 0; i < CALIBRATION_SIZE; ++i)
+    matrix[i] = ReadByte(offset + i);
+}
+
+
+void WidgetSettingsClass::SetCalibrationMatrix(byte triplet,
+                                               const byte *matrix) {
+  unsigned int offset = CALIBRATION_OFFSET + triplet * CALIBRATION_SIZE;
+  for (byte i = 0; i < CALIBRATION_SIZE; ++i)
+    WriteByte(offset + i, matrix[i]);
+}
+
+
+/**
+ * Read the saved carrier for a timer group.
+ * @param group the group, an index into Board::PWM_TIMERS
+ */
+byte WidgetSettingsClass::Carrier(byte group) const {
+  return ReadByte(CARRIER_OFFSET + group);
+}
+
+
+void WidgetSettingsClass::SetCarrier(byte group, byte carrier) {
+  WriteByte(CARRIER_OFFSET + group, carrier);
+}
+
+
+/**
+ * Return a byte of the snapshot. While a snapshot is being written this is
+ * the snapshot, rather than what's in the EEPROM.
+ * @param offset the offset, less than SNAPSHOT_SIZE
+ */
+byte WidgetSettingsClass::SnapshotByte(unsigned int offset) const {
+  switch (offset) {
+    case 0:
+      return SNAPSHOT_VERSION;
+    case 1:
+      return PWM_OUTPUT_COUNT;
+    case 2:
+      return Board::PWM_TIMER_COUNT;
+  }
+  offset -= SNAPSHOT_HEADER_SIZE;
+  if (m_snapshot_state != SNAPSHOT_IDLE)
+    return m_snapshot[offset];
+  return EEPROM.read(SnapshotAddress(offset));
+}
+
+
+/**
+ * Apply a snapshot. Nothing changes unless the whole snapshot is valid.
+ */
+WidgetSettingsClass::snapshot_status WidgetSettingsClass::ApplySnapshot(
+    const byte *data,
+    unsigned int size) {
+  if (size != SNAPSHOT_SIZE)
+    return SNAPSHOT_BAD_SIZE;
+  if (data[0] != SNAPSHOT_VERSION || data[1] != PWM_OUTPUT_COUNT ||
+      data[2] != Board::PWM_TIMER_COUNT)
+    return SNAPSHOT_BAD_VERSION;
+
+  const byte *snapshot = data + SNAPSHOT_HEADER_SIZE;
+  unsigned int start_address = (snapshot[0] << 8) + snapshot[1];
+  byte personality = snapshot[2];
+  unsigned int label_size = (snapshot[3] << 8) + snapshot[4];
+  const byte *preset = snapshot + 5 + MAX_LABEL_LENGTH;
+  unsigned int mode = (preset[0] << 8) + preset[1];
+  byte captured_scenes = preset[3];
+  const byte *carriers = snapshot + SNAPSHOT_DATA_SIZE - Board::PWM_TIMER_COUNT;
+
+  bool valid = start_address >= 1 && start_address <= 512;
+  valid &= personality >= 1 && personality <= PERSONALITY_COUNT;
+  valid &= label_size <= MAX_LABEL_LENGTH;
+  valid &= (mode == PRESET_PLAYBACK_OFF ||
+            (mode == PRESET_PLAYBACK_ALL && captured_scenes) ||
+            (mode <= MAX_SCENES && captured_scenes & (1 << (mode - 1))));
+  for (byte i = 0; i < Board::PWM_TIMER_COUNT; ++i)
+    valid &= carriers[i] < CARRIER_COUNT;
+  if (!valid)
+    return SNAPSHOT_OUT_OF_RANGE;
+
+  // a pending label would overwrite the snapshot's one
+  if (m_label_pending) {
+    m_label_size = label_size;
+    memcpy(m_label_buffer, snapshot + 5, label_size);
+  }
+
+  memcpy(m_snapshot, snapshot, SNAPSHOT_DATA_SIZE);
+  m_snapshot_state = SNAPSHOT_WRITING;
+  m_snapshot_offset = 0;
+  m_start_address = start_address;
+  m_personality = personality;
+  return SNAPSHOT_OK;
+}
+
+
+/**
+ * Called from the main loop. A snapshot can be a few hundred bytes, at 3.3ms
+ * per write that's too long to block DMX for, so this writes one byte at a
+ * time, skipping the bytes that don't change.
+ */
+bool WidgetSettingsClass::CommitSnapshot() {
+  if (m_snapshot_state == SNAPSHOT_WRITTEN) {
+    m_snapshot_state = SNAPSHOT_IDLE;
+    return true;
+  }
+  if (m_snapshot_state == SNAPSHOT_IDLE || !eeprom_is_ready())
+    return false;
+
+  while (m_snapshot_offset < SNAPSHOT_DATA_SIZE) {
+    unsigned int address = SnapshotAddress(m_snapshot_offset);
+    byte data = m_snapshot[m_snapshot_offset++];
+    if (EEPROM.read(address) == data) {
+      m_skipped_writes++;
+    } else {
+      EEPROM.write(address, data);
+      m_writes++;
+      break;
+    }
+  }
+  if (m_snapshot_offset == SNAPSHOT_DATA_SIZE)
+    m_snapshot_state = SNAPSHOT_WRITTEN;
+  return false;
+}
+
+
 bool WidgetSettingsClass::PerformWrite() {
   if (!m_label_pending)
     return false;
 
   for (byte i = 0; i < m_label_size; ++i) {
-    EEPROM.write(DEVICE_LABEL_OFFSET + i, m_label_buffer[i]);
+    WriteByte(DEVICE_LABEL_OFFSET + i, m_label_buffer[i]);
   }
   WriteInt(DEVICE_LABEL_SIZE_OFFSET, m_label_size);
   m_label_pending = false;
@@ -178,14 +440,90 @@ void WidgetSettingsClass::IncrementDevicePowerCycles() {
 }
 
 
+/**
+ * Read a byte of the settings. While a snapshot is being written, the bytes
+ * it covers come from the snapshot, so the settings never read back as a mix
+ * of the old & new values.
+ */
+byte WidgetSettingsClass::ReadByte(unsigned int offset) const {
+  if (m_snapshot_state == SNAPSHOT_WRITING) {
+    unsigned int snapshot_offset = SnapshotOffset(offset);
+    if (snapshot_offset < SNAPSHOT_DATA_SIZE)
+      return m_snapshot[snapshot_offset];
+  }
+  return EEPROM.read(offset);
+}
+
+
 unsigned int WidgetSettingsClass::ReadInt(unsigned int offset) const {
-  return (EEPROM.read(offset) << 8) + EEPROM.read(offset + 1);
+  return (ReadByte(offset) << 8) + ReadByte(offset + 1);
+}
+
+
+/**
+ * Write a byte, unless it already holds the value. An EEPROM write takes
+ * 3.3ms and wears the cell, and many SETs rewrite the current value.
+ *
+ * A setter called after a snapshot was applied wins. If the snapshot covers
+ * the byte the new value replaces the snapshot's, and if that part of the
+ * snapshot hasn't been written yet CommitSnapshot() writes it.
+ */
+void WidgetSettingsClass::WriteByte(unsigned int offset, byte data) {
+  if (m_snapshot_state == SNAPSHOT_WRITING) {
+    unsigned int snapshot_offset = SnapshotOffset(offset);
+    if (snapshot_offset < SNAPSHOT_DATA_SIZE) {
+      m_snapshot[snapshot_offset] = data;
+      if (snapshot_offset >= m_snapshot_offset)
+        return;
+    }
+  }
+  UpdateByte(offset, data);
+}
+
+
+void WidgetSettingsClass::UpdateByte(unsigned int offset, byte data) {
+  // the read would wait for the last write as well
+  Scheduler.WaitForEeprom();
+  if (EEPROM.read(offset) == data) {
+    m_skipped_writes++;
+    return;
+  }
+  EEPROM.write(offset, data);
+  m_writes++;
+}
+
+
+/**
+ * Map an offset into the snapshot data onto an EEPROM address.
+ */
+unsigned int WidgetSettingsClass::SnapshotAddress(unsigned int offset) {
+  const eeprom_block *block = SNAPSHOT_BLOCKS;
+  while (offset >= block->size) {
+    offset -= block->size;
+    block++;
+  }
+  return block->offset + offset;
+}
+
+
+/**
+ * Map an EEPROM address onto an offset into the snapshot data.
+ * @return SNAPSHOT_DATA_SIZE if the snapshot doesn't include the address
+ */
+unsigned int WidgetSettingsClass::SnapshotOffset(unsigned int address) {
+  unsigned int offset = 0;
+  const eeprom_block *block = SNAPSHOT_BLOCKS;
+  for (; offset < SNAPSHOT_DATA_SIZE; offset += block->size, block++) {
+    if (address >= block->offset && address < block->offset + block->size)
+      return offset + address - block->offset;
+  }
+  return SNAPSHOT_DATA_SIZE;
 }
 
 
 void WidgetSettingsClass::WriteInt(unsigned int offset, int data) {
-  EEPROM.write(offset, data >> 8);
-  EEPROM.write(offset + 1, data);
+  WriteByte(offset, data >> 8);
+  WriteByte(offset + 1, data);
 }
 
 unsigned long WidgetSettingsClass::ReadLong(unsigned long offset) const {
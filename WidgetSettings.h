@@ -18,6 +18,7 @@
  */
 
 #include "Arduino.h"
+#include "Personality.h"
 
 #ifndef WIDGET_SETTINGS_H
 #define WIDGET_SETTINGS_H
@@ -29,10 +30,16 @@ class WidgetSettingsClass {
   public:
     WidgetSettingsClass()
         : m_label_pending(false),
-          m_label_size(0)
+          m_label_size(0),
+          m_snapshot_state(SNAPSHOT_IDLE),
+          m_snapshot_offset(0),
+          m_writes(0),
+          m_skipped_writes(0)
     {}
     void Init();
 
+    enum { MAX_LABEL_LENGTH = 32 };
+
     unsigned int StartAddress() const { return m_start_address; };
     void SetStartAddress(unsigned int start_address);
 
@@ -45,6 +52,8 @@ class WidgetSettingsClass {
     void SetSerialNumber(long serial_number);
     // helper method to compare an array of bytes against the serial #
     bool MatchesSerialNumber(const byte *data) const;
+    // returns a byte of the UID, in network order
+    byte UIDByte(byte index) const;
 
     byte DeviceLabel(char *label, byte length) const;
     void SetDeviceLabel(const char *new_label, byte length);
@@ -59,14 +68,77 @@ class WidgetSettingsClass {
     byte Personality() const { return m_personality; }
     void SetPersonality(byte value);
 
+    // preset scenes, these are numbered from 1
+    enum { MAX_SCENES = 8 };
+    // a scene is the up fade, down fade & wait times, then the output levels
+    enum { SCENE_SIZE = 6 + PWM_OUTPUT_COUNT };
+    bool SceneCaptured(byte scene) const;
+    bool AnySceneCaptured() const;
+    void CaptureScene(byte scene, const byte *levels, unsigned int up_fade,
+                      unsigned int down_fade, unsigned int wait_time);
+    // read a single byte from a scene record
+    byte SceneByte(byte scene, byte offset) const;
+    // true if a scene byte can be read without waiting for a write
+    bool SceneReadReady() const;
+
+    unsigned int PresetPlaybackMode() const;
+    byte PresetPlaybackLevel() const;
+    void SetPresetPlayback(unsigned int mode, byte level);
+
+    // the colour calibration matrix for each RGB triplet, see Calibration.h
+    enum { CALIBRATION_SIZE = 9 };
+    void CalibrationMatrix(byte triplet, byte *matrix) const;
+    void SetCalibrationMatrix(byte triplet, const byte *matrix);
+
+    // the PWM carrier for each timer group, see PwmCarrier.h
+    byte Carrier(byte group) const;
+    void SetCarrier(byte group, byte carrier);
+
+    // A snapshot is the configuration as a versioned blob, so it can be
+    // copied to other widgets in one message. It's the version, the number of
+    // outputs & timer groups, then the start address, personality, device
+    // label size & label, preset playback mode, level & captured scenes, the
+    // scenes, the calibration matrices and the carriers. Multi byte values
+    // are big endian. The ESTA ID, serial number, power cycles & sensor value
+    // belong to the widget, so they aren't included.
+    enum { SNAPSHOT_VERSION = 1 };
+    enum { SNAPSHOT_HEADER_SIZE = 3 };
+    enum {
+      SNAPSHOT_SIZE = (SNAPSHOT_HEADER_SIZE + 2 + 1 + 2 + MAX_LABEL_LENGTH + 4 +
+                       MAX_SCENES * SCENE_SIZE +
+                       RGB_TRIPLET_COUNT * CALIBRATION_SIZE +
+                       Board::PWM_TIMER_COUNT)
+    };
+    typedef enum {
+      SNAPSHOT_OK = 0,
+      SNAPSHOT_BAD_SIZE = 1,
+      // a newer version, or from a board with different outputs
+      SNAPSHOT_BAD_VERSION = 2,
+      SNAPSHOT_OUT_OF_RANGE = 3,
+    } snapshot_status;
+
+    byte SnapshotByte(unsigned int offset) const;
+    // The start address & personality change straight away, the rest is
+    // written to the EEPROM in the background by CommitSnapshot(). The
+    // getters return the snapshot's values meanwhile.
+    snapshot_status ApplySnapshot(const byte *data, unsigned int size);
+    // Write the next byte of an applied snapshot if the EEPROM is free.
+    // @return true once the snapshot is written, the other modules then need
+    // to reload their copies of the settings.
+    bool CommitSnapshot();
+
     // perform any pending writes
     bool PerformWrite();
 
+    // The number of EEPROM bytes written, and the number skipped because they
+    // already held the value
+    unsigned int EepromWrites() const { return m_writes; }
+    unsigned int SkippedEepromWrites() const { return m_skipped_writes; }
+
   private:
     static const int MAGIC_NUMBER;
     static const long DEFAULT_SERIAL_NUMBER;
     static const char DEFAULT_LABEL[];
-    enum { MAX_LABEL_LENGTH = 32};
 
     static const byte MAGIC_NUMBER_OFFSET;
     static const byte START_ADDRESS_OFFSET;
@@ -77,6 +149,32 @@ class WidgetSettingsClass {
     static const byte DEVICE_POWER_CYCLES_OFFSET;
     static const byte SENSOR_0_RECORDED_VALUE;
     static const byte DMX_PERSONALITY_VALUE;
+    static const byte SCENE_MAGIC_NUMBER;
+    static const byte SCENE_MAGIC_OFFSET;
+    static const byte PRESET_PLAYBACK_MODE_OFFSET;
+    static const byte PRESET_PLAYBACK_LEVEL_OFFSET;
+    static const byte CAPTURED_SCENES_OFFSET;
+    static const byte SCENES_OFFSET;
+    static const byte CALIBRATION_MAGIC_NUMBER;
+    static const unsigned int CALIBRATION_MAGIC_OFFSET;
+    static const unsigned int CALIBRATION_OFFSET;
+    static const byte CARRIER_MAGIC_NUMBER;
+    static const unsigned int CARRIER_MAGIC_OFFSET;
+    static const unsigned int CARRIER_OFFSET;
+
+    // A run of EEPROM bytes that's part of a snapshot
+    typedef struct {
+      unsigned int offset;
+      unsigned int size;
+    } eeprom_block;
+    static const eeprom_block SNAPSHOT_BLOCKS[];
+    enum { SNAPSHOT_DATA_SIZE = SNAPSHOT_SIZE - SNAPSHOT_HEADER_SIZE };
+
+    typedef enum {
+      SNAPSHOT_IDLE,
+      SNAPSHOT_WRITING,
+      SNAPSHOT_WRITTEN,
+    } snapshot_state;
 
     unsigned int m_start_address;
     byte m_personality;
@@ -86,6 +184,19 @@ class WidgetSettingsClass {
     bool m_label_pending;
     byte m_label_size;
 
+    // an applied snapshot, less the header, while it's being written
+    byte m_snapshot[SNAPSHOT_DATA_SIZE];
+    snapshot_state m_snapshot_state;
+    unsigned int m_snapshot_offset;
+
+    unsigned int m_writes;
+    unsigned int m_skipped_writes;
+
+    byte ReadByte(unsigned int offset) const;
+    void WriteByte(unsigned int offset, byte data);
+    void UpdateByte(unsigned int offset, byte data);
+    static unsigned int SnapshotAddress(unsigned int offset);
+    static unsigned int SnapshotOffset(unsigned int address);
     unsigned int ReadInt(unsigned int offset) const;
     void WriteInt(unsigned int offset, int data);
 
@@ -0,0 +1,112 @@
+/*
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Library General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ * Trace.cpp
+ * Copyright (C) 2011 Simon Newton
+ * Reads & writes traces.
+ */
+
+#include <string.h>
+#include "Trace.h"
+
+namespace {
+const char TRACE_MAGIC[] = "RGBT";
+}  // namespace
+
+
+bool TraceWriter::WriteHeader() {
+  return (fwrite(TRACE_MAGIC, 4, 1, m_file) == 1 &&
+          fputc(TRACE_VERSION, m_file) != EOF);
+}
+
+
+/**
+ * Write a record, data longer than TRACE_MAX_RECORD_SIZE is split.
+ * @param time_us the time from the start of the session, this must not go
+ *   backwards.
+ */
+bool TraceWriter::Write(trace_record_type type, uint64_t time_us,
+                        const uint8_t *data, unsigned int size) {
+  if (time_us < m_last_time_us)
+    time_us = m_last_time_us;
+
+  do {
+    unsigned int chunk = size < TRACE_MAX_RECORD_SIZE ? size :
+                         TRACE_MAX_RECORD_SIZE;
+    if (fputc(type, m_file) == EOF ||
+        !WriteVarint(time_us - m_last_time_us) ||
+        !WriteVarint(chunk) ||
+        (chunk && fwrite(data, chunk, 1, m_file) != 1))
+      return false;
+    m_last_time_us = time_us;
+    data += chunk;
+    size -= chunk;
+  } while (size);
+  return true;
+}
+
+
+bool TraceWriter::WriteVarint(uint64_t value) {
+  while (value >= 0x80) {
+    if (fputc((value & 0x7f) | 0x80, m_file) == EOF)
+      return false;
+    value >>= 7;
+  }
+  return fputc(value, m_file) != EOF;
+}
+
+
+bool TraceReader::ReadHeader() {
+  char magic[4];
+  if (fread(magic, sizeof(magic), 1, m_file) != 1 ||
+      memcmp(magic, TRACE_MAGIC, sizeof(magic)))
+    return false;
+  int version = fgetc(m_file);
+  return version != EOF && version <= TRACE_VERSION;
+}
+
+
+bool TraceReader::Read(trace_record *record) {
+  int type = fgetc(m_file);
+  if (type == EOF)
+    return false;
+
+  uint64_t delta, size;
+  if (!ReadVarint(&delta) || !ReadVarint(&size) ||
+      size > TRACE_MAX_RECORD_SIZE ||
+      (size && fread(record->data, size, 1, m_file) != 1)) {
+    m_error = true;
+    return false;
+  }
+
+  m_time_us += delta;
+  record->type = static_cast<trace_record_type>(type);
+  record->time_us = m_time_us;
+  record->size = size;
+  return true;
+}
+
+
+bool TraceReader::ReadVarint(uint64_t *value) {
+  *value = 0;
+  for (unsigned int shift = 0; shift < 64; shift += 7) {
+    int b = fgetc(m_file);
+    if (b == EOF)
+      return false;
+    *value |= static_cast<uint64_t>(b & 0x7f) << shift;
+    if (!(b & 0x80))
+      return true;
+  }
+  return false;
+}
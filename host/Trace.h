@@ -0,0 +1,95 @@
+/*
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Library General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ * Trace.h
+ * Copyright (C) 2011 Simon Newton
+ * A compact binary record of the serial traffic to & from the widget and of
+ * the output levels, used to replay a session against another build.
+ *
+ * A trace is the magic "RGBT" and a version byte, then records of:
+ *   type (1 byte), the time since the previous record in us (varint), the
+ *   size (varint), then the data.
+ * The varints are 7 bits per byte, least significant first, with the top bit
+ * set on all but the last byte.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+
+#ifndef HOST_TRACE_H
+#define HOST_TRACE_H
+
+typedef enum {
+  TRACE_EEPROM = 0,  // the EEPROM image at the start of the session
+  TRACE_TO_WIDGET = 1,  // bytes from the host
+  TRACE_FROM_WIDGET = 2,  // bytes to the host
+  TRACE_OUTPUTS = 3,  // the output levels after a change, one byte each
+} trace_record_type;
+
+enum { TRACE_VERSION = 1 };
+// longer runs of serial data are split across records
+enum { TRACE_MAX_RECORD_SIZE = 4096 };
+
+typedef struct {
+  trace_record_type type;
+  uint64_t time_us;  // from the start of the session
+  unsigned int size;
+  uint8_t data[TRACE_MAX_RECORD_SIZE];
+} trace_record;
+
+
+class TraceWriter {
+  public:
+    // the file isn't closed by the writer
+    explicit TraceWriter(FILE *file)
+        : m_file(file),
+          m_last_time_us(0) {
+    }
+
+    bool WriteHeader();
+    bool Write(trace_record_type type, uint64_t time_us, const uint8_t *data,
+               unsigned int size);
+
+  private:
+    FILE *m_file;
+    uint64_t m_last_time_us;
+
+    bool WriteVarint(uint64_t value);
+};
+
+
+class TraceReader {
+  public:
+    explicit TraceReader(FILE *file)
+        : m_file(file),
+          m_time_us(0),
+          m_error(false) {
+    }
+
+    // @return false if this isn't a trace, or is from a newer version
+    bool ReadHeader();
+    // @return false at the end of the trace or if it's truncated
+    bool Read(trace_record *record);
+    // true if Read() stopped because the trace was truncated or corrupt
+    bool Error() const { return m_error; }
+
+  private:
+    FILE *m_file;
+    uint64_t m_time_us;
+    bool m_error;
+
+    bool ReadVarint(uint64_t *value);
+};
+
+#endif  // HOST_TRACE_H
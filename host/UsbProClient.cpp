@@ -0,0 +1,345 @@
+/*
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Library General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ * UsbProClient.cpp
+ * Copyright (C) 2011 Simon Newton
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <termios.h>
+#include <unistd.h>
+#include "MessageLabels.h"
+#include "RDMEnums.h"
+#include "UsbProClient.h"
+
+
+UsbProClient::UsbProClient(rdm_callback callback, void *context)
+    : m_fd(-1),
+      m_callback(callback),
+      m_context(context),
+      m_frame_callback(NULL),
+      m_frame_context(NULL),
+      m_timeout_ms(1000),
+      m_next_transaction(0),
+      m_next_sequence(0),
+      m_in_flight(0),
+      m_line_idle_ns(0) {
+  memset(m_src_uid, 0, sizeof(m_src_uid));
+  memset(m_pending, 0, sizeof(m_pending));
+  memset(&m_stats, 0, sizeof(m_stats));
+  m_stats.min_latency_us = 0xffffffff;
+}
+
+
+UsbProClient::~UsbProClient() {
+  Close();
+}
+
+
+/**
+ * Open the tty & put it into raw mode at the widget's baud rate.
+ */
+bool UsbProClient::Open(const char *device) {
+  Close();
+  m_fd = open(device, O_RDWR | O_NOCTTY);
+  if (m_fd < 0)
+    return false;
+
+  struct termios tio;
+  if (tcgetattr(m_fd, &tio)) {
+    Close();
+    return false;
+  }
+  cfmakeraw(&tio);
+  cfsetispeed(&tio, B115200);
+  cfsetospeed(&tio, B115200);
+  tio.c_cflag |= CLOCAL | CREAD;
+  if (tcsetattr(m_fd, TCSANOW, &tio)) {
+    Close();
+    return false;
+  }
+  tcflush(m_fd, TCIOFLUSH);
+  m_parser.Reset();
+  return true;
+}
+
+
+void UsbProClient::Close() {
+  if (m_fd >= 0)
+    close(m_fd);
+  m_fd = -1;
+}
+
+
+void UsbProClient::SetSourceUID(const uint8_t uid[RDM_UID_SIZE]) {
+  memcpy(m_src_uid, uid, RDM_UID_SIZE);
+}
+
+
+bool UsbProClient::SendDmx(const uint8_t *slots, uint16_t size) {
+  uint8_t data[MAX_FRAME_SIZE];
+  if (size >= sizeof(data))
+    return false;
+  data[0] = 0;  // start code
+  memcpy(data + 1, slots, size);
+  return WriteMessage(DMX_DATA_LABEL, data, size + 1);
+}
+
+
+int UsbProClient::SendRDM(const uint8_t dest_uid[RDM_UID_SIZE],
+                          uint8_t command_class,
+                          uint16_t pid,
+                          const uint8_t *param_data,
+                          uint8_t param_data_size) {
+  uint8_t transaction_number = m_next_transaction;
+  if (m_pending[transaction_number].active)
+    return -1;
+
+  rdm_header header;
+  memcpy(header.dest_uid, dest_uid, RDM_UID_SIZE);
+  memcpy(header.src_uid, m_src_uid, RDM_UID_SIZE);
+  header.transaction_number = transaction_number;
+  header.port_id = 1;
+  header.message_count = 0;
+  header.sub_device = 0;
+  header.command_class = command_class;
+  header.param_id = pid;
+  header.param_data_size = param_data_size;
+
+  uint8_t message[RDM_HEADER_SIZE + RDM_MAX_PARAM_DATA_SIZE +
+                  RDM_CHECKSUM_SIZE];
+  uint16_t size = RDMEncodeMessage(message, sizeof(message), header,
+                                   param_data);
+  if (!size)
+    return -1;
+
+  if (!WriteMessage(RDM_LABEL, message, size))
+    return -1;
+
+  pending_request *request = &m_pending[transaction_number];
+  clock_gettime(CLOCK_MONOTONIC, &request->sent);
+  request->active = true;
+  request->sequence = m_next_sequence++;
+  m_in_flight++;
+  m_next_transaction++;
+  return transaction_number;
+}
+
+
+bool UsbProClient::Poll(int timeout_ms) {
+  if (m_fd < 0)
+    return false;
+
+  struct pollfd fds = {m_fd, POLLIN, 0};
+  int ready = poll(&fds, 1, timeout_ms);
+  if (ready < 0 && errno != EINTR)
+    return false;
+
+  if (ready > 0) {
+    uint8_t data[256];
+    ssize_t size = read(m_fd, data, sizeof(data));
+    if (size <= 0)
+      return false;
+
+    for (ssize_t i = 0; i < size; ++i) {
+      switch (m_parser.Parse(data[i])) {
+        case UsbProParser::DATA:
+          if (m_parser.Offset() < sizeof(m_frame))
+            m_frame[m_parser.Offset()] = data[i];
+          break;
+        case UsbProParser::END:
+          if (m_parser.Size() <= sizeof(m_frame))
+            HandleFrame(m_parser.Label(), m_frame, m_parser.Size());
+          break;
+        default:
+          break;
+      }
+    }
+  }
+  ExpireRequests();
+  return true;
+}
+
+
+bool UsbProClient::WriteMessage(uint8_t label,
+                                const uint8_t *data,
+                                uint16_t size) {
+  uint8_t message[USBPRO_HEADER_SIZE + MAX_FRAME_SIZE + USBPRO_FOOTER_SIZE];
+  if (size > MAX_FRAME_SIZE)
+    return false;
+  size_t length = UsbProEncodeMessage(message, label, data, size);
+
+  size_t offset = 0;
+  while (offset < length) {
+    ssize_t written = write(m_fd, message + offset, length - offset);
+    if (written < 0) {
+      if (errno == EINTR)
+        continue;
+      return false;
+    }
+    offset += written;
+  }
+
+  // the message goes out after anything already written
+  uint64_t now = NanosNow();
+  if (m_line_idle_ns < now)
+    m_line_idle_ns = now;
+  m_line_idle_ns += length * BYTE_TIME_NS;
+  return true;
+}
+
+
+/**
+ * The backlog is estimated from the bytes written, a serial port driver can
+ * also report what it still holds.
+ */
+uint32_t UsbProClient::LineBacklogUs() const {
+  uint64_t now = NanosNow();
+  uint64_t backlog_ns = m_line_idle_ns > now ? m_line_idle_ns - now : 0;
+  int queued = 0;
+  if (m_fd >= 0 && !ioctl(m_fd, TIOCOUTQ, &queued) &&
+      static_cast<uint64_t>(queued) * BYTE_TIME_NS > backlog_ns)
+    backlog_ns = static_cast<uint64_t>(queued) * BYTE_TIME_NS;
+  return backlog_ns / 1000;
+}
+
+
+void UsbProClient::HandleFrame(uint8_t label,
+                               const uint8_t *data,
+                               uint16_t size) {
+  if (label == RDM_LABEL) {
+    if (size)
+      HandleRDMResponse(data, size);
+  } else if (m_frame_callback) {
+    m_frame_callback(label, data, size, m_frame_context);
+  }
+}
+
+
+/**
+ * The widget handles requests in order. A response carries the transaction
+ * number of the request, but a bare status code doesn't, so that's matched
+ * to the oldest outstanding request.
+ */
+void UsbProClient::HandleRDMResponse(const uint8_t *data, uint16_t size) {
+  uint8_t status = data[0];
+  const uint8_t *message = data + 1;
+  uint16_t message_size = size - 1;
+
+  rdm_header header;
+  int transaction_number;
+  if (status == RDM_STATUS_OK &&
+      RDMDecodeMessage(message, message_size, &header)) {
+    transaction_number = header.transaction_number;
+    if (!m_pending[transaction_number].active)
+      transaction_number = -1;
+  } else {
+    // a discovery response isn't framed as an RDM message
+    transaction_number = OldestRequest();
+  }
+
+  if (transaction_number < 0) {
+    m_stats.unmatched++;
+    return;
+  }
+  if (status != RDM_STATUS_OK) {
+    message = NULL;
+    message_size = 0;
+  }
+  Complete(transaction_number, status, message, message_size);
+}
+
+
+int UsbProClient::OldestRequest() const {
+  int oldest = -1;
+  for (unsigned int i = 0; i < TRANSACTION_COUNT; ++i) {
+    if (m_pending[i].active &&
+        (oldest < 0 ||
+         static_cast<int32_t>(m_pending[i].sequence -
+                              m_pending[oldest].sequence) < 0))
+      oldest = i;
+  }
+  return oldest;
+}
+
+
+void UsbProClient::Complete(uint8_t transaction_number,
+                            uint8_t status,
+                            const uint8_t *message,
+                            uint16_t message_size) {
+  pending_request *request = &m_pending[transaction_number];
+  rdm_result result;
+  result.transaction_number = transaction_number;
+  result.timed_out = false;
+  result.status = status;
+  result.message = message;
+  result.message_size = message_size;
+  result.latency_us = MicrosSince(request->sent);
+
+  request->active = false;
+  m_in_flight--;
+  m_stats.responses++;
+  m_stats.total_latency_us += result.latency_us;
+  if (result.latency_us < m_stats.min_latency_us)
+    m_stats.min_latency_us = result.latency_us;
+  if (result.latency_us > m_stats.max_latency_us)
+    m_stats.max_latency_us = result.latency_us;
+
+  if (m_callback)
+    m_callback(result, m_context);
+}
+
+
+void UsbProClient::ExpireRequests() {
+  uint32_t timeout_us = m_timeout_ms * 1000;
+  for (unsigned int i = 0; i < TRANSACTION_COUNT; ++i) {
+    pending_request *request = &m_pending[i];
+    if (!request->active)
+      continue;
+    uint32_t age = MicrosSince(request->sent);
+    if (age < timeout_us)
+      continue;
+
+    request->active = false;
+    m_in_flight--;
+    m_stats.timeouts++;
+    if (m_callback) {
+      rdm_result result;
+      memset(&result, 0, sizeof(result));
+      result.transaction_number = i;
+      result.timed_out = true;
+      result.latency_us = age;
+      m_callback(result, m_context);
+    }
+  }
+}
+
+
+uint32_t UsbProClient::MicrosSince(const struct timespec &start) {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return ((now.tv_sec - start.tv_sec) * 1000000 +
+          (now.tv_nsec - start.tv_nsec) / 1000);
+}
+
+
+uint64_t UsbProClient::NanosNow() {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return static_cast<uint64_t>(now.tv_sec) * 1000000000 + now.tv_nsec;
+}
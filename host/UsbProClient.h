@@ -0,0 +1,163 @@
+/*
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Library General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ * UsbProClient.h
+ * Copyright (C) 2011 Simon Newton
+ * A Linux client for the widget. DMX frames and RDM requests are written
+ * without waiting for the previous response, the RDM responses are matched
+ * to the requests by transaction number.
+ */
+
+#include <stdint.h>
+#include <time.h>
+#include "RDMCodec.h"
+#include "UsbProCodec.h"
+
+#ifndef HOST_USBPRO_CLIENT_H
+#define HOST_USBPRO_CLIENT_H
+
+// The outcome of an RDM request
+typedef struct {
+  uint8_t transaction_number;
+  bool timed_out;
+  uint8_t status;  // one of the widget's RDM status codes
+  // the response, only set if the status is OK
+  const uint8_t *message;
+  uint16_t message_size;
+  // from the request being written to the response being read
+  uint32_t latency_us;
+} rdm_result;
+
+typedef struct {
+  uint32_t responses;
+  uint32_t timeouts;
+  // responses that didn't match an outstanding request
+  uint32_t unmatched;
+  uint32_t min_latency_us;
+  uint32_t max_latency_us;
+  uint64_t total_latency_us;
+} client_stats;
+
+
+class UsbProClient {
+  public:
+    typedef void (*rdm_callback)(const rdm_result &result, void *context);
+    typedef void (*frame_callback)(uint8_t label,
+                                   const uint8_t *data,
+                                   uint16_t size,
+                                   void *context);
+
+    /*
+     * @param callback called for each response or timeout
+     * @param context passed to the callback
+     */
+    UsbProClient(rdm_callback callback, void *context);
+    ~UsbProClient();
+
+    bool Open(const char *device);
+    void Close();
+
+    // The UID the requests are sent from
+    void SetSourceUID(const uint8_t uid[RDM_UID_SIZE]);
+    // Requests that haven't been answered after this are reported as lost
+    void SetTimeout(unsigned int timeout_ms) { m_timeout_ms = timeout_ms; }
+    // Called with the messages that aren't RDM responses
+    void SetFrameCallback(frame_callback callback, void *context) {
+      m_frame_callback = callback;
+      m_frame_context = context;
+    }
+
+    /**
+     * Send a message with any label.
+     */
+    bool WriteMessage(uint8_t label, const uint8_t *data, uint16_t size);
+
+    /**
+     * Send a DMX frame, the start code is added.
+     */
+    bool SendDmx(const uint8_t *slots, uint16_t size);
+
+    /**
+     * Send an RDM request to the root device.
+     * @return the transaction number, or -1 if the write failed or there are
+     *   already 256 requests outstanding.
+     */
+    int SendRDM(const uint8_t dest_uid[RDM_UID_SIZE],
+                uint8_t command_class,
+                uint16_t pid,
+                const uint8_t *param_data,
+                uint8_t param_data_size);
+
+    // The number of requests waiting for a response
+    unsigned int InFlight() const { return m_in_flight; }
+
+    // How long until the messages already written have been sent at the
+    // line rate.
+    uint32_t LineBacklogUs() const;
+
+    /**
+     * Process the data from the widget & expire old requests.
+     * @param timeout_ms how long to wait for data
+     * @return false if the device failed
+     */
+    bool Poll(int timeout_ms);
+
+    const client_stats &Stats() const { return m_stats; }
+
+  private:
+    enum {
+      MAX_FRAME_SIZE = 600,
+      TRANSACTION_COUNT = 256,
+      // a byte at 115200 baud, with the start & stop bits
+      BYTE_TIME_NS = 86806,
+    };
+
+    typedef struct {
+      bool active;
+      uint32_t sequence;
+      struct timespec sent;
+    } pending_request;
+
+    int m_fd;
+    rdm_callback m_callback;
+    void *m_context;
+    frame_callback m_frame_callback;
+    void *m_frame_context;
+    unsigned int m_timeout_ms;
+    uint8_t m_src_uid[RDM_UID_SIZE];
+
+    uint8_t m_next_transaction;
+    uint32_t m_next_sequence;
+    unsigned int m_in_flight;
+    // when the bytes written so far will have been sent
+    uint64_t m_line_idle_ns;
+    pending_request m_pending[TRANSACTION_COUNT];
+    client_stats m_stats;
+
+    UsbProParser m_parser;
+    uint8_t m_frame[MAX_FRAME_SIZE];
+
+    void HandleFrame(uint8_t label, const uint8_t *data, uint16_t size);
+    void HandleRDMResponse(const uint8_t *data, uint16_t size);
+    int OldestRequest() const;
+    void Complete(uint8_t transaction_number,
+                  uint8_t status,
+                  const uint8_t *message,
+                  uint16_t message_size);
+    void ExpireRequests();
+
+    static uint32_t MicrosSince(const struct timespec &start);
+    static uint64_t NanosNow();
+};
+#endif  // HOST_USBPRO_CLIENT_H
@@ -0,0 +1,196 @@
+/*
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Library General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ * rdmping.cpp
+ * Copyright (C) 2011 Simon Newton
+ * Send a stream of RDM GETs to the widget, interleaved with DMX frames, and
+ * report the round trip time of each request.
+ *
+ *   rdmping [-n count] [-w window] [-d dmx_interval_ms] [-s dmx_slots]
+ *           [-t timeout_ms] <device> <uid> <pid>
+ *
+ * A DMX frame is only sent once the line has sent the messages before it,
+ * a 512 slot frame takes 45ms at 115200 baud. Frames that fall behind are
+ * skipped rather than sent in a burst, which would hold up the requests.
+ *
+ * The uid is of the form 7a70:00000001, the pid may be decimal or hex.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "RDMEnums.h"
+#include "UsbProClient.h"
+
+namespace {
+
+void Usage(const char *name) {
+  fprintf(stderr,
+          "Usage: %s [-n count] [-w window] [-d dmx_interval_ms] "
+          "[-s dmx_slots] [-t timeout_ms] <device> <uid> <pid>\n",
+          name);
+  exit(1);
+}
+
+
+bool ParseUID(const char *input, uint8_t uid[RDM_UID_SIZE]) {
+  unsigned int esta_id;
+  unsigned long serial;
+  if (sscanf(input, "%4x:%8lx", &esta_id, &serial) != 2)
+    return false;
+  uid[0] = esta_id >> 8;
+  uid[1] = esta_id;
+  uid[2] = serial >> 24;
+  uid[3] = serial >> 16;
+  uid[4] = serial >> 8;
+  uid[5] = serial;
+  return true;
+}
+
+
+uint32_t MillisNow() {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return now.tv_sec * 1000 + now.tv_nsec / 1000000;
+}
+
+
+void PrintResult(const rdm_result &result, void*) {
+  if (result.timed_out) {
+    printf("tn %3d: timed out\n", result.transaction_number);
+    return;
+  }
+
+  printf("tn %3d: %6.2f ms, ", result.transaction_number,
+         result.latency_us / 1000.0);
+  if (result.status != RDM_STATUS_OK) {
+    printf("status %d\n", result.status);
+  } else if (result.message_size < RDM_HEADER_SIZE) {
+    printf("%d byte response\n", result.message_size);
+  } else {
+    const uint8_t *message = result.message;
+    switch (message[RDM_PORT_ID_OFFSET]) {
+      case RDM_RESPONSE_ACK:
+        printf("ACK, %d bytes\n", message[RDM_PDL_OFFSET]);
+        break;
+      case RDM_RESPONSE_NACK:
+        printf("NACK, reason 0x%04x\n",
+               RDMReadShort(message + RDM_PARAM_DATA_OFFSET));
+        break;
+      default:
+        printf("response type %d\n", message[RDM_PORT_ID_OFFSET]);
+    }
+  }
+}
+}  // namespace
+
+
+int main(int argc, char *argv[]) {
+  unsigned int count = 100;
+  unsigned int window = 1;
+  unsigned int dmx_interval = 0;
+  unsigned int dmx_slots = 512;
+  unsigned int timeout = 1000;
+
+  int opt;
+  while ((opt = getopt(argc, argv, "n:w:d:s:t:")) != -1) {
+    switch (opt) {
+      case 'n':
+        count = atoi(optarg);
+        break;
+      case 'w':
+        window = atoi(optarg);
+        break;
+      case 'd':
+        dmx_interval = atoi(optarg);
+        break;
+      case 's':
+        dmx_slots = atoi(optarg);
+        break;
+      case 't':
+        timeout = atoi(optarg);
+        break;
+      default:
+        Usage(argv[0]);
+    }
+  }
+  if (argc - optind != 3 || !window || window > 255 || !dmx_slots ||
+      dmx_slots > 512)
+    Usage(argv[0]);
+
+  uint8_t uid[RDM_UID_SIZE];
+  if (!ParseUID(argv[optind + 1], uid))
+    Usage(argv[0]);
+  uint16_t pid = strtoul(argv[optind + 2], NULL, 0);
+
+  UsbProClient client(&PrintResult, NULL);
+  if (!client.Open(argv[optind])) {
+    perror(argv[optind]);
+    return 1;
+  }
+  client.SetTimeout(timeout);
+  // the controller's UID is the widget's UID with the top serial number
+  uint8_t src_uid[RDM_UID_SIZE] = {uid[0], uid[1], 0xff, 0xff, 0xff, 0xfe};
+  client.SetSourceUID(src_uid);
+
+  uint8_t dmx[512];
+  memset(dmx, 0, sizeof(dmx));
+  uint32_t next_dmx = MillisNow();
+  unsigned int dmx_sent = 0;
+  unsigned int dmx_skipped = 0;
+
+  unsigned int sent = 0;
+  while (sent < count || client.InFlight()) {
+    while (sent < count && client.InFlight() < window) {
+      if (client.SendRDM(uid, GET_COMMAND, pid, NULL, 0) < 0) {
+        fprintf(stderr, "Failed to send request\n");
+        return 1;
+      }
+      sent++;
+    }
+
+    if (dmx_interval && static_cast<int32_t>(MillisNow() - next_dmx) >= 0 &&
+        !client.LineBacklogUs()) {
+      for (unsigned int i = 0; i < dmx_slots; ++i)
+        dmx[i]++;
+      client.SendDmx(dmx, dmx_slots);
+      dmx_sent++;
+      next_dmx += dmx_interval;
+      uint32_t now = MillisNow();
+      if (static_cast<int32_t>(now - next_dmx) >= 0) {
+        dmx_skipped += (now - next_dmx) / dmx_interval + 1;
+        next_dmx = now + dmx_interval;
+      }
+    }
+
+    if (!client.Poll(dmx_interval ? 1 : 10)) {
+      fprintf(stderr, "Device error\n");
+      return 1;
+    }
+  }
+
+  const client_stats &stats = client.Stats();
+  printf("%u sent, %u responses, %u timeouts, %u unmatched\n",
+         sent, stats.responses, stats.timeouts, stats.unmatched);
+  if (dmx_interval)
+    printf("%u DMX frames sent, %u skipped\n", dmx_sent, dmx_skipped);
+  if (stats.responses) {
+    printf("round trip min/avg/max = %.2f/%.2f/%.2f ms\n",
+           stats.min_latency_us / 1000.0,
+           stats.total_latency_us / 1000.0 / stats.responses,
+           stats.max_latency_us / 1000.0);
+  }
+  return 0;
+}
@@ -0,0 +1,205 @@
+/*
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Library General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ * rgbconfig.cpp
+ * Copyright (C) 2011 Simon Newton
+ * Save a widget's configuration snapshot to a file, or provision widgets
+ * from one. Each widget takes a single message, whatever the number of
+ * settings.
+ *
+ *   rgbconfig [-t timeout_ms] -g <file> <device>
+ *   rgbconfig [-t timeout_ms] -s <file> <device> [<device> ...]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "MessageLabels.h"
+#include "UsbProClient.h"
+
+namespace {
+
+enum { MAX_SNAPSHOT_SIZE = 600 };
+
+// The reply to a CONFIG_LABEL message
+typedef struct {
+  bool received;
+  uint8_t data[MAX_SNAPSHOT_SIZE];
+  uint16_t size;
+} config_reply;
+
+// Matches WidgetSettingsClass::snapshot_status
+const char *const STATUS_NAMES[] = {
+  "ok",
+  "wrong size",
+  "wrong version or board",
+  "value out of range",
+};
+
+
+void Usage(const char *name) {
+  fprintf(stderr,
+          "Usage: %s [-t timeout_ms] -g <file> <device>\n"
+          "       %s [-t timeout_ms] -s <file> <device> [<device> ...]\n",
+          name, name);
+  exit(1);
+}
+
+
+uint32_t MillisNow() {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return now.tv_sec * 1000 + now.tv_nsec / 1000000;
+}
+
+
+void HandleFrame(uint8_t label,
+                 const uint8_t *data,
+                 uint16_t size,
+                 void *context) {
+  config_reply *reply = static_cast<config_reply*>(context);
+  if (label != CONFIG_LABEL || size > sizeof(reply->data))
+    return;
+  memcpy(reply->data, data, size);
+  reply->size = size;
+  reply->received = true;
+}
+
+
+/**
+ * Send a CONFIG_LABEL message & wait for the reply.
+ */
+bool Exchange(const char *device,
+              unsigned int timeout_ms,
+              const uint8_t *data,
+              uint16_t size,
+              config_reply *reply) {
+  UsbProClient client(NULL, NULL);
+  if (!client.Open(device)) {
+    perror(device);
+    return false;
+  }
+  reply->received = false;
+  client.SetFrameCallback(&HandleFrame, reply);
+  if (!client.WriteMessage(CONFIG_LABEL, data, size)) {
+    fprintf(stderr, "%s: write failed\n", device);
+    return false;
+  }
+
+  uint32_t start = MillisNow();
+  while (!reply->received && MillisNow() - start < timeout_ms) {
+    if (!client.Poll(10)) {
+      fprintf(stderr, "%s: device error\n", device);
+      return false;
+    }
+  }
+  if (!reply->received)
+    fprintf(stderr, "%s: timed out\n", device);
+  return reply->received;
+}
+
+
+bool Get(const char *file, const char *device, unsigned int timeout_ms) {
+  config_reply reply;
+  if (!Exchange(device, timeout_ms, NULL, 0, &reply))
+    return false;
+
+  FILE *output = fopen(file, "wb");
+  if (!output) {
+    perror(file);
+    return false;
+  }
+  bool ok = fwrite(reply.data, 1, reply.size, output) == reply.size;
+  ok &= fclose(output) == 0;
+  if (!ok) {
+    perror(file);
+    return false;
+  }
+  printf("%s: saved %d bytes, version %d\n", device, reply.size,
+         reply.size ? reply.data[0] : 0);
+  return true;
+}
+
+
+bool Set(const uint8_t *snapshot,
+         uint16_t size,
+         const char *device,
+         unsigned int timeout_ms) {
+  config_reply reply;
+  if (!Exchange(device, timeout_ms, snapshot, size, &reply))
+    return false;
+  if (reply.size != 1) {
+    fprintf(stderr, "%s: %d byte reply\n", device, reply.size);
+    return false;
+  }
+
+  uint8_t status = reply.data[0];
+  if (status < sizeof(STATUS_NAMES) / sizeof(STATUS_NAMES[0]))
+    printf("%s: %s\n", device, STATUS_NAMES[status]);
+  else
+    printf("%s: status %d\n", device, status);
+  return status == 0;
+}
+}  // namespace
+
+
+int main(int argc, char *argv[]) {
+  const char *get_file = NULL;
+  const char *set_file = NULL;
+  unsigned int timeout = 1000;
+
+  int opt;
+  while ((opt = getopt(argc, argv, "g:s:t:")) != -1) {
+    switch (opt) {
+      case 'g':
+        get_file = optarg;
+        break;
+      case 's':
+        set_file = optarg;
+        break;
+      case 't':
+        timeout = atoi(optarg);
+        break;
+      default:
+        Usage(argv[0]);
+    }
+  }
+  int devices = argc - optind;
+  if (get_file && !set_file && devices == 1)
+    return Get(get_file, argv[optind], timeout) ? 0 : 1;
+  if (!set_file || get_file || devices < 1)
+    Usage(argv[0]);
+
+  FILE *input = fopen(set_file, "rb");
+  if (!input) {
+    perror(set_file);
+    return 1;
+  }
+  uint8_t snapshot[MAX_SNAPSHOT_SIZE];
+  size_t size = fread(snapshot, 1, sizeof(snapshot), input);
+  fclose(input);
+  if (!size) {
+    fprintf(stderr, "%s: empty snapshot\n", set_file);
+    return 1;
+  }
+
+  // carry on with the rest of the fleet if one widget fails
+  int failures = 0;
+  for (int i = optind; i < argc; ++i) {
+    if (!Set(snapshot, size, argv[i], timeout))
+      failures++;
+  }
+  return failures ? 1 : 0;
+}
@@ -0,0 +1,151 @@
+/*
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Library General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ * rgblatency.cpp
+ * Copyright (C) 2011 Simon Newton
+ * Measure how long DMX frames take to reach the outputs, from a session
+ * recorded by rgbmixerd -t.
+ *
+ *   rgblatency <trace>
+ *
+ * The latency of a frame runs from its last byte reaching the widget to the
+ * logged output change, so it includes the wait for the next PWM period.
+ * Frames are matched to output changes by the level of the first output, so
+ * each frame needs a new value in slot 1, as rdmping's frames have, and the
+ * widget needs the default personality & start address. Frames that never
+ * reach the outputs were dropped, or replaced by a newer frame.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "MessageLabels.h"
+#include "Trace.h"
+#include "UsbProCodec.h"
+
+namespace {
+
+// 10 bits per byte, as the simulator's line runs at 115200 baud
+const double BYTE_US = 85.0;
+// a frame that doesn't reach the outputs within this is lost
+const uint64_t MAX_LATENCY_US = 1000000;
+enum { MAX_FRAMES = 100000 };
+
+typedef struct {
+  uint64_t end_us;
+  uint8_t level;
+} dmx_frame;
+
+dmx_frame frames[MAX_FRAMES];
+unsigned int latencies_us[MAX_FRAMES];
+
+
+int CompareLatency(const void *a, const void *b) {
+  unsigned int x = *static_cast<const unsigned int*>(a);
+  unsigned int y = *static_cast<const unsigned int*>(b);
+  return x < y ? -1 : x > y;
+}
+
+
+double Percentile(unsigned int count, double fraction) {
+  unsigned int index = count * fraction;
+  return latencies_us[index < count ? index : count - 1] / 1000.0;
+}
+}  // namespace
+
+
+int main(int argc, char *argv[]) {
+  if (argc != 2) {
+    fprintf(stderr, "Usage: %s <trace>\n", argv[0]);
+    return 1;
+  }
+  FILE *input = fopen(argv[1], "rb");
+  if (!input) {
+    perror(argv[1]);
+    return 1;
+  }
+  TraceReader reader(input);
+  if (!reader.ReadHeader()) {
+    fprintf(stderr, "%s: not a trace\n", argv[1]);
+    return 1;
+  }
+
+  UsbProParser parser;
+  // when the line from the host is next idle
+  double line_free_us = 0;
+  bool null_start = false;
+  uint8_t level = 0;
+  unsigned int frame_count = 0;
+  // the oldest frame that hasn't reached the outputs
+  unsigned int pending = 0;
+  unsigned int applied = 0;
+
+  trace_record record;
+  while (reader.Read(&record)) {
+    if (record.type == TRACE_TO_WIDGET) {
+      if (line_free_us < record.time_us)
+        line_free_us = record.time_us;
+      for (unsigned int i = 0; i < record.size; ++i) {
+        line_free_us += BYTE_US;
+        uint8_t data = record.data[i];
+        switch (parser.Parse(data)) {
+          case UsbProParser::DATA:
+            if (parser.Offset() == 0)
+              null_start = data == 0;
+            else if (parser.Offset() == 1)
+              level = data;
+            break;
+          case UsbProParser::END:
+            if (parser.Label() == DMX_DATA_LABEL && parser.Size() > 1 &&
+                null_start && frame_count < MAX_FRAMES) {
+              frames[frame_count].end_us = line_free_us;
+              frames[frame_count].level = level;
+              frame_count++;
+            }
+            break;
+          default:
+            break;
+        }
+      }
+    } else if (record.type == TRACE_OUTPUTS && record.size) {
+      // older frames that are still pending never reached the outputs
+      for (unsigned int i = pending; i < frame_count; ++i) {
+        if (frames[i].end_us > record.time_us)
+          break;
+        if (frames[i].level == record.data[0] &&
+            record.time_us - frames[i].end_us < MAX_LATENCY_US) {
+          latencies_us[applied++] = record.time_us - frames[i].end_us;
+          pending = i + 1;
+          break;
+        }
+      }
+    }
+  }
+  if (reader.Error())
+    fprintf(stderr, "%s: truncated\n", argv[1]);
+  fclose(input);
+
+  printf("dmx frames: %u, applied %u, lost %u\n", frame_count, applied,
+         frame_count - applied);
+  if (!applied)
+    return 0;
+
+  qsort(latencies_us, applied, sizeof(latencies_us[0]), CompareLatency);
+  uint64_t total = 0;
+  for (unsigned int i = 0; i < applied; ++i)
+    total += latencies_us[i];
+  printf("latency ms: mean %.2f, 50%% %.2f, 99%% %.2f, max %.2f\n",
+         total / 1000.0 / applied, Percentile(applied, 0.5),
+         Percentile(applied, 0.99), latencies_us[applied - 1] / 1000.0);
+  return 0;
+}
@@ -0,0 +1,176 @@
+/*
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Library General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ * rgbmixerd.cpp
+ * Copyright (C) 2011 Simon Newton
+ * A virtual widget. The firmware is built for the host and runs against
+ * simulated peripherals, with the host serial port on a pseudo terminal so
+ * OLA or rdmping can be pointed at it.
+ *
+ *   rgbmixerd [-e eeprom_file] [-o output_log] [-l link] [-t trace_file]
+ *
+ * The output levels are logged each time they change, one line per change:
+ * the time in seconds then a level per output. The settings are kept in the
+ * EEPROM file, rgbmixer.eeprom by default. With -t the session is recorded,
+ * see rgbreplay.
+ */
+
+#define _XOPEN_SOURCE 600
+#include <fcntl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <termios.h>
+#include <unistd.h>
+#include "sim/Simulator.h"
+
+namespace {
+
+void Usage(const char *name) {
+  fprintf(stderr,
+          "Usage: %s [-e eeprom_file] [-o output_log] [-l link] "
+          "[-t trace_file]\n",
+          name);
+  exit(1);
+}
+
+
+void Stop(int) {
+  SimStop();
+}
+
+
+/**
+ * Open the pseudo terminal. The slave is held open so reads on the master
+ * don't fail while no client is connected.
+ * @return the master fd, or -1 on error
+ */
+int OpenPty(int *slave_fd, const char **slave_name) {
+  int master_fd = posix_openpt(O_RDWR | O_NOCTTY);
+  if (master_fd < 0 || grantpt(master_fd) || unlockpt(master_fd)) {
+    perror("posix_openpt");
+    return -1;
+  }
+
+  *slave_name = ptsname(master_fd);
+  *slave_fd = open(*slave_name, O_RDWR | O_NOCTTY);
+  if (*slave_fd < 0) {
+    perror(*slave_name);
+    return -1;
+  }
+
+  // clients normally set this too, but a raw line is needed before they do
+  struct termios tio;
+  tcgetattr(*slave_fd, &tio);
+  cfmakeraw(&tio);
+  cfsetspeed(&tio, B115200);
+  tcsetattr(*slave_fd, TCSANOW, &tio);
+  return master_fd;
+}
+}  // namespace
+
+
+int main(int argc, char *argv[]) {
+  const char *eeprom_file = "rgbmixer.eeprom";
+  const char *log_file = NULL;
+  const char *link = NULL;
+  const char *trace_file = NULL;
+
+  int opt;
+  while ((opt = getopt(argc, argv, "e:o:l:t:")) != -1) {
+    switch (opt) {
+      case 'e':
+        eeprom_file = optarg;
+        break;
+      case 'o':
+        log_file = optarg;
+        break;
+      case 'l':
+        link = optarg;
+        break;
+      case 't':
+        trace_file = optarg;
+        break;
+      default:
+        Usage(argv[0]);
+    }
+  }
+  if (optind != argc)
+    Usage(argv[0]);
+
+  FILE *output_log = stdout;
+  if (log_file && !(output_log = fopen(log_file, "w"))) {
+    perror(log_file);
+    return 1;
+  }
+
+  if (!SimOpenEeprom(eeprom_file)) {
+    perror(eeprom_file);
+    return 1;
+  }
+
+  FILE *trace_output = NULL;
+  if (trace_file && !(trace_output = fopen(trace_file, "wb"))) {
+    perror(trace_file);
+    return 1;
+  }
+  TraceWriter trace(trace_output);
+  if (trace_output && !trace.WriteHeader()) {
+    perror(trace_file);
+    return 1;
+  }
+
+  int slave_fd;
+  const char *slave_name;
+  int master_fd = OpenPty(&slave_fd, &slave_name);
+  if (master_fd < 0)
+    return 1;
+
+  if (link) {
+    unlink(link);
+    if (symlink(slave_name, link)) {
+      perror(link);
+      return 1;
+    }
+  }
+  fprintf(stderr, "rgbmixerd: serial port is %s\n", link ? link : slave_name);
+
+  signal(SIGINT, Stop);
+  signal(SIGTERM, Stop);
+  SimRun(master_fd, output_log, trace_output ? &trace : NULL);
+  if (trace_output)
+    fclose(trace_output);
+
+  const sim_stats &stats = SimStats();
+  fprintf(stderr,
+          "rgbmixerd: %llu bytes received, %llu sent, %llu RX overruns, "
+          "%llu RX ring drops\n",
+          static_cast<unsigned long long>(stats.rx_bytes),
+          static_cast<unsigned long long>(stats.tx_bytes),
+          static_cast<unsigned long long>(stats.rx_overruns),
+          static_cast<unsigned long long>(stats.rx_ring_drops));
+  fprintf(stderr,
+          "rgbmixerd: %llu Timer1 overflows, %llu output changes, "
+          "%llu lost overflows, %llu EEPROM writes\n",
+          static_cast<unsigned long long>(stats.timer1_overflows),
+          static_cast<unsigned long long>(stats.output_changes),
+          static_cast<unsigned long long>(stats.lost_overflows),
+          static_cast<unsigned long long>(stats.eeprom_writes));
+
+  if (link)
+    unlink(link);
+  // the firmware thread never returns
+  _exit(0);
+}
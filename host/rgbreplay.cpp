@@ -0,0 +1,194 @@
+/*
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Library General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ * rgbreplay.cpp
+ * Copyright (C) 2011 Simon Newton
+ * Replay a session recorded by rgbmixerd -t against this build of the
+ * firmware, and check the responses & output changes are the same.
+ *
+ *   rgbreplay [-t output_trace] [-w tail_ms] <trace>
+ *
+ * The replay runs on a virtual clock, so it's deterministic and the timing
+ * of the responses isn't compared, only their order & content. The host CPU
+ * time spent handling each label's messages is reported, as a relative
+ * measure of the cost of a change. The exit status is 0 if the replay
+ * matches, 2 if it differs.
+ *
+ * A session recorded live may not match when it's first replayed, e.g. if
+ * bytes were overrun. Replay it once with -t and use that as the baseline.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "Trace.h"
+#include "sim/Simulator.h"
+
+namespace {
+
+void Usage(const char *name) {
+  fprintf(stderr, "Usage: %s [-t output_trace] [-w tail_ms] <trace>\n",
+          name);
+  exit(1);
+}
+
+
+/**
+ * The data of one record type in a trace, one byte at a time.
+ */
+class RecordStream {
+  public:
+    RecordStream(FILE *file, trace_record_type type)
+        : m_reader(file),
+          m_type(type),
+          m_offset(0),
+          m_records(0) {
+      m_record.size = 0;
+      m_record.time_us = 0;
+      rewind(file);
+      m_reader.ReadHeader();
+    }
+
+    // @return false at the end of the trace
+    bool Next(uint8_t *data) {
+      while (m_offset == m_record.size) {
+        if (!m_reader.Read(&m_record))
+          return false;
+        m_offset = m_record.type == m_type ? 0 : m_record.size;
+        if (m_record.type == m_type)
+          m_records++;
+      }
+      *data = m_record.data[m_offset++];
+      return true;
+    }
+
+    // The record the last byte came from
+    uint64_t Record() const { return m_records; }
+    double Seconds() const { return m_record.time_us / 1000000.0; }
+
+  private:
+    TraceReader m_reader;
+    trace_record_type m_type;
+    trace_record m_record;
+    unsigned int m_offset;
+    uint64_t m_records;
+};
+
+
+/**
+ * Compare one record type in the two traces.
+ * @return true if they match
+ */
+bool Compare(FILE *recorded, FILE *replayed, trace_record_type type,
+             const char *name) {
+  RecordStream expected(recorded, type);
+  RecordStream actual(replayed, type);
+  unsigned long long offset = 0;
+  while (true) {
+    uint8_t expected_byte = 0, actual_byte = 0;
+    bool expected_more = expected.Next(&expected_byte);
+    bool actual_more = actual.Next(&actual_byte);
+    if (!expected_more && !actual_more)
+      break;
+    if (expected_more != actual_more || expected_byte != actual_byte) {
+      printf("%s: differ at byte %llu, record %llu at %.6fs in the recording "
+             "and record %llu at %.6fs in the replay\n",
+             name, offset,
+             static_cast<unsigned long long>(expected.Record()),
+             expected.Seconds(),
+             static_cast<unsigned long long>(actual.Record()),
+             actual.Seconds());
+      return false;
+    }
+    offset++;
+  }
+  printf("%s: match, %llu bytes in %llu records\n", name, offset,
+         static_cast<unsigned long long>(actual.Record()));
+  return true;
+}
+
+
+void PrintCosts(const sim_message_cost costs[256]) {
+  printf("label  messages   mean us    max us\n");
+  for (unsigned int label = 0; label < 256; ++label) {
+    const sim_message_cost &cost = costs[label];
+    if (!cost.messages)
+      continue;
+    printf("%5u %9llu %9.2f %9.2f\n", label,
+           static_cast<unsigned long long>(cost.messages),
+           cost.total_ns / 1000.0 / cost.messages,
+           cost.max_ns / 1000.0);
+  }
+}
+}  // namespace
+
+
+int main(int argc, char *argv[]) {
+  const char *output_file = NULL;
+  unsigned long tail_ms = 1000;
+
+  int opt;
+  while ((opt = getopt(argc, argv, "t:w:")) != -1) {
+    switch (opt) {
+      case 't':
+        output_file = optarg;
+        break;
+      case 'w':
+        tail_ms = strtoul(optarg, NULL, 0);
+        break;
+      default:
+        Usage(argv[0]);
+    }
+  }
+  if (optind + 1 != argc)
+    Usage(argv[0]);
+
+  const char *input_file = argv[optind];
+  FILE *input = fopen(input_file, "rb");
+  if (!input) {
+    perror(input_file);
+    return 1;
+  }
+  TraceReader reader(input);
+  if (!reader.ReadHeader()) {
+    fprintf(stderr, "%s: not a trace\n", input_file);
+    return 1;
+  }
+
+  FILE *output = output_file ? fopen(output_file, "w+b") : tmpfile();
+  if (!output) {
+    perror(output_file ? output_file : "tmpfile");
+    return 1;
+  }
+  TraceWriter writer(output);
+  writer.WriteHeader();
+
+  static sim_message_cost costs[256];
+  bool complete = SimReplay(&reader, &writer, tail_ms * 1000ull, costs);
+  if (fflush(output)) {
+    perror(output_file ? output_file : "tmpfile");
+    return 1;
+  }
+  if (!complete)
+    fprintf(stderr, "%s: truncated, replayed up to the last whole record\n",
+            input_file);
+
+  bool match = Compare(input, output, TRACE_FROM_WIDGET, "responses");
+  match &= Compare(input, output, TRACE_OUTPUTS, "outputs");
+  PrintCosts(costs);
+  // the firmware still has the simulator's state, so don't run destructors
+  fflush(stdout);
+  _exit(match ? 0 : 2);
+}
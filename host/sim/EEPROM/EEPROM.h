@@ -0,0 +1,38 @@
+/*
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Library General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ * EEPROM/EEPROM.h
+ * Copyright (C) 2011 Simon Newton
+ * The Arduino EEPROM library for the host build.
+ */
+
+#include <stdint.h>
+#include <avr/eeprom.h>
+
+#ifndef HOST_SIM_EEPROM_H
+#define HOST_SIM_EEPROM_H
+
+class EEPROMClass {
+  public:
+    uint8_t read(int address) {
+      return eeprom_read_byte(reinterpret_cast<const uint8_t*>(address));
+    }
+    void write(int address, uint8_t value) {
+      eeprom_write_byte(reinterpret_cast<uint8_t*>(address), value);
+    }
+};
+
+extern EEPROMClass EEPROM;
+
+#endif  // HOST_SIM_EEPROM_H
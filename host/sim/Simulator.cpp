@@ -0,0 +1,922 @@
+/*
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Library General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ * Simulator.cpp
+ * Copyright (C) 2011 Simon Newton
+ * Runs the firmware against simulated ATmega328P peripherals.
+ *
+ * Time is counted in CPU cycles from the monotonic clock. The peripherals
+ * are driven by that clock rather than by the firmware, so a slow main loop
+ * or a long critical section has the same effect here as on the chip: RX
+ * bytes are overrun, Timer0 overflows are lost and writes block on the TX
+ * ring.
+ *
+ * A replay is the opposite. The firmware runs on the caller's thread against
+ * a virtual clock that only moves between passes of the main loop or while
+ * the firmware waits for the EEPROM, so the result only depends on the
+ * trace.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sched.h>
+#include <pthread.h>
+#include <signal.h>
+#include <sys/eventfd.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <util/atomic.h>
+#include "Arduino.h"
+#include "Board.h"
+#include "EEPROM/EEPROM.h"
+#include "Simulator.h"
+#include "UsbProReceiver.h"
+
+volatile uint8_t sim_data_memory[0x100];
+SimTimer0Register sim_tcnt0(false);
+SimTimer0Register sim_tifr0(true);
+HardwareSerial Serial;
+EEPROMClass EEPROM;
+
+// main.cpp is built with main renamed to firmware_main
+int firmware_main(void);
+void Setup();
+void TakeAction(byte label, const byte *message, unsigned int message_size);
+void Idle();
+bool FilterData(byte label, unsigned int offset, byte data);
+
+extern "C" {
+void TIMER0_OVF_vect(void);
+void TIMER1_OVF_vect(void);
+void USART_RX_vect(void);
+}
+
+namespace {
+
+const uint64_t CYCLES_PER_US = F_CPU / 1000000;
+// the timer clock for each CS setting
+const unsigned int PRESCALERS[8] = {0, 1, 8, 64, 256, 1024, 0, 0};
+// Timer0 is in fast PWM mode, Timer1 in 8 bit phase correct mode
+const uint64_t TIMER0_PERIOD = 256;
+const uint64_t TIMER1_PERIOD = 510;
+// as in the 1.0 core
+enum { SERIAL_BUFFER_SIZE = 64 };
+// the USART's receive buffer
+enum { USART_FIFO_SIZE = 2 };
+// bytes read from the serial port that are still to go down the line
+enum { LINE_BUFFER_SIZE = 4096 };
+const uint64_t EEPROM_WRITE_CYCLES = 3400 * CYCLES_PER_US;
+// the time one eeprom_is_ready() poll takes on the virtual clock
+const uint64_t EEPROM_POLL_CYCLES = 16;
+// if the host falls further behind than this the extra overflows are lost
+enum { MAX_CATCH_UP = 1000 };
+// output changes logged per pass, after that only the last is kept
+enum { MAX_OUTPUT_CHANGES = 16 };
+
+typedef struct {
+  uint64_t time;
+  uint8_t levels[Board::PWM_OUTPUT_COUNT];
+} output_change;
+
+struct timespec start_time;
+volatile sig_atomic_t running = 1;
+sim_stats stats;
+// the session is recorded here if it's set
+TraceWriter *trace = NULL;
+// no output is above 255 until the first change is logged
+uint8_t last_levels[Board::PWM_OUTPUT_COUNT];
+
+// The replay state, Now() returns virtual_now while replaying
+bool replaying = false;
+uint64_t virtual_now = 0;
+// the bytes written by the current pass of the main loop
+uint8_t replay_tx[TRACE_MAX_RECORD_SIZE];
+unsigned int replay_tx_size = 0;
+sim_message_cost *replay_costs = NULL;
+
+// The interrupt lock, see avr/interrupt.h
+pthread_mutex_t interrupt_lock = PTHREAD_MUTEX_INITIALIZER;
+__thread bool interrupts_off = false;
+__thread bool in_isr = false;
+
+// The time of the last overflow of each timer, guarded by the interrupt lock
+uint64_t timer0_overflow = 0;
+uint64_t timer1_overflow = 0;
+
+// The core's serial rings. The TX ring is guarded by serial_lock, the RX ring
+// by the interrupt lock.
+pthread_mutex_t serial_lock = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t serial_cond = PTHREAD_COND_INITIALIZER;
+uint8_t tx_ring[SERIAL_BUFFER_SIZE];
+unsigned int tx_head = 0;
+unsigned int tx_tail = 0;
+bool tx_busy = false;
+uint8_t rx_ring[SERIAL_BUFFER_SIZE];
+unsigned int rx_head = 0;
+unsigned int rx_tail = 0;
+// wakes the peripheral thread when the TX ring stops being empty
+int wake_fd = -1;
+// 8N1 at the default 115200 baud, Serial.begin() sets this
+volatile uint64_t byte_cycles = 1360;
+
+uint8_t eeprom[SIM_EEPROM_SIZE];
+int eeprom_fd = -1;
+uint64_t eeprom_busy_until = 0;
+
+
+void ReplayUntil(uint64_t time, bool main_loop);
+
+
+uint64_t Now() {
+  if (replaying)
+    return virtual_now;
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  uint64_t ns = (now.tv_sec - start_time.tv_sec) * 1000000000ull +
+                now.tv_nsec - start_time.tv_nsec;
+  return ns * CYCLES_PER_US / 1000;
+}
+
+
+void SleepCycles(uint64_t cycles) {
+  if (replaying) {
+    // the interrupts still run while the firmware waits
+    ReplayUntil(virtual_now + cycles, false);
+    return;
+  }
+  struct timespec delay;
+  uint64_t ns = cycles * 1000 / CYCLES_PER_US;
+  delay.tv_sec = ns / 1000000000;
+  delay.tv_nsec = ns % 1000000000;
+  nanosleep(&delay, NULL);
+}
+
+
+uint64_t Timer0Ticks() {
+  unsigned int prescaler = PRESCALERS[TCCR0B & 0x07];
+  return prescaler ? (Now() - timer0_overflow) / prescaler : 0;
+}
+
+
+/**
+ * Try to take the interrupt lock for the peripheral thread.
+ * @return false if the firmware has interrupts off.
+ */
+bool EnterInterrupt() {
+  if (pthread_mutex_trylock(&interrupt_lock))
+    return false;
+  interrupts_off = true;
+  in_isr = true;
+  return true;
+}
+
+
+void LeaveInterrupt() {
+  in_isr = false;
+  interrupts_off = false;
+  pthread_mutex_unlock(&interrupt_lock);
+}
+
+
+/**
+ * The line from the host. Bytes read from the serial port are shifted in one
+ * at a time, each lands in the USART's receive buffer byte_cycles after the
+ * previous one.
+ */
+class SerialLine {
+  public:
+    SerialLine()
+        : m_head(0),
+          m_size(0),
+          m_landing(0),
+          m_fifo_size(0),
+          m_overrun(false) {
+    }
+
+    bool Full() const { return m_size == LINE_BUFFER_SIZE; }
+
+    void ReadHost(int fd) {
+      while (!Full()) {
+        unsigned int tail = (m_head + m_size) % LINE_BUFFER_SIZE;
+        unsigned int space = LINE_BUFFER_SIZE - m_size;
+        if (tail + space > LINE_BUFFER_SIZE)
+          space = LINE_BUFFER_SIZE - tail;
+        ssize_t r = read(fd, m_line + tail, space);
+        if (r <= 0)
+          return;
+        if (trace)
+          trace->Write(TRACE_TO_WIDGET, Now() / CYCLES_PER_US, m_line + tail,
+                       r);
+        m_size += r;
+        stats.rx_bytes += r;
+      }
+    }
+
+    /**
+     * Land the bytes that have finished arriving, running the RX interrupt
+     * after each one if the firmware allows it.
+     */
+    void Receive(uint64_t now) {
+      if (!m_landing && m_size)
+        m_landing = now + byte_cycles;
+
+      while (m_landing && m_landing <= now) {
+        if (m_fifo_size == USART_FIFO_SIZE) {
+          // the byte in the shift register is lost
+          m_overrun = true;
+          stats.rx_overruns++;
+        } else {
+          m_fifo[m_fifo_size++] = m_line[m_head];
+        }
+        m_head = (m_head + 1) % LINE_BUFFER_SIZE;
+        m_size--;
+        m_landing = m_size ? m_landing + byte_cycles : 0;
+        Service();
+      }
+      Service();
+    }
+
+    // The time the next byte lands, or 0 if the line is idle
+    uint64_t NextEvent() const {
+      return m_landing;
+    }
+
+  private:
+    uint8_t m_line[LINE_BUFFER_SIZE];
+    unsigned int m_head;
+    unsigned int m_size;
+    uint64_t m_landing;
+    uint8_t m_fifo[USART_FIFO_SIZE];
+    unsigned int m_fifo_size;
+    bool m_overrun;
+
+    void Service() {
+      if (!m_fifo_size || !(UCSR0B & _BV(RXCIE0)) || !EnterInterrupt())
+        return;
+      while (m_fifo_size) {
+        // DOR is reported with the byte after the lost one
+        UCSR0A = m_overrun ? _BV(DOR0) : 0;
+        m_overrun = false;
+        UDR0 = m_fifo[0];
+        m_fifo[0] = m_fifo[1];
+        m_fifo_size--;
+        USART_RX_vect();
+      }
+      LeaveInterrupt();
+    }
+};
+
+
+/**
+ * Send the bytes from the TX ring that would have gone by now, back to back.
+ * @param tx_done the time the byte on the line finishes, or 0 if it's idle
+ * @return the new tx_done
+ */
+uint64_t Transmit(int fd, uint64_t now, uint64_t tx_done) {
+  uint8_t sent[SERIAL_BUFFER_SIZE];
+  unsigned int sent_size = 0;
+  while (tx_done <= now) {
+    pthread_mutex_lock(&serial_lock);
+    bool empty = tx_head == tx_tail;
+    uint8_t data = tx_ring[tx_tail];
+    if (!empty)
+      tx_tail = (tx_tail + 1) % SERIAL_BUFFER_SIZE;
+    tx_busy = !empty;
+    pthread_cond_broadcast(&serial_cond);
+    pthread_mutex_unlock(&serial_lock);
+    if (empty) {
+      tx_done = 0;
+      break;
+    }
+
+    // with nothing reading the port the data is lost, as it would be on the
+    // USB serial adapter
+    if (write(fd, &data, 1) == 1)
+      stats.tx_bytes++;
+    tx_done = (tx_done ? tx_done : now) + byte_cycles;
+    sent[sent_size++] = data;
+    if (sent_size == sizeof(sent))
+      break;
+  }
+
+  if (trace && sent_size)
+    trace->Write(TRACE_FROM_WIDGET, now / CYCLES_PER_US, sent, sent_size);
+  return tx_done;
+}
+
+
+/**
+ * Work out which overflows to run. An overflow that fell due before the
+ * cutoff was only held up by the host, so each one runs. After the cutoff the
+ * firmware had interrupts off and they share the one overflow flag.
+ * @param last the time of the last overflow, this is updated
+ * @param cutoff when the firmware turned interrupts off, or now
+ * @return the number of times to run the interrupt
+ */
+unsigned int DueOverflows(uint64_t *last, uint64_t period, uint64_t now,
+                          uint64_t cutoff) {
+  unsigned int runs = 0;
+  while (*last + period <= cutoff && runs < MAX_CATCH_UP) {
+    *last += period;
+    runs++;
+  }
+  if (*last + period <= now) {
+    uint64_t lost = (now - *last) / period - 1;
+    *last += (lost + 1) * period;
+    stats.lost_overflows += lost;
+    runs++;
+  }
+  return runs;
+}
+
+
+/**
+ * Timer1 keeps counting while its overflow interrupt is off, the firmware
+ * only turns it on when it has outputs to latch. This moves the last overflow
+ * up to the time, so once it's on the interrupt waits for the next period.
+ * @param last the time of the last overflow, this is updated
+ */
+void SkipOverflows(uint64_t *last, uint64_t period, uint64_t now) {
+  if (now > *last)
+    *last += (now - *last) / period * period;
+}
+
+
+/**
+ * The levels on the PWM pins, an output disconnected from its timer is held
+ * low.
+ */
+void ReadLevels(uint8_t *levels) {
+  for (byte i = 0; i < Board::PWM_OUTPUT_COUNT; ++i) {
+    const pwm_channel &channel = Board::PWM_CHANNELS[i];
+    if (!(_SFR_MEM8(channel.tccr_address) & channel.com_mask))
+      levels[i] = 0;
+    else if (channel.flags & PWM_CHANNEL_16BIT)
+      levels[i] = _SFR_MEM16(channel.ocr_address);
+    else
+      levels[i] = _SFR_MEM8(channel.ocr_address);
+  }
+}
+
+
+void LogLevels(FILE *output_log, const output_change &change) {
+  uint64_t us = change.time / CYCLES_PER_US;
+  if (output_log) {
+    fprintf(output_log, "%llu.%06llu",
+            static_cast<unsigned long long>(us / 1000000),
+            static_cast<unsigned long long>(us % 1000000));
+    for (byte i = 0; i < Board::PWM_OUTPUT_COUNT; ++i)
+      fprintf(output_log, " %d", change.levels[i]);
+    fputc('\n', output_log);
+    fflush(output_log);
+  }
+  if (trace)
+    trace->Write(TRACE_OUTPUTS, us, change.levels, sizeof(change.levels));
+  stats.output_changes++;
+}
+
+
+void *FirmwareThread(void*) {
+  // The main loop never sleeps, so on a busy host it would hold off the
+  // peripherals for a whole time slice. At the idle priority they preempt it
+  // as soon as they wake.
+  struct sched_param param;
+  memset(&param, 0, sizeof(param));
+  pthread_setschedparam(pthread_self(), SCHED_IDLE, &param);
+  firmware_main();
+  return NULL;
+}
+
+
+/*
+ * Replay
+ */
+void FlushReplay() {
+  if (replay_tx_size)
+    trace->Write(TRACE_FROM_WIDGET, virtual_now / CYCLES_PER_US, replay_tx,
+                 replay_tx_size);
+  replay_tx_size = 0;
+}
+
+
+uint64_t CpuNanoseconds() {
+  struct timespec now;
+  clock_gettime(CLOCK_THREAD_CPUTIME_ID, &now);
+  return now.tv_sec * 1000000000ull + now.tv_nsec;
+}
+
+
+/**
+ * One pass of UsbProReceiver::Read(), as it runs on a board with the host on
+ * a USART. Only TakeAction() is timed, it's where each message is handled.
+ */
+void RunMainLoop() {
+  UsbProFrameQueueClass::frame frame;
+  while (UsbProFrameQueue.Front(&frame)) {
+    if (UsbProFrameQueue.Superseded()) {
+      UsbProFrameQueue.Pop();
+      continue;
+    }
+    uint64_t start = CpuNanoseconds();
+    TakeAction(frame.label, frame.data, frame.size);
+    uint64_t cost = CpuNanoseconds() - start;
+    UsbProFrameQueue.Pop();
+
+    sim_message_cost &label_cost = replay_costs[frame.label];
+    label_cost.messages++;
+    label_cost.total_ns += cost;
+    label_cost.max_ns = max(label_cost.max_ns, cost);
+  }
+  Idle();
+  FlushReplay();
+}
+
+
+/**
+ * Run the timers up to the time.
+ * @param main_loop if true, run a pass of the main loop after each overflow.
+ */
+void ReplayUntil(uint64_t time, bool main_loop) {
+  while (EnterInterrupt()) {
+    uint64_t next = time + 1;
+    unsigned int prescaler0 = PRESCALERS[TCCR0B & 0x07];
+    uint64_t period0 = TIMER0_PERIOD * prescaler0;
+    if (prescaler0 && (TIMSK0 & _BV(TOIE0)))
+      next = min(next, timer0_overflow + period0);
+    unsigned int prescaler1 = PRESCALERS[TCCR1B & 0x07];
+    uint64_t period1 = TIMER1_PERIOD * prescaler1;
+    bool timer1_enabled = prescaler1 && (TIMSK1 & _BV(TOIE1));
+    if (timer1_enabled)
+      next = min(next, timer1_overflow + period1);
+    else if (prescaler1)
+      SkipOverflows(&timer1_overflow, period1, virtual_now);
+    if (next > time) {
+      LeaveInterrupt();
+      break;
+    }
+
+    // an EEPROM write can move the clock past several overflows
+    virtual_now = max(virtual_now, next);
+    if (prescaler0 && timer0_overflow + period0 == next) {
+      timer0_overflow = next;
+      TIMER0_OVF_vect();
+    }
+    if (timer1_enabled && timer1_overflow + period1 == next) {
+      timer1_overflow = next;
+      TIMER1_OVF_vect();
+      stats.timer1_overflows++;
+      output_change change;
+      ReadLevels(change.levels);
+      if (memcmp(change.levels, last_levels, sizeof(last_levels))) {
+        change.time = virtual_now;
+        memcpy(last_levels, change.levels, sizeof(last_levels));
+        LogLevels(NULL, change);
+      }
+    }
+    LeaveInterrupt();
+    if (main_loop)
+      RunMainLoop();
+  }
+  virtual_now = max(virtual_now, time);
+}
+
+
+/**
+ * A byte from the host lands in the USART.
+ */
+void ReplayByte(uint8_t data) {
+  stats.rx_bytes++;
+  if (!(UCSR0B & _BV(RXCIE0)) || !EnterInterrupt()) {
+    stats.rx_overruns++;
+    return;
+  }
+  UCSR0A = 0;
+  UDR0 = data;
+  USART_RX_vect();
+  LeaveInterrupt();
+}
+}  // namespace
+
+
+SimTimer0Register::operator uint8_t() const {
+  uint64_t ticks = Timer0Ticks();
+  if (m_flags)
+    return ticks >= TIMER0_PERIOD ? _BV(TOV0) : 0;
+  return ticks % TIMER0_PERIOD;
+}
+
+
+SimTimer0Register &SimTimer0Register::operator=(uint8_t value) {
+  unsigned int prescaler = PRESCALERS[TCCR0B & 0x07];
+  if (m_flags) {
+    // writing a 1 clears a pending overflow, its interrupt never runs
+    if ((value & _BV(TOV0)) && Timer0Ticks() >= TIMER0_PERIOD)
+      timer0_overflow += TIMER0_PERIOD * prescaler;
+  } else {
+    timer0_overflow = Now() - static_cast<uint64_t>(value) * prescaler;
+  }
+  return *this;
+}
+
+
+void SimDisableInterrupts() {
+  if (!interrupts_off) {
+    pthread_mutex_lock(&interrupt_lock);
+    interrupts_off = true;
+  }
+}
+
+
+void SimEnableInterrupts() {
+  if (interrupts_off && !in_isr) {
+    interrupts_off = false;
+    pthread_mutex_unlock(&interrupt_lock);
+  }
+}
+
+
+bool SimInterruptsEnabled() {
+  return !interrupts_off;
+}
+
+
+void SimDelayMicroseconds(unsigned int us) {
+  if (replaying) {
+    SleepCycles(us * CYCLES_PER_US);
+    return;
+  }
+  uint64_t end = Now() + us * CYCLES_PER_US;
+  while (Now() < end) {}
+}
+
+
+/*
+ * The Arduino core
+ */
+void init() {
+  // as wiring.c sets up the timers
+  TCCR0A = _BV(WGM11) | _BV(WGM10);
+  TCCR0B = 0x03;
+  TIMSK0 |= _BV(TOIE0);
+  TCCR1A = _BV(WGM10);
+  TCCR1B = 0x03;
+  TCCR2A = _BV(WGM10);
+  TCCR2B = 0x04;
+  UCSR0B = 0;
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    timer0_overflow = timer1_overflow = Now();
+  }
+  sei();
+}
+
+
+// The outputs are logged from the timer registers, so the pins aren't
+// modelled.
+void pinMode(uint8_t, uint8_t) {}
+void digitalWrite(uint8_t, uint8_t) {}
+int digitalRead(uint8_t) { return LOW; }
+void analogWrite(uint8_t, int) {}
+
+// About 25C from the temperature sensor
+int analogRead(uint8_t) { return 51; }
+
+
+void delayMicroseconds(unsigned int us) {
+  SimDelayMicroseconds(us);
+}
+
+
+/**
+ * The core's RX interrupt, which fills the 64 byte ring. The firmware
+ * replaces it on boards where the host is on a USART.
+ */
+extern "C" void __attribute__((weak)) USART_RX_vect(void) {
+  uint8_t data = UDR0;
+  unsigned int next = (rx_head + 1) % SERIAL_BUFFER_SIZE;
+  if (next == rx_tail) {
+    stats.rx_ring_drops++;
+    return;
+  }
+  rx_ring[rx_head] = data;
+  rx_head = next;
+}
+
+
+void HardwareSerial::begin(unsigned long baud) {
+  // the 1.0 core uses double speed mode, a frame is 10 bits
+  unsigned int ubrr = (F_CPU / 4 / baud - 1) / 2;
+  UBRR0H = ubrr >> 8;
+  UBRR0L = ubrr;
+  byte_cycles = 10 * 8 * (ubrr + 1);
+  UCSR0B |= _BV(RXEN0) | _BV(TXEN0) | _BV(RXCIE0);
+}
+
+
+int HardwareSerial::available() {
+  int size;
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    size = (SERIAL_BUFFER_SIZE + rx_head - rx_tail) % SERIAL_BUFFER_SIZE;
+  }
+  return size;
+}
+
+
+int HardwareSerial::peek() {
+  int data = -1;
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    if (rx_head != rx_tail)
+      data = rx_ring[rx_tail];
+  }
+  return data;
+}
+
+
+int HardwareSerial::read() {
+  int data = -1;
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    if (rx_head != rx_tail) {
+      data = rx_ring[rx_tail];
+      rx_tail = (rx_tail + 1) % SERIAL_BUFFER_SIZE;
+    }
+  }
+  return data;
+}
+
+
+/**
+ * Wait for the TX ring to drain.
+ */
+void HardwareSerial::flush() {
+  pthread_mutex_lock(&serial_lock);
+  while (tx_head != tx_tail || tx_busy)
+    pthread_cond_wait(&serial_cond, &serial_lock);
+  pthread_mutex_unlock(&serial_lock);
+}
+
+
+size_t HardwareSerial::write(uint8_t data) {
+  if (replaying) {
+    // the line is infinitely fast, so the bytes never queue
+    if (replay_tx_size == sizeof(replay_tx))
+      FlushReplay();
+    replay_tx[replay_tx_size++] = data;
+    stats.tx_bytes++;
+    return 1;
+  }
+
+  pthread_mutex_lock(&serial_lock);
+  unsigned int next = (tx_head + 1) % SERIAL_BUFFER_SIZE;
+  while (next == tx_tail)
+    pthread_cond_wait(&serial_cond, &serial_lock);
+  bool was_empty = tx_head == tx_tail;
+  tx_ring[tx_head] = data;
+  tx_head = next;
+  pthread_mutex_unlock(&serial_lock);
+  if (was_empty) {
+    uint64_t wake = 1;
+    if (::write(wake_fd, &wake, sizeof(wake)) < 0 && errno != EAGAIN)
+      perror("wake");
+  }
+  return 1;
+}
+
+
+size_t HardwareSerial::write(const uint8_t *data, size_t size) {
+  for (size_t i = 0; i < size; ++i)
+    write(data[i]);
+  return size;
+}
+
+
+/*
+ * avr-libc's EEPROM functions
+ */
+bool eeprom_is_ready() {
+  uint64_t now = Now();
+  if (replaying && now < eeprom_busy_until) {
+    // the virtual clock only moves while the firmware waits, so a loop
+    // polling this would never end
+    SleepCycles(min(eeprom_busy_until - now, EEPROM_POLL_CYCLES));
+  }
+  return now >= eeprom_busy_until;
+}
+
+
+void eeprom_busy_wait() {
+  uint64_t now = Now();
+  if (now < eeprom_busy_until)
+    SleepCycles(eeprom_busy_until - now);
+}
+
+
+uint8_t eeprom_read_byte(const uint8_t *address) {
+  eeprom_busy_wait();
+  return eeprom[reinterpret_cast<uintptr_t>(address) % SIM_EEPROM_SIZE];
+}
+
+
+void eeprom_write_byte(uint8_t *address, uint8_t value) {
+  eeprom_busy_wait();
+  unsigned int offset = reinterpret_cast<uintptr_t>(address) %
+                        SIM_EEPROM_SIZE;
+  eeprom[offset] = value;
+  if (eeprom_fd >= 0 && pwrite(eeprom_fd, &value, 1, offset) != 1)
+    perror("eeprom write");
+  eeprom_busy_until = Now() + EEPROM_WRITE_CYCLES;
+  stats.eeprom_writes++;
+}
+
+
+/*
+ * The simulator
+ */
+bool SimOpenEeprom(const char *path) {
+  eeprom_fd = open(path, O_RDWR | O_CREAT, 0644);
+  if (eeprom_fd < 0)
+    return false;
+
+  // an erased EEPROM reads as 0xff
+  memset(eeprom, 0xff, sizeof(eeprom));
+  ssize_t size = pread(eeprom_fd, eeprom, sizeof(eeprom), 0);
+  if (size < 0)
+    size = 0;
+  if (size < SIM_EEPROM_SIZE &&
+      pwrite(eeprom_fd, eeprom + size, SIM_EEPROM_SIZE - size, size) !=
+      SIM_EEPROM_SIZE - size)
+    return false;
+  return true;
+}
+
+
+void SimRun(int serial_fd, FILE *output_log, TraceWriter *session_trace) {
+  trace = session_trace;
+  if (trace)
+    trace->Write(TRACE_EEPROM, 0, eeprom, sizeof(eeprom));
+  memset(last_levels, 0xff, sizeof(last_levels));
+
+  clock_gettime(CLOCK_MONOTONIC, &start_time);
+  wake_fd = eventfd(0, EFD_NONBLOCK);
+  fcntl(serial_fd, F_SETFL, fcntl(serial_fd, F_GETFL) | O_NONBLOCK);
+
+  // signals are handled by this thread
+  sigset_t signals, old_signals;
+  sigfillset(&signals);
+  pthread_sigmask(SIG_BLOCK, &signals, &old_signals);
+  pthread_t firmware;
+  pthread_create(&firmware, NULL, FirmwareThread, NULL);
+  pthread_sigmask(SIG_SETMASK, &old_signals, NULL);
+
+  SerialLine line;
+  uint64_t tx_done = 0;
+  // when the firmware was first seen with interrupts off, 0 if it wasn't
+  uint64_t blocked_since = 0;
+  output_change output_changes[MAX_OUTPUT_CHANGES];
+
+  while (running) {
+    uint64_t now = Now();
+    line.ReadHost(serial_fd);
+    line.Receive(now);
+    tx_done = Transmit(serial_fd, now, tx_done);
+
+    // the timers, an overflow that's due waits if interrupts are off
+    uint64_t next_event = now + 1000 * CYCLES_PER_US;
+    bool blocked = false;
+    unsigned int changes = 0;
+    if (EnterInterrupt()) {
+      uint64_t cutoff = blocked_since ? blocked_since : now;
+      blocked_since = 0;
+
+      unsigned int prescaler = PRESCALERS[TCCR0B & 0x07];
+      uint64_t period = TIMER0_PERIOD * prescaler;
+      if (prescaler && (TIMSK0 & _BV(TOIE0))) {
+        for (unsigned int runs = DueOverflows(&timer0_overflow, period, now,
+                                              cutoff);
+             runs; --runs)
+          TIMER0_OVF_vect();
+        next_event = min(next_event, timer0_overflow + period);
+      }
+
+      prescaler = PRESCALERS[TCCR1B & 0x07];
+      period = TIMER1_PERIOD * prescaler;
+      if (prescaler && !(TIMSK1 & _BV(TOIE1))) {
+        SkipOverflows(&timer1_overflow, period, now);
+      } else if (prescaler) {
+        for (unsigned int runs = DueOverflows(&timer1_overflow, period, now,
+                                              cutoff);
+             runs; --runs) {
+          TIMER1_OVF_vect();
+          stats.timer1_overflows++;
+          output_change &change = output_changes[changes];
+          ReadLevels(change.levels);
+          if (!memcmp(change.levels, last_levels, sizeof(last_levels)))
+            continue;
+          change.time = timer1_overflow - (runs - 1) * period;
+          memcpy(last_levels, change.levels, sizeof(last_levels));
+          if (changes < MAX_OUTPUT_CHANGES - 1)
+            changes++;
+        }
+        next_event = min(next_event, timer1_overflow + period);
+      }
+      LeaveInterrupt();
+    } else {
+      blocked = true;
+      if (!blocked_since)
+        blocked_since = now;
+    }
+
+    for (unsigned int i = 0; i < changes; ++i)
+      LogLevels(output_log, output_changes[i]);
+
+    // sleep until the next event, or data from the host
+    if (line.NextEvent())
+      next_event = min(next_event, line.NextEvent());
+    if (tx_done)
+      next_event = min(next_event, tx_done);
+    now = Now();
+    uint64_t wait = next_event > now ? next_event - now : 0;
+    if (blocked)
+      wait = min(wait, 10 * CYCLES_PER_US);
+    struct timespec timeout;
+    uint64_t ns = wait * 1000 / CYCLES_PER_US;
+    timeout.tv_sec = ns / 1000000000;
+    timeout.tv_nsec = ns % 1000000000;
+    struct pollfd poll_fds[] = {
+      {wake_fd, POLLIN, 0},
+      {serial_fd, static_cast<short>(line.Full() ? 0 : POLLIN), 0},
+    };
+    if (ppoll(poll_fds, 2, &timeout, NULL) > 0 &&
+        (poll_fds[0].revents & POLLIN)) {
+      uint64_t wake;
+      if (read(wake_fd, &wake, sizeof(wake)) < 0 && errno != EAGAIN)
+        perror("wake");
+    }
+  }
+}
+
+
+void SimStop() {
+  running = 0;
+}
+
+
+const sim_stats &SimStats() {
+  return stats;
+}
+
+
+bool SimReplay(TraceReader *input, TraceWriter *output, uint64_t tail_us,
+               sim_message_cost costs[256]) {
+  trace_record record;
+  bool have_record = input->Read(&record);
+  memset(eeprom, 0xff, sizeof(eeprom));
+  if (have_record && record.type == TRACE_EEPROM) {
+    memcpy(eeprom, record.data, min(record.size, sizeof(eeprom)));
+    have_record = input->Read(&record);
+  }
+
+  trace = output;
+  trace->Write(TRACE_EEPROM, 0, eeprom, sizeof(eeprom));
+  memset(last_levels, 0xff, sizeof(last_levels));
+  replay_costs = costs;
+  replaying = true;
+  virtual_now = 0;
+
+  Setup();
+  UsbProReceiver receiver(TakeAction, Idle, FilterData);
+  RunMainLoop();
+
+  // when the line from the host is next idle
+  uint64_t line_free = 0;
+  for (; have_record; have_record = input->Read(&record)) {
+    if (record.type != TRACE_TO_WIDGET)
+      continue;
+    ReplayUntil(record.time_us * CYCLES_PER_US, true);
+    // the writer holds the time if the replay is already past it
+    trace->Write(TRACE_TO_WIDGET, record.time_us, record.data, record.size);
+    line_free = max(line_free, record.time_us * CYCLES_PER_US);
+    for (unsigned int i = 0; i < record.size; ++i) {
+      line_free += byte_cycles;
+      ReplayUntil(line_free, true);
+      ReplayByte(record.data[i]);
+      RunMainLoop();
+    }
+  }
+
+  ReplayUntil(line_free + tail_us * CYCLES_PER_US, true);
+  FlushReplay();
+  replaying = false;
+  return !input->Error();
+}
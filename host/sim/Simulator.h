@@ -0,0 +1,86 @@
+/*
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Library General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ * Simulator.h
+ * Copyright (C) 2011 Simon Newton
+ * Runs the firmware against simulated ATmega328P peripherals: the host
+ * USART, Timer0 & Timer1 and the EEPROM. The firmware's main() runs on its
+ * own thread, the peripherals on the caller's.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include "../Trace.h"
+
+#ifndef HOST_SIM_SIMULATOR_H
+#define HOST_SIM_SIMULATOR_H
+
+typedef struct {
+  uint64_t rx_bytes;
+  uint64_t tx_bytes;
+  // bytes lost because the RX interrupt didn't run in time, the USART's
+  // data overrun
+  uint64_t rx_overruns;
+  // bytes dropped by the core's 64 byte RX ring, only used if the firmware
+  // doesn't handle the RX interrupt itself
+  uint64_t rx_ring_drops;
+  // timer overflows that were lost because interrupts were off too long
+  uint64_t lost_overflows;
+  uint64_t timer1_overflows;
+  uint64_t output_changes;
+  uint64_t eeprom_writes;
+} sim_stats;
+
+// The host CPU time spent handling one label's messages during a replay
+typedef struct {
+  uint64_t messages;
+  uint64_t total_ns;
+  uint64_t max_ns;
+} sim_message_cost;
+
+/*
+ * Load the EEPROM image, a missing file is created and reads as erased.
+ * @return false if the file couldn't be opened.
+ */
+bool SimOpenEeprom(const char *path);
+
+/*
+ * Start the firmware and run the peripherals until SimStop() is called.
+ * @param serial_fd the host end of the serial port
+ * @param output_log where the output levels are logged each time they change,
+ *   one line per change: the time in seconds, then a level per output.
+ * @param trace if set, the session is recorded here.
+ */
+void SimRun(int serial_fd, FILE *output_log, TraceWriter *trace);
+
+/*
+ * Run the firmware against the messages from the host in a trace. The EEPROM
+ * starts as the trace's image, the file from SimOpenEeprom() isn't used.
+ * Don't call SimRun() or SimReplay() after this.
+ * @param input the trace to replay
+ * @param output the replayed session is written here
+ * @param tail_us how long to keep running after the last byte from the host
+ * @param costs indexed by label, the CPU time spent handling each message is
+ *   added to these.
+ * @return false if the input trace is corrupt.
+ */
+bool SimReplay(TraceReader *input, TraceWriter *output, uint64_t tail_us,
+               sim_message_cost costs[256]);
+
+// Safe to call from a signal handler
+void SimStop();
+
+const sim_stats &SimStats();
+
+#endif  // HOST_SIM_SIMULATOR_H
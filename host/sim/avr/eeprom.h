@@ -0,0 +1,33 @@
+/*
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Library General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ * avr/eeprom.h
+ * Copyright (C) 2011 Simon Newton
+ * The EEPROM for the host build. A write keeps the EEPROM busy for 3.4ms as
+ * it does on the chip, the image is saved to a file.
+ */
+
+#include <stdint.h>
+
+#ifndef HOST_SIM_AVR_EEPROM_H
+#define HOST_SIM_AVR_EEPROM_H
+
+enum { SIM_EEPROM_SIZE = 1024 };
+
+bool eeprom_is_ready();
+void eeprom_busy_wait();
+uint8_t eeprom_read_byte(const uint8_t *address);
+void eeprom_write_byte(uint8_t *address, uint8_t value);
+
+#endif  // HOST_SIM_AVR_EEPROM_H
@@ -0,0 +1,35 @@
+/*
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Library General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ * avr/interrupt.h
+ * Copyright (C) 2011 Simon Newton
+ * Interrupts for the host build. The firmware runs on one thread and the
+ * simulated peripherals on another, an ISR runs on the peripheral thread
+ * while it holds the interrupt lock. cli() takes the lock, so the firmware's
+ * critical sections exclude the ISRs as they do on the chip.
+ */
+
+#ifndef HOST_SIM_AVR_INTERRUPT_H
+#define HOST_SIM_AVR_INTERRUPT_H
+
+#define ISR(vector) extern "C" void vector(void)
+
+void SimDisableInterrupts();
+void SimEnableInterrupts();
+bool SimInterruptsEnabled();
+
+#define cli() SimDisableInterrupts()
+#define sei() SimEnableInterrupts()
+
+#endif  // HOST_SIM_AVR_INTERRUPT_H
@@ -0,0 +1,98 @@
+/*
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Library General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ * avr/io.h
+ * Copyright (C) 2011 Simon Newton
+ * The ATmega328P registers the firmware uses, for the host build. They live
+ * in a simulated data memory, apart from TCNT0 & TIFR0 which are worked out
+ * from the clock since micros() reads them.
+ */
+
+#include <stdint.h>
+
+#ifndef HOST_SIM_AVR_IO_H
+#define HOST_SIM_AVR_IO_H
+
+#ifndef __AVR_ATmega328P__
+#error "The simulator only models the ATmega328P"
+#endif
+
+#define _BV(bit) (1 << (bit))
+
+extern volatile uint8_t sim_data_memory[0x100];
+
+#define _SFR_MEM8(address) (sim_data_memory[(address)])
+#define _SFR_MEM16(address) \
+  (*reinterpret_cast<volatile uint16_t*>(&sim_data_memory[(address)]))
+#define _SFR_MEM_ADDR(reg) \
+  static_cast<unsigned int>(&(reg) - sim_data_memory)
+
+// Timer0's counter and overflow flag, read back from the simulated clock
+class SimTimer0Register {
+  public:
+    explicit SimTimer0Register(bool flags) : m_flags(flags) {}
+    operator uint8_t() const;
+    SimTimer0Register &operator=(uint8_t value);
+
+  private:
+    bool m_flags;
+};
+
+extern SimTimer0Register sim_tcnt0;
+extern SimTimer0Register sim_tifr0;
+
+#define TIFR0 sim_tifr0
+#define TIFR1 _SFR_MEM8(0x36)
+#define TCCR0A _SFR_MEM8(0x44)
+#define TCCR0B _SFR_MEM8(0x45)
+#define TCNT0 sim_tcnt0
+#define OCR0A _SFR_MEM8(0x47)
+#define OCR0B _SFR_MEM8(0x48)
+#define TIMSK0 _SFR_MEM8(0x6e)
+#define TIMSK1 _SFR_MEM8(0x6f)
+#define TIMSK2 _SFR_MEM8(0x70)
+#define TCCR1A _SFR_MEM8(0x80)
+#define TCCR1B _SFR_MEM8(0x81)
+#define TCNT1 _SFR_MEM16(0x84)
+#define ICR1 _SFR_MEM16(0x86)
+#define OCR1A _SFR_MEM16(0x88)
+#define OCR1B _SFR_MEM16(0x8a)
+#define TCCR2A _SFR_MEM8(0xb0)
+#define TCCR2B _SFR_MEM8(0xb1)
+#define OCR2A _SFR_MEM8(0xb3)
+#define OCR2B _SFR_MEM8(0xb4)
+#define UCSR0A _SFR_MEM8(0xc0)
+#define UCSR0B _SFR_MEM8(0xc1)
+#define UCSR0C _SFR_MEM8(0xc2)
+#define UBRR0L _SFR_MEM8(0xc4)
+#define UBRR0H _SFR_MEM8(0xc5)
+#define UDR0 _SFR_MEM8(0xc6)
+
+#define TOV0 0
+#define TOIE0 0
+#define TOV1 0
+#define TOIE1 0
+#define TOIE2 0
+#define CS10 0
+#define WGM10 0
+#define WGM11 1
+#define WGM12 3
+#define WGM13 4
+#define DOR0 3
+#define FE0 4
+#define RXCIE0 7
+#define RXEN0 4
+#define TXEN0 3
+
+#endif  // HOST_SIM_AVR_IO_H
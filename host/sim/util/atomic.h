@@ -0,0 +1,53 @@
+/*
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Library General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ * util/atomic.h
+ * Copyright (C) 2011 Simon Newton
+ * ATOMIC_BLOCK for the host build, see avr/interrupt.h.
+ */
+
+#include <avr/interrupt.h>
+
+#ifndef HOST_SIM_UTIL_ATOMIC_H
+#define HOST_SIM_UTIL_ATOMIC_H
+
+class SimAtomicBlock {
+  public:
+    explicit SimAtomicBlock(bool restore_state)
+        : m_enable(!restore_state || SimInterruptsEnabled()),
+          m_done(false) {
+      SimDisableInterrupts();
+    }
+    ~SimAtomicBlock() {
+      if (m_enable)
+        SimEnableInterrupts();
+    }
+    // true the first time, so the block's body runs once
+    bool Once() {
+      bool run = !m_done;
+      m_done = true;
+      return run;
+    }
+
+  private:
+    bool m_enable;
+    bool m_done;
+};
+
+#define ATOMIC_RESTORESTATE true
+#define ATOMIC_FORCEON false
+#define ATOMIC_BLOCK(type) \
+  for (SimAtomicBlock sim_atomic_block(type); sim_atomic_block.Once(); )
+
+#endif  // HOST_SIM_UTIL_ATOMIC_H
@@ -0,0 +1,26 @@
+/*
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Library General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ * util/delay.h
+ * Copyright (C) 2011 Simon Newton
+ * _delay_us() for the host build.
+ */
+
+#ifndef HOST_SIM_UTIL_DELAY_H
+#define HOST_SIM_UTIL_DELAY_H
+
+void SimDelayMicroseconds(unsigned int us);
+#define _delay_us(us) SimDelayMicroseconds(us)
+
+#endif  // HOST_SIM_UTIL_DELAY_H
@@ -21,9 +21,25 @@ extern "C" void __cxa_pure_virtual() {}
  * http://opendmx.net/index.php/Arduino_RGB_Mixer
  */
 
+#include "Board.h"
+#include "Calibration.h"
+#include "ColourMath.h"
 #include "Common.h"
+#include "DmxReceiver.h"
+#include "DmxTransmitter.h"
+#include "Effects.h"
 #include "MessageLabels.h"
+#include "OutputSync.h"
+#include "Personality.h"
+#include "PresetPlayer.h"
+#include "Profiler.h"
+#include "PwmCarrier.h"
+#include "PwmDriver.h"
+#include "RDMCodec.h"
+#include "RDMEnums.h"
 #include "RDMHandlers.h"
+#include "Responders.h"
+#include "Scheduler.h"
 #include "UsbProReceiver.h"
 #include "UsbProSender.h"
 #include "WidgetSettings.h"
@@ -37,16 +53,22 @@ byte MANUFACTURER_NAME_SIZE = sizeof(MANUFACTURER_NAME);
 UsbProSender sender;
 RDMHandler rdm_handler(&sender);
 
-// Pin constants
-const byte LED_PIN = 13;
-const byte PWM_PINS[] = {3, 5, 6, 9, 10, 11};
-
-// device setting
-const byte DEVICE_PARAMS[] = {0, 1, 0, 0, 40};
+// device setting, the firmware version, break & MAB times and refresh rate.
+// The host can change the last three.
+byte device_params[] = {0, 1, 9, 1, 0};
+enum {
+  BREAK_TIME_PARAM = 2,
+  MAB_TIME_PARAM = 3,
+  REFRESH_RATE_PARAM = 4,
+};
 const byte DEVICE_ID[] = {1, 0};
 
 // global state
-byte led_state = LOW;  // flash the led when we get data.
+byte output_levels[PWM_OUTPUT_COUNT];  // the current level of each output
+volatile byte render_ticks = 0;  // incremented on each render tick
+byte last_render_ticks = 0;
+// true while the RDM handler is running, line requests wait until it's done
+bool rdm_handler_busy = false;
 
 
 /**
@@ -88,33 +110,273 @@ void SendManufacturerResponse() {
 
 
 /**
- * Write the DMX values to the PWM pins.
+ * Send the counters response. Each counter is 2 bytes, little endian.
+ *  - host messages dropped because there was no free receive buffer, or
+ *    they were too big for one
+ *  - EEPROM bytes written
+ *  - EEPROM writes skipped because the byte already held the value
+ *  - retransmitted RDM SETs answered from the replay cache
+ *  - syncs that applied a staged frame
+ *  - DMX frames skipped because a newer frame was already queued
+ *  - RDM responses to the DMX line dropped because they were too late, this
+ *    is always 0 without DMX_INPUT
+ */
+void SendCounters() {
+  const unsigned int counters[] = {
+    UsbProReceiver::DroppedFrames(),
+    WidgetSettings.EepromWrites(),
+    WidgetSettings.SkippedEepromWrites(),
+    rdm_handler.ReplayedSets(),
+    OutputSync.Syncs(),
+    UsbProReceiver::CoalescedFrames(),
+#ifdef DMX_INPUT
+    DmxReceiver.LateResponses(),
+#else
+    0,
+#endif
+  };
+  const byte counter_count = sizeof(counters) / sizeof(counters[0]);
+  sender.SendMessageHeader(COUNTERS_LABEL, 2 * counter_count);
+  for (byte i = 0; i < counter_count; ++i) {
+    sender.Write(counters[i]);
+    sender.Write(counters[i] >> 8);
+  }
+  sender.SendMessageFooter();
+}
+
+
+/**
+ * Stage the output levels for the PWM driver, applying the calibration and
+ * then the master & strobe. The values reach the pins on the next Timer1
+ * overflow.
+ */
+void WriteOutputs() {
+  byte values[PWM_OUTPUT_COUNT];
+  Calibration.Apply(output_levels, values);
+  byte gain = Effects.Gain();
+  for (byte i = 0; i < PWM_OUTPUT_COUNT; ++i)
+    values[i] = Scale8(values[i], gain) ^ OutputMap.InvertMask(i);
+  PwmDriver.Commit(values);
+}
+
+
+/**
+ * Write the DMX values to the PWM pins. In sync mode the values are staged
+ * until the next sync.
  * @param data the dmx data buffer.
  * @param size the size of the dmx buffer.
  */
 void SetPWM(const byte data[], unsigned int size) {
-  unsigned int start_address = WidgetSettings.StartAddress() - 1;
-  byte personality = WidgetSettings.Personality();
-
-  for (byte i = 0; i < sizeof(PWM_PINS) && start_address + i < size; ++i) {
-    byte value = data[start_address + i];
-    bool invert = false;
-    invert |= i < 3 && personality > 1;
-    invert |= i >= 3 && personality == 3;
-    analogWrite(PWM_PINS[i], invert ? 255 - value : value);
+  PROFILE_SCOPE(PROFILE_SET_PWM);
+  if (OutputSync.Enabled()) {
+    OutputMap.Apply(data, size, OutputSync.StagedLevels());
+    OutputSync.Stage(OutputMap.Master(), OutputMap.StrobeRate());
+    return;
   }
+
+  OutputMap.Apply(data, size, output_levels);
+  Effects.SetMaster(OutputMap.Master());
+  Effects.SetStrobeRate(OutputMap.StrobeRate());
+  WriteOutputs();
+}
+
+
+/**
+ * Staged output values are latched on the Timer1 overflow, so they change on
+ * a PWM period boundary. Outside of profile builds the interrupt is only
+ * enabled while there's a frame to latch, at the 31kHz carrier taking every
+ * overflow would cost about 17% of the CPU.
+ */
+ISR(TIMER1_OVF_vect) {
+  PROFILE_OVERFLOW();
+  PwmDriver.Latch();
+}
+
+
+/**
+ * The render tick, this is called from the Timer0 overflow.
+ */
+void HandleRenderTick() {
+  render_ticks++;
+  Effects.Tick();
+#if DMX_PORT_COUNT > 0
+  DmxTransmitter.Tick();
+#endif
+}
+
+
+/**
+ * Send the configuration snapshot.
+ */
+void SendConfig() {
+  sender.SendMessageHeader(CONFIG_LABEL, WidgetSettingsClass::SNAPSHOT_SIZE);
+  for (unsigned int i = 0; i < WidgetSettingsClass::SNAPSHOT_SIZE; ++i)
+    sender.Write(WidgetSettings.SnapshotByte(i));
+  sender.SendMessageFooter();
+}
+
+
+/**
+ * Apply a configuration snapshot and reply with the snapshot_status. The
+ * snapshot is written to the EEPROM from Idle(), so a fleet can be
+ * provisioned without blocking DMX.
+ */
+void ApplyConfig(const byte *message, unsigned int message_size) {
+  byte status = WidgetSettings.ApplySnapshot(message, message_size);
+  if (status == WidgetSettingsClass::SNAPSHOT_OK) {
+    OutputMap.Compile(WidgetSettings.Personality(),
+                      WidgetSettings.StartAddress());
+    rdm_handler.InvalidateCachedResponses();
+  }
+  sender.WriteMessage(CONFIG_LABEL, sizeof(status), &status);
+}
+
+
+/**
+ * Reload the settings the other modules keep a copy of, once a snapshot has
+ * been written.
+ */
+void ReloadSettings() {
+  Calibration.Init();
+  PwmCarrier.Init();
+  PresetPlayer.Start(WidgetSettings.PresetPlaybackMode(),
+                     WidgetSettings.PresetPlaybackLevel());
+  rdm_handler.InvalidateCachedResponses();
+  WriteOutputs();
+}
+
+
+/**
+ * Apply a DMX frame from the host.
+ */
+void ApplyDmxFrame(byte label,
+                   const byte *message,
+                   unsigned int message_size) {
+  switch (label) {
+    case DMX_DATA_LABEL:
+#if DMX_PORT_COUNT > 0
+      DmxTransmitter.SetFrame(0, message, message_size);
+#endif
+      // preset playback takes priority over DMX
+      if (message_size && message[0] == 0 && !PresetPlayer.Active()) {
+        // 0 start code, flash the led when we get data
+        Board::LedPin::Toggle();
+        SetPWM(&message[1], message_size - 1);
+      }
+      break;
+#if DMX_PORT_COUNT > 1
+    case DMX_DATA_PORT2_LABEL:
+      DmxTransmitter.SetFrame(1, message, message_size);
+      break;
+    case DMX_DATA_PORT3_LABEL:
+      DmxTransmitter.SetFrame(2, message, message_size);
+      break;
+#endif
+  }
+}
+
+
+/**
+ * The high priority task, this applies the DMX frames that are waiting. It
+ * runs from Idle() and whenever RDM or settings work yields, see
+ * Scheduler.h.
+ */
+void ApplyWaitingDmx() {
+#ifdef HOST_USART_RX_vect
+  UsbProFrameQueue.HandleDmxFrames(ApplyDmxFrame);
+#endif
+#ifdef DMX_INPUT
+  if (DmxReceiver.FrameReady() && !PresetPlayer.Active())
+    SetPWM(DmxReceiver.Frame(), DmxReceiver.FrameSize());
+#endif
+}
+
+
+#ifdef DMX_INPUT
+/**
+ * Answer an RDM request from the DMX line, the controller only waits 2ms for
+ * the response.
+ */
+void AnswerLineRDM() {
+  if (!DmxReceiver.RequestReady() || rdm_handler_busy)
+    return;
+  rdm_handler_busy = true;
+  DmxReceiver.SendResponse(rdm_handler.HandleLineRDMMessage(
+      DmxReceiver.Request(),
+      DmxReceiver.RequestSize(),
+      DmxReceiver.ResponseBuffer(),
+      DmxReceiverClass::RDM_BUFFER_SIZE));
+  rdm_handler_busy = false;
+}
+
+
+/**
+ * Runs while the main loop waits for an EEPROM write, so a long write such as
+ * a snapshot doesn't hold up the line. SETs may write the EEPROM themselves,
+ * so they wait for Idle(), along with any request that arrives while the RDM
+ * handler is busy with the host. DmxReceiver counts the responses that end up
+ * too late to send.
+ */
+void AnswerLineRDMDuringWrite() {
+  if (DmxReceiver.RequestReady() &&
+      DmxReceiver.Request()[RDM_COMMAND_CLASS_OFFSET] != SET_COMMAND)
+    AnswerLineRDM();
 }
+#endif
 
 
 /**
  * Called when there is no serial data
  */
 void Idle() {
+#ifdef DMX_INPUT
+  // answer RDM first, the controller only waits 2ms for the response
+  AnswerLineRDM();
+#endif
+  ApplyWaitingDmx();
+
+  byte ticks = render_ticks;
+  bool render = PresetPlayer.Update(ticks - last_render_ticks, output_levels);
+  last_render_ticks = ticks;
+
+  if (Effects.GateChanged() || Calibration.MatrixChanged() || render)
+    WriteOutputs();
+
   if (WidgetSettings.PerformWrite()) {
     rdm_handler.QueueSetDeviceLabel();
   }
+
+  if (WidgetSettings.CommitSnapshot())
+    ReloadSettings();
 }
 
+
+/**
+ * Apply the widget parameters to the DMX ports.
+ */
+void ApplyDeviceParams() {
+#if DMX_PORT_COUNT > 0
+  DmxTransmitter.SetTiming(device_params[BREAK_TIME_PARAM],
+                           device_params[MAB_TIME_PARAM],
+                           device_params[REFRESH_RATE_PARAM]);
+#endif
+}
+
+
+/**
+ * Handle a set widget parameters request. This is the user config size, the
+ * break & MAB times, refresh rate and then the user config which we ignore.
+ */
+void SetDeviceParams(const byte *message, unsigned int message_size) {
+  if (message_size < 5)
+    return;
+  device_params[BREAK_TIME_PARAM] = message[2];
+  device_params[MAB_TIME_PARAM] = message[3];
+  device_params[REFRESH_RATE_PARAM] = message[4];
+  ApplyDeviceParams();
+}
+
+
 /*
  * Called when a full message is received from the host.
  * @param label the message label.
@@ -122,20 +384,21 @@ void Idle() {
  * @param message_size the size of the message.
  */
 void TakeAction(byte label, const byte *message, unsigned int message_size) {
+  PROFILE_SCOPE(PROFILE_TAKE_ACTION);
   switch (label) {
     case PARAMETERS_LABEL:
       // Widget Parameters request
       sender.WriteMessage(PARAMETERS_LABEL,
-                          sizeof(DEVICE_PARAMS),
-                          DEVICE_PARAMS);
+                          sizeof(device_params),
+                          device_params);
+      break;
+    case SET_PARAMETERS_LABEL:
+      SetDeviceParams(message, message_size);
       break;
     case DMX_DATA_LABEL:
-      if (message[0] == 0) {
-        // 0 start code
-        led_state = !led_state;
-        digitalWrite(LED_PIN, led_state);
-        SetPWM(&message[1], message_size);
-       }
+    case DMX_DATA_PORT2_LABEL:
+    case DMX_DATA_PORT3_LABEL:
+      ApplyDmxFrame(label, message, message_size);
       break;
     case SERIAL_NUMBER_LABEL:
       SendSerialNumberResponse();
@@ -146,37 +409,110 @@ void TakeAction(byte label, const byte *message, unsigned int message_size) {
     case MANUFACTURER_LABEL:
       SendManufacturerResponse();
       break;
+    case COUNTERS_LABEL:
+      SendCounters();
+      break;
+    case CONFIG_LABEL:
+      // an empty message returns the snapshot
+      if (message_size)
+        ApplyConfig(message, message_size);
+      else
+        SendConfig();
+      break;
+    case SYNC_LABEL:
+      // an empty message applies the staged frame, otherwise the first byte
+      // turns sync mode on or off
+      if (message_size)
+        OutputSync.SetEnabled(message[0]);
+      else
+        OutputSync.Sync();
+      break;
      case RDM_LABEL:
-      led_state = !led_state;
-      digitalWrite(LED_PIN, led_state);
+      Board::LedPin::Toggle();
+      rdm_handler_busy = true;
       rdm_handler.HandleRDMMessage(message, message_size);
+      rdm_handler_busy = false;
+      break;
+    case RDM_BATCH_LABEL:
+      Board::LedPin::Toggle();
+      rdm_handler_busy = true;
+      rdm_handler.HandleRDMBatch(message, message_size);
+      rdm_handler_busy = false;
       break;
+#ifdef PROFILE
+    case PROFILE_LABEL:
+      // a non-zero first byte clears the counters once they're sent
+      Profiler.SendCounters(sender, message_size && message[0]);
+      break;
+#endif
   }
 }
 
 
+/*
+ * Called as each byte of a message arrives. RDM messages are validated as
+ * they stream in so we can stop buffering messages for other devices. This
+ * is only used on boards where the host messages aren't received by the
+ * USART interrupt.
+ * @param label the message label.
+ * @param offset the offset of the byte in the message data.
+ * @param data the byte.
+ * @return false if the rest of the message doesn't need to be buffered.
+ */
+bool FilterData(byte label, unsigned int offset, byte data) {
+  if (label != RDM_LABEL)
+    return true;
+  return rdm_handler.ValidateByte(offset, data);
+}
+
+
 /**
- * The main function
+ * Set up the hardware & restore the settings. The host replay harness calls
+ * this and then runs the main loop itself.
  */
-int main(void) {
+void Setup() {
   init();
 
   WidgetSettings.Init();
-  byte personality = WidgetSettings.Personality();
+  Responders.Init();
+  Calibration.Init();
+  OutputMap.Compile(WidgetSettings.Personality(),
+                    WidgetSettings.StartAddress());
 
   // set the output pin levels according to the personality
-  for (byte i = 0; i < sizeof(PWM_PINS); i++) {
-    pinMode(PWM_PINS[i], OUTPUT);
-    bool invert = false;
-    invert |= i < 3 && personality > 1;
-    invert |= i >= 3 && personality == 3;
-    analogWrite(PWM_PINS[i], invert ? 255 : 0);
-  }
+  PROFILE_INIT();
+  PwmDriver.Init();
+  PwmCarrier.Init();
+  WriteOutputs();
 
-  pinMode(LED_PIN, OUTPUT);
-  digitalWrite(LED_PIN, led_state);
+#if DMX_PORT_COUNT > 0
+  DmxTransmitter.Init();
+#endif
+#ifdef DMX_INPUT
+  DmxReceiver.Init();
+#endif
+  ApplyDeviceParams();
 
-  UsbProReceiver receiver(TakeAction, Idle);
+  // resume playback, this runs without a host attached
+  PresetPlayer.Start(WidgetSettings.PresetPlaybackMode(),
+                     WidgetSettings.PresetPlaybackLevel());
+
+  Scheduler.SetTask(ApplyWaitingDmx);
+#ifdef DMX_INPUT
+  Scheduler.SetEepromTask(AnswerLineRDMDuringWrite);
+#endif
+
+  Board::LedPin::Output();
+  Board::LedPin::Low();
+}
+
+
+/**
+ * The main function
+ */
+int main(void) {
+  Setup();
+  UsbProReceiver receiver(TakeAction, Idle, FilterData);
   // this never returns
   receiver.Read();
   return 0;